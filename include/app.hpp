@@ -5,6 +5,8 @@
  **/
 #pragma once
 
+#include <string>
+
 #include <axolote/engine.hpp>
 
 #include "celestial_body_system.hpp"
@@ -28,6 +30,9 @@ public:
     /** Celestial bodies **/
     std::shared_ptr<CelestialBodySystem> bodies_system
         = std::make_shared<CelestialBodySystem>();
+    /** Integrator given on the command line, replaces the one of the
+     * config when not empty **/
+    std::string integrator;
 
     /**
      * \brief renders simulation in real time mode
@@ -73,7 +78,23 @@ private:
     struct BenchmarkEntry {
         CelestialBodySystem::SimulationAlgorithm algorithm;
         const char *name;
+        CelestialBodySystem::TreeBuilder tree_builder
+            = CelestialBodySystem::TreeBuilder::Insertion;
+        bool octree_refit = false;
+        bool reuse_lists = false;
+        std::uint32_t reorder_interval = 0;
     };
+    /**
+     * \brief Overrides a config with the command line options
+     * \param data - json data
+     **/
+    void apply_options(nlohmann::json &data) const;
+    /**
+     * \brief benchmarks OcTree against LinearOcTree on the same bodies
+     * \param data - json data
+     * \param repetitions - how many times each tree is built and traversed
+     **/
+    void benchmark_octrees(nlohmann::json &data, std::size_t repetitions);
     /**
      * \brief update focus point
      * \author João Vitor Espig (JotaEspig)
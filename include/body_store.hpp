@@ -0,0 +1,274 @@
+/**
+ * \file body_store.hpp
+ * \brief Structure of arrays holding every body of the simulation
+ **/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+/**
+ * \brief Bodies of the simulation stored as parallel arrays
+ *
+ * Positions, velocities, masses and radii are contiguous so the trees, the
+ * collision phase and the integrators stream through them, and the render
+ * only data (colors, model matrices) stays out of the way. A body is
+ * addressed by its index, which changes when removed bodies are compacted
+ * away, or by its id, which is kept for as long as the body lives.
+ **/
+class BodyStore {
+public:
+    /** Stable identifier of a body **/
+    using Id = std::uint32_t;
+    /** Index or id of no body **/
+    static constexpr std::uint32_t null_index = 0xFFFFFFFFu;
+
+    /**
+     * \brief Per body access to a store through a stable id
+     *
+     * Stays valid across compactions, and becomes invalid once the body is
+     * removed and compacted away
+     **/
+    class Handle {
+    public:
+        /**
+         * \brief Default constructor, invalid handle
+         **/
+        Handle() = default;
+        /**
+         * \brief Constructor
+         * \param store - store holding the body
+         * \param id - id of the body
+         **/
+        Handle(BodyStore *store, Id id);
+
+        /**
+         * \brief Id getter
+         * \returns id of the body
+         **/
+        Id id() const;
+        /**
+         * \brief Is valid
+         * \returns true if the body is still in the store
+         **/
+        bool is_valid() const;
+        /**
+         * \brief Index getter
+         * \returns current index of the body
+         **/
+        std::size_t index() const;
+        /**
+         * \brief Position getter
+         * \returns position of the body
+         **/
+        glm::vec3 &pos() const;
+        /**
+         * \brief Velocity getter
+         * \returns velocity of the body
+         **/
+        glm::vec3 &velocity() const;
+        /**
+         * \brief Mass getter
+         * \returns mass of the body
+         **/
+        float mass() const;
+        /**
+         * \brief Radius getter
+         * \returns radius of the body
+         **/
+        float radius() const;
+
+    private:
+        /** Store holding the body **/
+        BodyStore *_store = nullptr;
+        /** Id of the body **/
+        Id _id = null_index;
+    };
+
+    /**
+     * \brief Amount of bodies, removed ones included until compact()
+     * \returns amount of bodies
+     **/
+    std::size_t size() const;
+    /**
+     * \brief Is empty
+     * \returns true if there are no bodies
+     **/
+    bool empty() const;
+    /**
+     * \brief Removes every body and forgets every id
+     **/
+    void clear();
+    /**
+     * \brief Reserves memory for bodies
+     * \param count - amount of bodies
+     **/
+    void reserve(std::size_t count);
+    /**
+     * \brief Adds a body at the end of the arrays
+     * \param mass - mass
+     * \param pos - position
+     * \param velocity - velocity
+     * \returns handle of the new body
+     **/
+    Handle add(float mass, const glm::vec3 &pos, const glm::vec3 &velocity);
+    /**
+     * \brief Handle of a body
+     * \param body - index of the body
+     * \returns handle
+     **/
+    Handle handle(std::size_t body);
+    /**
+     * \brief Handle of a body
+     * \param id - id of the body
+     * \returns handle, invalid if the body is gone
+     **/
+    Handle find(Id id);
+    /**
+     * \brief Index of a body
+     * \param id - id of the body
+     * \returns index, or null_index if the body is gone
+     **/
+    std::uint32_t index_of(Id id) const;
+
+    /**
+     * \brief Positions getter
+     * \returns position of each body
+     **/
+    const std::vector<glm::vec3> &positions() const;
+    /**
+     * \brief Positions getter
+     * \returns position of each body
+     **/
+    std::vector<glm::vec3> &positions();
+    /**
+     * \brief Velocities getter
+     * \returns velocity of each body
+     **/
+    const std::vector<glm::vec3> &velocities() const;
+    /**
+     * \brief Velocities getter
+     * \returns velocity of each body
+     **/
+    std::vector<glm::vec3> &velocities();
+    /**
+     * \brief Masses getter, use set_mass() to change them
+     * \returns mass of each body
+     *
+     * Masses are float, masses given as double are rounded once when the
+     * body is added. Sums of them, like the node masses OcTree keeps in
+     * double, follow that rounding.
+     **/
+    const std::vector<float> &masses() const;
+    /**
+     * \brief Radii getter, follow the masses
+     * \returns radius of each body
+     **/
+    const std::vector<float> &radii() const;
+    /**
+     * \brief Colors getter, follow the masses
+     * \returns color of each body
+     **/
+    const std::vector<glm::vec3> &colors() const;
+    /**
+     * \brief Ids getter
+     * \returns id of each body
+     **/
+    const std::vector<Id> &ids() const;
+
+    /**
+     * \brief Mass setter, also sets radius and color
+     * \param body - index of the body
+     * \param mass - new mass
+     **/
+    void set_mass(std::size_t body, float mass);
+    /**
+     * \brief Flags a body to be removed by the next compact()
+     * \param body - index of the body
+     *
+     * Safe to call concurrently on different bodies
+     **/
+    void remove(std::size_t body);
+    /**
+     * \brief Is removed
+     * \param body - index of the body
+     * \returns true if the body is flagged to be removed
+     **/
+    bool is_removed(std::size_t body) const;
+    /**
+     * \brief Erases the removed bodies keeping the order of the others
+     * \returns amount of bodies erased
+     *
+     * Indices of the bodies after an erased one shift down, ids are kept
+     **/
+    std::size_t compact();
+    /**
+     * \brief Moves the bodies into a new order
+     * \param order - index of the body that goes at each index, a
+     * permutation of every index
+     *
+     * Ids are kept, so bodies can be sorted for locality and still be found
+     * through their id
+     **/
+    void reorder(const std::vector<std::uint32_t> &order);
+
+    /**
+     * \brief Checks if two bodies are colliding
+     * \param a - index of a body
+     * \param b - index of another body
+     * \returns true if their spheres overlap
+     **/
+    bool is_colliding(std::size_t a, std::size_t b) const;
+    /**
+     * \brief Checks if two colliding bodies should merge
+     * \param a - index of a body
+     * \param b - index of another body
+     * \returns true if one is massive enough or they are close enough
+     **/
+    bool should_merge(std::size_t a, std::size_t b) const;
+    /**
+     * \brief Treats the collision between two bodies
+     * \param a - index of the body pushed away
+     * \param b - index of the other body
+     *
+     * If the two bodies are too close they are merged into a, otherwise a
+     * gets an "elastic" response
+     **/
+    void collide(std::size_t a, std::size_t b);
+    /**
+     * \brief Merges a body into another one
+     * \param a - index of the body kept
+     * \param b - index of the body removed
+     *
+     * Mass, position and velocity of a become the ones of the union,
+     * weighted by mass
+     **/
+    void merge(std::size_t a, std::size_t b);
+    /**
+     * \brief Model matrix of a body for the instanced render
+     * \param body - index of the body
+     * \returns translation to its position scaled by its radius
+     **/
+    glm::mat4 model_matrix(std::size_t body) const;
+
+private:
+    /** Position of each body **/
+    std::vector<glm::vec3> _positions;
+    /** Velocity of each body **/
+    std::vector<glm::vec3> _velocities;
+    /** Mass of each body **/
+    std::vector<float> _masses;
+    /** Radius of each body **/
+    std::vector<float> _radii;
+    /** Color of each body **/
+    std::vector<glm::vec3> _colors;
+    /** Is each body flagged to be removed **/
+    std::vector<std::uint8_t> _removed;
+    /** Id of each body **/
+    std::vector<Id> _ids;
+    /** Index of each id, null_index once the body is gone **/
+    std::vector<std::uint32_t> _indices;
+};
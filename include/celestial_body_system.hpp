@@ -5,6 +5,7 @@
  **/
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <vector>
 
@@ -12,9 +13,17 @@
 #include <glm/glm.hpp>
 #include <nlohmann/json.hpp>
 
-#include "celestial_body.hpp"
+#include "body_store.hpp"
+#include "collision_detector.hpp"
+#include "direct_sum.hpp"
+#include "fast_multipole.hpp"
 #include "gravitational_grid.hpp"
+#include "hermite.hpp"
+#include "integrator.hpp"
+#include "kd_tree.hpp"
+#include "linear_octree.hpp"
 #include "octree.hpp"
+#include "particle_mesh.hpp"
 #include "sphere.hpp"
 
 /**
@@ -23,12 +32,112 @@
  **/
 class CelestialBodySystem : public axolote::Drawable {
 public:
-    enum class SimulationAlgorithm { Naive, BarnesHut, BarnesHutOpenMP };
+    enum class SimulationAlgorithm {
+        Naive,
+        NaiveOpenMP,
+        BarnesHut,
+        BarnesHutOpenMP,
+        FMM,
+        Hermite,
+        TreePM
+    };
     SimulationAlgorithm algorithm = SimulationAlgorithm::BarnesHutOpenMP;
+    /**
+     * \brief Tree source of the Barnes-Hut algorithms
+     *
+     * Insertion builds the OcTree one body at a time. Morton builds the
+     * LinearOcTree in parallel from sorted Morton keys. KdTree builds the
+     * KdTree, which follows clustered bodies more closely. Collisions are
+     * resolved before any build, see detect_collisions.
+     **/
+    enum class TreeBuilder { Insertion, Morton, KdTree };
+    TreeBuilder tree_builder = TreeBuilder::Insertion;
+    /** Refit the linear octree between steps instead of rebuilding it, only
+     * used by TreeBuilder::Morton. Always done while
+     * LinearOcTree::reuse_lists is set **/
+    bool octree_refit = false;
+    /** Find and resolve collisions before each step **/
+    bool detect_collisions = true;
+    /** The root cube of the trees is the fixed domain below instead of
+     * following the extent of the bodies, bodies leaving it are erased **/
+    bool fixed_domain = false;
+    /** 3D point where the fixed domain starts **/
+    glm::vec3 domain_start{-1000.0f, -1000.0f, -1000.0f};
+    /** Width of the fixed domain **/
+    float domain_width = 2000.0f;
+    /** Fraction of the extent of the bodies added on each side of a new
+     * root cube **/
+    float domain_padding = 0.05f;
+    /** The root cube is kept while it holds every body and the extent of
+     * the bodies is at least this fraction of its width **/
+    float domain_hysteresis = 0.5f;
+    /**
+     * \brief Arithmetic of the OcTree and KdTree walks of
+     * TreeBuilder::Insertion and TreeBuilder::KdTree
+     *
+     * The "precision" key also sets it on direct and linear_octree.
+     * SimulationAlgorithm::FMM and SimulationAlgorithm::Hermite ignore it:
+     * the fast multipole solver keeps its expansions in double and its near
+     * field in float, Hermite works in double.
+     **/
+    Precision precision = Precision::Float;
+    /**
+     * \brief Bodies of this mass or less are test particles
+     *
+     * Test particles feel gravity without being sources of it: they are left
+     * out of the trees and of the direct sums, and their accelerations come
+     * from a parallel pass over them once the sources are evaluated. The
+     * collision detector has its own threshold.
+     **/
+    float test_particle_mass = 0.0f;
+    /**
+     * \brief The heaviest bodies are summed directly instead of going in
+     * the trees
+     *
+     * Only used by the Barnes-Hut, fast multipole and TreePM algorithms.
+     * The heavy bodies walk the tree of the others like test particles, and
+     * their own gravity is added to every body by an exact direct sum. This
+     * many of the heaviest bodies are taken, the lowest index first among
+     * equal masses, 0 for none.
+     **/
+    std::uint32_t heavy_bodies = 0;
+    /** Bodies holding at least this fraction of the total mass are summed
+     * directly too, 0 for none **/
+    float heavy_mass_fraction = 0.0f;
+    /**
+     * \brief Steps between two sorts of the bodies by Morton key, 0 to keep
+     * the order they were added in
+     *
+     * Bodies close in space end up close in memory, so consecutive bodies
+     * of the parallel loops walk the same parts of the trees and a thread
+     * gets a compact region. Bodies keep their id, see BodyStore::reorder().
+     * Not used by SimulationAlgorithm::Hermite.
+     **/
+    std::uint32_t reorder_interval = 0;
 
     std::shared_ptr<GravGrid> grav_grid;
     /** Octree **/
     OcTree octree;
+    /** Kd-tree, used by TreeBuilder::KdTree **/
+    KdTree kd_tree;
+    /** Linear octree, used by TreeBuilder::Morton,
+     * SimulationAlgorithm::FMM and SimulationAlgorithm::TreePM **/
+    LinearOcTree linear_octree;
+    /** Fast multipole solver, used by SimulationAlgorithm::FMM **/
+    FastMultipole fmm;
+    /** Long range solver of SimulationAlgorithm::TreePM, the linear octree
+     * gives the short range part **/
+    ParticleMesh mesh;
+    /** Direct summation, used by SimulationAlgorithm::Naive and
+     * SimulationAlgorithm::NaiveOpenMP **/
+    DirectSum direct;
+    /** Time integration, the algorithm only gives the accelerations **/
+    Integrator integrator;
+    /** Direct Hermite integration, used by SimulationAlgorithm::Hermite
+     * instead of the integrator **/
+    Hermite hermite;
+    /** Collision phase, used when detect_collisions is set **/
+    CollisionDetector collision_detector;
     /** Sphere mesh OpenGL object **/
     Sphere sphere;
 
@@ -61,16 +170,15 @@ public:
      * \param mass - mass
      * \param pos - position
      * \param vel - velocity
-     * \returns shared pointer to the body
+     * \returns handle of the body
      **/
-    std::shared_ptr<CelestialBody>
-    add_body(double mass, glm::vec3 pos, glm::vec3 vel);
+    BodyStore::Handle add_body(double mass, glm::vec3 pos, glm::vec3 vel);
     /**
      * \brief Get celestial bodies
      * \author João Vitor Espig (JotaEspig)
-     * \returns vector of celestial bodies
+     * \returns store of celestial bodies
      **/
-    std::vector<std::shared_ptr<CelestialBody>> celestial_bodies() const;
+    const BodyStore &celestial_bodies() const;
     /**
      * \brief Update instanced VBOs
      * \author João Vitor Espig (JotaEspig)
@@ -124,14 +232,102 @@ private:
     /** Instanced Color VBO **/
     std::shared_ptr<axolote::gl::VBO> instanced_colors_vbo
         = axolote::gl::VBO::create();
-    /** Vector of celestial bodies on the simulation **/
-    std::vector<std::shared_ptr<CelestialBody>> _celestial_bodies;
+    /** Celestial bodies on the simulation **/
+    BodyStore _bodies;
+    /** Model matrices packed for the instanced VBO **/
+    std::vector<glm::mat4> _model_matrices;
+    /** Colors packed for the instanced VBO **/
+    std::vector<glm::vec4> _colors;
+    /** Accelerations of the step, from the linear octree, the fast multipole
+     * solver or the direct sum **/
+    std::vector<glm::vec3> _accelerations;
+    /** Are some bodies left out of the algorithm set, test particles or
+     * heavy bodies **/
+    bool _split = false;
+    /** Bodies the algorithm set pulls from, only used while _split **/
+    std::vector<std::uint32_t> _sources;
+    /** Bodies of at most test_particle_mass **/
+    std::vector<std::uint32_t> _test_particles;
+    /** Bodies summed directly, see heavy_bodies **/
+    std::vector<std::uint32_t> _heavy;
+    /** Positions of the heavy bodies **/
+    std::vector<glm::vec3> _heavy_positions;
+    /** Masses of the heavy bodies **/
+    std::vector<float> _heavy_masses;
+    /** Acceleration of each body from the heavy bodies **/
+    std::vector<glm::vec3> _heavy_accelerations;
+    /** Candidates to heavy bodies, the picked ones first **/
+    std::vector<std::uint32_t> _mass_order;
+    /** Positions of the sources **/
+    std::vector<glm::vec3> _source_positions;
+    /** Masses of the sources **/
+    std::vector<float> _source_masses;
+    /** Active flag of each source **/
+    std::vector<std::uint8_t> _source_active;
+    /** Accelerations of the sources **/
+    std::vector<glm::vec3> _source_accelerations;
+    /** Test particles and heavy bodies evaluated by the current call **/
+    std::vector<std::uint32_t> _targets;
+    /** Positions of the targets **/
+    std::vector<glm::vec3> _target_positions;
+    /** Accelerations of the targets **/
+    std::vector<glm::vec3> _target_accelerations;
+    /** 3D point where the root cube of the trees starts **/
+    glm::vec3 _root_start{0.0f, 0.0f, 0.0f};
+    /** Width of the root cube of the trees, zero until the first build **/
+    float _root_width = 0.0f;
+    /** Steps since the bodies were last sorted, see reorder_interval **/
+    std::uint32_t _steps_since_reorder = 0;
+    /** Morton key of each body for the sort **/
+    std::vector<std::uint64_t> _reorder_keys;
+    /** Body that goes at each index once sorted **/
+    std::vector<std::uint32_t> _reorder_order;
+    /** Scratch keys for the radix sort **/
+    std::vector<std::uint64_t> _reorder_key_scratch;
+    /** Scratch bodies for the radix sort **/
+    std::vector<std::uint32_t> _reorder_scratch;
+    /** Accelerations in the new order **/
+    std::vector<glm::vec3> _reordered_accelerations;
+
+    /**
+     * \brief Fills the model matrices and colors of the instanced VBOs
+     **/
+    void pack_instances();
+    /**
+     * \brief Resolves the collisions of the step and removes the merged
+     * bodies
+     **/
+    void resolve_collisions();
+    /**
+     * \brief Updates the root cube of the trees
+     *
+     * Without a fixed domain the bounding box of the bodies is found with a
+     * parallel min/max reduction. The current cube is kept while it holds
+     * the box and is not too large for it, otherwise a new cube is centered
+     * on the box with domain_padding around it.
+     **/
+    void update_root_cube();
+    /**
+     * \brief Is outside of the fixed domain
+     * \param pos - position
+     * \returns true if a fixed domain is used and pos is outside of it
+     **/
+    bool is_outside_domain(const glm::vec3 &pos) const;
 
     /**
      * \brief Build octree
      * \author João Vitor Espig (JotaEspig)
+     *
+     * \param active - flag per source, nullptr for every source
+     *
+     * With TreeBuilder::Morton the accelerations of the active sources are
+     * also evaluated here, one tree walk per group of sources
      **/
-    void build_octree();
+    void build_octree(const std::vector<std::uint8_t> *active);
+    /**
+     * \brief Builds or refits the linear octree on the sources
+     **/
+    void build_linear_octree();
     /**
      * @brief Update gravity grid data
      *
@@ -142,22 +338,141 @@ private:
      *
      */
     void upload_gravity_grid();
+    /**
+     * \brief Calculates the accelerations of the algorithm set into
+     * _accelerations, called by the integrator
+     * \param active - flag per body, only the flagged bodies are evaluated,
+     * nullptr for every body
+     **/
+    void evaluate_accelerations(const std::vector<std::uint8_t> *active);
+    /**
+     * \brief Splits the bodies into sources, test particles and heavy
+     * bodies
+     * \param active - flag per body, nullptr for every body
+     *
+     * While some bodies are not sources the positions, masses and active
+     * flags of the sources are gathered for the algorithms
+     **/
+    void split_sources(const std::vector<std::uint8_t> *active);
+    /**
+     * \brief Fills _heavy from heavy_bodies and heavy_mass_fraction, in
+     * index order
+     **/
+    void select_heavy_bodies();
+    /**
+     * \brief Amount of bodies the algorithms pull from and evaluate
+     * \returns every body, or only the sources while _split
+     **/
+    std::uint32_t source_count() const;
+    /**
+     * \brief Body of a source
+     * \param source - index among the sources
+     * \returns index of the body
+     **/
+    std::uint32_t source_body(std::uint32_t source) const;
+    /**
+     * \brief Positions the algorithms pull from
+     * \returns positions of every body or of the sources only
+     **/
+    const std::vector<glm::vec3> &source_positions() const;
+    /**
+     * \brief Masses the algorithms pull from
+     * \returns masses of every body or of the sources only
+     **/
+    const std::vector<float> &source_masses() const;
+    /**
+     * \brief Accelerations the algorithms fill
+     * \returns _accelerations or the accelerations of the sources only
+     **/
+    std::vector<glm::vec3> &source_accelerations();
+    /**
+     * \brief Runs the algorithm set on the sources
+     * \param active - flag per source, nullptr for every source
+     **/
+    void evaluate_sources(const std::vector<std::uint8_t> *active);
+    /**
+     * \brief Accelerations of the test particles and heavy bodies from the
+     * sources, in parallel
+     * \param active - flag per body, nullptr for every body
+     *
+     * Uses the tree or the columns left by the algorithm set, so it must
+     * follow evaluate_sources()
+     **/
+    void target_accelerations(const std::vector<std::uint8_t> *active);
+    /**
+     * \brief Adds the gravity of the heavy bodies to every body
+     * \param active - flag per body, nullptr for every body
+     **/
+    void add_heavy_accelerations(const std::vector<std::uint8_t> *active);
     /**
      * \brief Naive algorithm O(n²)
      * \author João Vitor Espig (JotaEspig)
-     * \param dt - delta time
+     * \param active - flag per source, nullptr for every source
      **/
-    void naive_algorithm(double dt);
+    void naive_algorithm(const std::vector<std::uint8_t> *active);
+    /**
+     * \brief Naive algorithm O(n²) using OpenMP, each pair is evaluated once
+     * \param active - flag per source, nullptr for every source
+     **/
+    void naive_algorithm_openmp(const std::vector<std::uint8_t> *active);
     /**
      * \brief Barnes-Hut algorithm O(n log n)
      * \author João Vitor Espig (JotaEspig)
-     * \param dt - delta time
+     * \param active - flag per source, nullptr for every source
      **/
-    void barnes_hut_algorithm(double dt);
+    void barnes_hut_algorithm(const std::vector<std::uint8_t> *active);
     /**
      * \brief Barnes-Hut algorithm O(n log n) using OpenMP to parallelize
      * \author João Vitor Espig (JotaEspig)
-     * \param dt - delta time
+     * \param active - flag per source, nullptr for every source
      */
-    void barnes_hut_algorithm_openmp(double dt);
+    void barnes_hut_algorithm_openmp(const std::vector<std::uint8_t> *active);
+    /**
+     * \brief Is the softening of the tree octree_accelerations() walks
+     * positive
+     * \returns true if the OcTree, or the KdTree with TreeBuilder::KdTree,
+     * softens
+     **/
+    bool is_tree_softened() const;
+    /**
+     * \brief Accelerations of the sources from the OcTree, or from the
+     * KdTree with TreeBuilder::KdTree
+     * \tparam precision - precision of the walk
+     * \tparam softened - soften the body to body terms, see
+     * is_tree_softened()
+     * \param active - flag per source, nullptr for every source
+     * \param parallel - spread the bodies over the OpenMP threads
+     **/
+    template <Precision precision, bool softened>
+    void octree_accelerations(
+        const std::vector<std::uint8_t> *active, bool parallel
+    );
+    /**
+     * \brief Fast multipole method O(n) on the linear octree
+     *
+     * Evaluates every body, the expansions are shared by all of them
+     **/
+    void fmm_algorithm();
+    /**
+     * \brief TreePM, long range gravity from a mesh and short range
+     * gravity from the linear octree
+     * \param active - flag per source, nullptr for every source
+     *
+     * O(n log n) like Barnes-Hut, but the tree walk stops a few split scales
+     * away from each group, so its lists stay short on large, roughly
+     * uniform systems
+     **/
+    void tree_pm_algorithm(const std::vector<std::uint8_t> *active);
+    /**
+     * \brief Erases the bodies that left the fixed domain
+     **/
+    void erase_outside_domain();
+    /**
+     * \brief Sorts the bodies by the Morton key of their position in the
+     * root cube, see reorder_interval
+     *
+     * What is kept between steps about the bodies, the accelerations and
+     * the integrator state, follows them
+     **/
+    void reorder_bodies();
 };
@@ -0,0 +1,143 @@
+/**
+ * \file collision_detector.hpp
+ * \brief Collision phase run apart from the tree builds
+ **/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "body_store.hpp"
+
+/**
+ * \brief Finds and resolves the collisions between bodies
+ *
+ * The broad phase hashes every body into a uniform grid whose cells are at
+ * least as wide as the largest collision distance, so colliding bodies are
+ * always in the same or in neighbouring cells. Cells are identified by the
+ * Morton key of their coordinates and bodies are radix sorted by key. Each
+ * occupied cell then tests its own bodies and the ones of the 13 neighbours
+ * after it, found through a hash table, in parallel.
+ *
+ * Test particles, bodies of at most test_particle_mass, are left out of the
+ * grid. Each of them is tested afterwards against the bodies of its own
+ * cell and of the 26 around it, so they are still swept up by heavier
+ * bodies but never tested against each other.
+ *
+ * Candidate pairs are resolved in a fixed order, so the outcome does not
+ * depend on the number of threads or on the order of a tree build. Pairs
+ * that should merge are joined with a union-find, every group merges into
+ * its body of lowest index, and the remaining pairs get an elastic response.
+ **/
+class CollisionDetector {
+public:
+    /** Bodies of this mass or less are test particles, which only collide
+     * with heavier bodies **/
+    float test_particle_mass = 0.0f;
+
+    /**
+     * \brief Finds and resolves the collisions of a step
+     * \param bodies - bodies, the ones already removed are ignored
+     * \returns number of bodies merged into others by this call
+     *
+     * Merged bodies are only flagged as removed, the caller compacts them
+     **/
+    std::size_t resolve(BodyStore &bodies);
+    /**
+     * \brief Pairs found by the last call to resolve()
+     * \returns colliding pairs of body indices, lower index first, sorted
+     **/
+    const std::vector<std::pair<std::uint32_t, std::uint32_t>> &pairs() const;
+
+private:
+    /** Cell keys of the bodies, sorted **/
+    std::vector<std::uint64_t> _keys;
+    /** Body of each sorted key **/
+    std::vector<std::uint32_t> _sorted_bodies;
+    /** Scratch keys for the radix sort **/
+    std::vector<std::uint64_t> _key_scratch;
+    /** Scratch values for the radix sort **/
+    std::vector<std::uint32_t> _value_scratch;
+    /** Integer coordinates of the cell of each body **/
+    std::vector<glm::uvec3> _cells;
+    /** X coordinates in sorted order **/
+    std::vector<float> _x;
+    /** Y coordinates in sorted order **/
+    std::vector<float> _y;
+    /** Z coordinates in sorted order **/
+    std::vector<float> _z;
+    /** Radii in sorted order **/
+    std::vector<float> _radii;
+    /** Test particles of the step, by index **/
+    std::vector<std::uint32_t> _test_particles;
+    /** Keys of the occupied cells, sorted **/
+    std::vector<std::uint64_t> _cell_keys;
+    /** Offset of the first sorted body of each occupied cell, one more
+     * entry closes the last cell **/
+    std::vector<std::uint32_t> _cell_starts;
+    /** Open addressing hash table of the occupied cells, index inside
+     * _cell_keys per slot **/
+    std::vector<std::uint32_t> _cell_table;
+    /** Colliding pairs found by the broad phase **/
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> _pairs;
+    /** Pairs found by each thread **/
+    std::vector<std::vector<std::pair<std::uint32_t, std::uint32_t>>>
+        _thread_pairs;
+    /** Does each pair merge **/
+    std::vector<std::uint8_t> _merges;
+    /** Is each body part of a merging pair **/
+    std::vector<std::uint8_t> _merging;
+    /** Union-find parent of each body **/
+    std::vector<std::uint32_t> _parents;
+
+    /**
+     * \brief Fills _pairs with every colliding pair
+     * \param bodies - bodies
+     **/
+    void find_pairs(const BodyStore &bodies);
+    /**
+     * \brief Adds the pair of two sorted bodies if they collide
+     * \param s - sorted index of a body
+     * \param t - sorted index of another body
+     * \param pairs - receives the pair of body indices
+     **/
+    void add_if_colliding(
+        std::uint32_t s, std::uint32_t t,
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> &pairs
+    ) const;
+    /**
+     * \brief Adds the pair of a test particle and a sorted body if they
+     * collide
+     * \param bodies - bodies
+     * \param i - index of the test particle
+     * \param t - sorted index of the other body
+     * \param pairs - receives the pair of body indices
+     **/
+    void add_if_touching(
+        const BodyStore &bodies, std::uint32_t i, std::uint32_t t,
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> &pairs
+    ) const;
+    /**
+     * \brief Index of an occupied cell
+     * \param key - key of the cell
+     * \returns index inside _cell_keys, or _cell_keys.size() if the cell is
+     * empty
+     **/
+    std::size_t find_cell(std::uint64_t key) const;
+    /**
+     * \brief Union-find root of a body, halving the path on the way
+     * \param body - index of the body
+     * \returns root of its group
+     **/
+    std::uint32_t find_root(std::uint32_t body);
+    /**
+     * \brief Joins the groups of two bodies, the lower root is kept
+     * \param a - index of a body
+     * \param b - index of a body
+     **/
+    void join(std::uint32_t a, std::uint32_t b);
+};
@@ -0,0 +1,275 @@
+/**
+ * \file direct_sum.hpp
+ * \brief Vectorized direct summation of the gravity of point masses
+ **/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "gravity_kernel.hpp"
+
+/** Bodies per tile of DirectSum::symmetric_accelerations(), the columns of
+ * two tiles stay in L1 **/
+#define DIRECT_SUM_TILE 256
+
+/**
+ * \brief Sums the gravity of point masses on a position, divided by G
+ * \param x - x of each source
+ * \param y - y of each source
+ * \param z - z of each source
+ * \param mass - mass of each source
+ * \param count - amount of sources
+ * \param pos - position
+ * \param softening2 - squared Plummer softening length
+ * \returns acceleration divided by G
+ *
+ * Sources at distance zero, the body itself included, add nothing. The
+ * kernel is picked at startup from the CPU: with AVX-512 it takes 16 sources
+ * per instruction, with AVX2 and FMA 8, both with masked loads for the
+ * remainder and a reciprocal square root refined by DIRECT_SUM_NEWTON_STEPS
+ * of direct_sum_simd.hpp.
+ * Other CPUs get a portable loop left to the compiler.
+ **/
+glm::vec3 direct_sum(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, const glm::vec3 &pos, float softening2
+);
+
+/**
+ * \brief Name of the instruction set picked for the direct sum kernels
+ * \returns "avx512", "avx2" or "portable"
+ **/
+const char *direct_sum_isa();
+
+/**
+ * \brief direct_sum() in the arithmetic of a precision
+ * \tparam precision - precision, Float is direct_sum() itself
+ * \param x - x of each source
+ * \param y - y of each source
+ * \param z - z of each source
+ * \param mass - mass of each source
+ * \param count - amount of sources
+ * \param pos - position
+ * \param softening2 - squared Plummer softening length
+ * \returns acceleration divided by G
+ **/
+template <Precision precision>
+inline glm::vec3 direct_sum_in(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, const glm::vec3 &pos, float softening2
+) {
+    if constexpr (precision == Precision::Float) {
+        return direct_sum(x, y, z, mass, count, pos, softening2);
+    } else {
+        using Types = PrecisionTypes<precision>;
+        return direct_sum_as<
+            typename Types::Scalar, typename Types::Accumulator>(
+            x, y, z, mass, count, pos, softening2
+        );
+    }
+}
+
+/**
+ * \brief Sums the short range gravity of point masses on a position, divided
+ * by G
+ * \param x - x of each source
+ * \param y - y of each source
+ * \param z - z of each source
+ * \param mass - mass of each source
+ * \param count - amount of sources
+ * \param pos - position
+ * \param softening2 - squared Plummer softening length
+ * \param split_radius - scale r_s of the Gaussian split
+ * \returns acceleration divided by G
+ *
+ * short_range_sum_as() in float, built for the instruction set picked for
+ * direct_sum(), where the lookups of the factor table are gathers
+ **/
+glm::vec3 short_range_sum(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, const glm::vec3 &pos, float softening2,
+    float split_radius
+);
+
+/**
+ * \brief short_range_sum() in the arithmetic of a precision
+ * \tparam precision - precision, Float is short_range_sum() itself
+ * \param x - x of each source
+ * \param y - y of each source
+ * \param z - z of each source
+ * \param mass - mass of each source
+ * \param count - amount of sources
+ * \param pos - position
+ * \param softening2 - squared Plummer softening length
+ * \param split_radius - scale r_s of the Gaussian split
+ * \returns acceleration divided by G
+ **/
+template <Precision precision>
+inline glm::vec3 short_range_sum_in(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, const glm::vec3 &pos, float softening2,
+    float split_radius
+) {
+    if constexpr (precision == Precision::Float) {
+        return short_range_sum(
+            x, y, z, mass, count, pos, softening2, split_radius
+        );
+    } else {
+        using Types = PrecisionTypes<precision>;
+        return short_range_sum_as<
+            typename Types::Scalar, typename Types::Accumulator>(
+            x, y, z, mass, count, pos, softening2, split_radius
+        );
+    }
+}
+
+/**
+ * \brief Exact O(N²) gravity between every pair of bodies
+ *
+ * Keeps the sources as one column per component so direct_sum() streams
+ * through them
+ **/
+class DirectSum {
+public:
+    /** Plummer softening length, 0 for plain Newtonian gravity **/
+    float softening = 0.0f;
+    /** Arithmetic of accelerations() and active_accelerations(),
+     * symmetric_accelerations() is always Float **/
+    Precision precision = Precision::Float;
+
+    /**
+     * \brief Calculates the net acceleration on every body
+     * \param positions - body positions
+     * \param masses - body masses
+     * \param accelerations - receives the acceleration of each body
+     **/
+    void accelerations(
+        const std::vector<glm::vec3> &positions,
+        const std::vector<float> &masses,
+        std::vector<glm::vec3> &accelerations
+    );
+    /**
+     * \brief Calculates the net acceleration on every body in parallel
+     * \param positions - body positions
+     * \param masses - body masses
+     * \param accelerations - receives the acceleration of each body
+     *
+     * Bodies are cut in tiles of DIRECT_SUM_TILE and threads take pairs of
+     * tiles. Each pair of bodies is evaluated once and its force is added to
+     * both, into one accumulator per thread, so there are half the pairs of
+     * accelerations(). The accumulators are summed at the end.
+     **/
+    void symmetric_accelerations(
+        const std::vector<glm::vec3> &positions,
+        const std::vector<float> &masses,
+        std::vector<glm::vec3> &accelerations
+    );
+    /**
+     * \brief Calculates the net acceleration on some bodies in parallel
+     * \param positions - body positions
+     * \param masses - body masses
+     * \param active - flag per body, only the flagged bodies are evaluated,
+     * nullptr for every body
+     * \param accelerations - receives the acceleration of each flagged body,
+     * the others are kept
+     **/
+    void active_accelerations(
+        const std::vector<glm::vec3> &positions,
+        const std::vector<float> &masses,
+        const std::vector<std::uint8_t> *active,
+        std::vector<glm::vec3> &accelerations
+    );
+
+    /**
+     * \brief Calculates the acceleration at positions that pull on nothing,
+     * in parallel
+     * \param positions - body positions
+     * \param masses - body masses
+     * \param targets - positions evaluated, such as test particles
+     * \param accelerations - receives the acceleration at each target
+     **/
+    void field_accelerations(
+        const std::vector<glm::vec3> &positions,
+        const std::vector<float> &masses,
+        const std::vector<glm::vec3> &targets,
+        std::vector<glm::vec3> &accelerations
+    );
+
+private:
+    /** X of each body **/
+    std::vector<float> _x;
+    /** Y of each body **/
+    std::vector<float> _y;
+    /** Z of each body **/
+    std::vector<float> _z;
+    /** Accelerations summed by each thread, x, y and z columns of all the
+     * bodies one after the other **/
+    std::vector<std::vector<float>> _thread_accelerations;
+
+    /**
+     * \brief Fills the columns of the bodies
+     * \param positions - body positions
+     **/
+    void gather(const std::vector<glm::vec3> &positions);
+    /**
+     * \brief accelerations() once the columns are filled
+     * \tparam precision - precision of the sums
+     * \param positions - body positions
+     * \param masses - body masses
+     * \param accelerations - receives the acceleration of each body
+     **/
+    template <Precision precision>
+    void sum_accelerations(
+        const std::vector<glm::vec3> &positions,
+        const std::vector<float> &masses,
+        std::vector<glm::vec3> &accelerations
+    ) const;
+    /**
+     * \brief active_accelerations() once the columns are filled
+     * \tparam precision - precision of the sums
+     * \param positions - body positions
+     * \param masses - body masses
+     * \param active - flag per body or nullptr
+     * \param accelerations - receives the acceleration of each flagged body
+     **/
+    template <Precision precision>
+    void sum_active_accelerations(
+        const std::vector<glm::vec3> &positions,
+        const std::vector<float> &masses,
+        const std::vector<std::uint8_t> *active,
+        std::vector<glm::vec3> &accelerations
+    ) const;
+    /**
+     * \brief field_accelerations() once the columns are filled
+     * \tparam precision - precision of the sums
+     * \param masses - body masses
+     * \param targets - positions evaluated
+     * \param accelerations - receives the acceleration at each target
+     **/
+    template <Precision precision>
+    void sum_field_accelerations(
+        const std::vector<float> &masses,
+        const std::vector<glm::vec3> &targets,
+        std::vector<glm::vec3> &accelerations
+    ) const;
+    /**
+     * \brief Adds the forces between the bodies of two tiles to both
+     * \param first - first body of a tile
+     * \param first_end - one past its last body
+     * \param second - first body of the other tile, after the first one or
+     * the same tile
+     * \param second_end - one past its last body
+     * \param masses - body masses
+     * \param softening2 - squared softening length
+     * \param acc - accumulator of the thread
+     **/
+    void add_tile_pair(
+        std::size_t first, std::size_t first_end, std::size_t second,
+        std::size_t second_end, const float *masses, float softening2,
+        float *acc
+    ) const;
+};
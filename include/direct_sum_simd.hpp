@@ -0,0 +1,224 @@
+/**
+ * \file direct_sum_simd.hpp
+ * \brief Instruction set variants of the direct sum kernels
+ *
+ * Each variant lives in its own translation unit built for its instruction
+ * set, and direct_sum.cpp picks one at startup from CPUID. The variants take
+ * and give plain floats, so no inline function of a shared header, glm or
+ * the standard library, gets compiled with flags the CPU may not support.
+ *
+ * The tree walks and the VBO packing stay on the baseline build. With the
+ * whole program built for AVX2 and FMA, on galaxy, galaxy_collision1 and
+ * shuriken with one thread, the OcTree walk got 10 to 18% slower, the
+ * point walk of LinearOcTree 0 to 2% slower, the KdTree walk 2 to 3%
+ * faster and the grouped walk, whose time is already in these kernels, 2
+ * to 6% faster. Built for the AVX-512 host itself every walk stayed within
+ * 4% and the packing got 9 to 13% faster, 2 to 4 microseconds a frame.
+ **/
+#pragma once
+
+#include <cstddef>
+// The C sqrtf, std::sqrt is an inline function
+#include <math.h>
+
+/** Newton steps refining the hardware reciprocal square root of the AVX2 and
+ * AVX-512 kernels, 0 keeps its 12 (AVX2) or 14 (AVX-512) bits **/
+#define DIRECT_SUM_NEWTON_STEPS 1
+
+/**
+ * \brief Sums the gravity of point masses on a position, divided by G
+ * \param x - x of each source
+ * \param y - y of each source
+ * \param z - z of each source
+ * \param mass - mass of each source
+ * \param count - amount of sources
+ * \param px - x of the position
+ * \param py - y of the position
+ * \param pz - z of the position
+ * \param softening2 - squared Plummer softening length
+ * \param out - receives x, y and z of the acceleration divided by G
+ **/
+using DirectSumKernel = void (*)(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, float px, float py, float pz, float softening2,
+    float *out
+);
+
+/**
+ * \brief Adds the forces between the bodies of two tiles to both
+ * \param x - x of each body
+ * \param y - y of each body
+ * \param z - z of each body
+ * \param masses - mass of each body
+ * \param n - amount of bodies
+ * \param first - first body of a tile
+ * \param first_end - one past its last body
+ * \param second - first body of the other tile, after the first one or the
+ * same tile
+ * \param second_end - one past its last body
+ * \param softening2 - squared softening length
+ * \param acc - accumulator, x, y and z columns of the n bodies one after the
+ * other
+ **/
+using TilePairKernel = void (*)(
+    const float *x, const float *y, const float *z, const float *masses,
+    std::size_t n, std::size_t first, std::size_t first_end,
+    std::size_t second, std::size_t second_end, float softening2, float *acc
+);
+
+/**
+ * \brief Short range factors of a split scale, see short_range_table()
+ **/
+struct ShortRangeTable {
+    /** Factors at evenly spaced squared distances, zeros past the last **/
+    const float *factors;
+    /** Index of a squared distance of 1 **/
+    float to_index;
+    /** Index of the first zero **/
+    float past;
+};
+
+/**
+ * \brief Sums the short range gravity of point masses on a position,
+ * divided by G
+ * \param x - x of each source
+ * \param y - y of each source
+ * \param z - z of each source
+ * \param mass - mass of each source
+ * \param count - amount of sources
+ * \param px - x of the position
+ * \param py - y of the position
+ * \param pz - z of the position
+ * \param softening2 - squared Plummer softening length
+ * \param table - short range factors
+ * \param out - receives x, y and z of the acceleration divided by G
+ **/
+using ShortRangeKernel = void (*)(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, float px, float py, float pz, float softening2,
+    const ShortRangeTable &table, float *out
+);
+
+/** DirectSumKernel with AVX-512 **/
+void direct_sum_avx512(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, float px, float py, float pz, float softening2,
+    float *out
+);
+/** TilePairKernel built for AVX-512 **/
+void add_tile_pair_avx512(
+    const float *x, const float *y, const float *z, const float *masses,
+    std::size_t n, std::size_t first, std::size_t first_end,
+    std::size_t second, std::size_t second_end, float softening2, float *acc
+);
+/** ShortRangeKernel built for AVX-512 **/
+void short_range_sum_avx512(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, float px, float py, float pz, float softening2,
+    const ShortRangeTable &table, float *out
+);
+/** DirectSumKernel with AVX2 and FMA **/
+void direct_sum_avx2(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, float px, float py, float pz, float softening2,
+    float *out
+);
+/** TilePairKernel built for AVX2 and FMA **/
+void add_tile_pair_avx2(
+    const float *x, const float *y, const float *z, const float *masses,
+    std::size_t n, std::size_t first, std::size_t first_end,
+    std::size_t second, std::size_t second_end, float softening2, float *acc
+);
+/** ShortRangeKernel built for AVX2 and FMA **/
+void short_range_sum_avx2(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, float px, float py, float pz, float softening2,
+    const ShortRangeTable &table, float *out
+);
+
+/**
+ * \brief Portable loop of TilePairKernel
+ *
+ * static, so each translation unit including it keeps its own copy built
+ * for its own instruction set
+ **/
+static inline void add_tile_pair_loop(
+    const float *x, const float *y, const float *z, const float *masses,
+    std::size_t n, std::size_t first, std::size_t first_end,
+    std::size_t second, std::size_t second_end, float softening2, float *acc
+) {
+    float *acc_x = acc;
+    float *acc_y = acc + n;
+    float *acc_z = acc + 2 * n;
+    for (std::size_t i = first; i < first_end; ++i) {
+        const float px = x[i];
+        const float py = y[i];
+        const float pz = z[i];
+        const float mass = masses[i];
+        float ax = 0.0f;
+        float ay = 0.0f;
+        float az = 0.0f;
+        // Inside one tile each pair is taken from its lower body
+        const std::size_t begin = first == second ? i + 1 : second;
+#pragma omp simd reduction(+ : ax, ay, az)
+        for (std::size_t j = begin; j < second_end; ++j) {
+            const float dx = x[j] - px;
+            const float dy = y[j] - py;
+            const float dz = z[j] - pz;
+            const float r2 = dx * dx + dy * dy + dz * dz + softening2;
+            const float valid = r2 > 0.0f;
+            const float inv_r = valid / sqrtf(r2 + (1.0f - valid));
+            const float inv_r3 = inv_r * inv_r * inv_r;
+            const float si = masses[j] * inv_r3;
+            const float sj = mass * inv_r3;
+            ax += dx * si;
+            ay += dy * si;
+            az += dz * si;
+            acc_x[j] -= dx * sj;
+            acc_y[j] -= dy * sj;
+            acc_z[j] -= dz * sj;
+        }
+        acc_x[i] += ax;
+        acc_y[i] += ay;
+        acc_z[i] += az;
+    }
+}
+
+/**
+ * \brief Portable loop of ShortRangeKernel
+ *
+ * static like add_tile_pair_loop(), the table lookups become gathers where
+ * the instruction set has them
+ **/
+static inline void short_range_sum_loop(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, float px, float py, float pz, float softening2,
+    const ShortRangeTable &table, float *out
+) {
+    const float *factors = table.factors;
+    float ax = 0.0f;
+    float ay = 0.0f;
+    float az = 0.0f;
+#pragma omp simd reduction(+ : ax, ay, az)
+    for (std::size_t j = 0; j < count; ++j) {
+        const float dx = x[j] - px;
+        const float dy = y[j] - py;
+        const float dz = z[j] - pz;
+        const float d2 = dx * dx + dy * dy + dz * dz;
+        const float r2 = d2 + softening2;
+        const float t0 = d2 * table.to_index;
+        const float t = t0 < table.past ? t0 : table.past;
+        const int i = static_cast<int>(t);
+        const float f = t - static_cast<float>(i);
+        const float split = factors[i] + f * (factors[i + 1] - factors[i]);
+        const float valid = r2 > 0.0f;
+        const float inv_r = valid / sqrtf(r2 + (1.0f - valid));
+        const float s = mass[j] * inv_r * inv_r * inv_r * split;
+        ax += dx * s;
+        ay += dy * s;
+        az += dz * s;
+    }
+    out[0] = ax;
+    out[1] = ay;
+    out[2] = az;
+}
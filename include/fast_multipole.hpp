@@ -0,0 +1,224 @@
+/**
+ * \file fast_multipole.hpp
+ * \brief Fast multipole method on the linear octree
+ **/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "linear_octree.hpp"
+
+/**
+ * \brief Fast multipole method using Cartesian Taylor expansions
+ *
+ * Works on a LinearOcTree that is already built. Multipoles of every node are
+ * filled bottom-up (P2M, M2M), a dual tree traversal turns well separated
+ * node pairs into local expansions (M2L) and leaf pairs into direct sums
+ * (P2P), and the local expansions are passed down to the bodies (L2L, L2P).
+ * The upward and downward passes are parallel inside each level and the
+ * traversal runs as OpenMP tasks, one per target subtree, so the whole
+ * evaluation costs O(N).
+ **/
+class FastMultipole {
+public:
+    /** Highest order of the expansions, at least 1. Forces are exact up to
+     * the moments of order `order - 1` **/
+    std::uint32_t order = 4;
+    /** Two nodes interact through their expansions when the sum of their
+     * radii is below theta times the distance between their centers **/
+    double theta = 0.5;
+    /** Subtrees with at most this many bodies are treated as leafs **/
+    std::uint32_t leaf_size = 32;
+    /** Plummer softening length of the leaf to leaf direct sums **/
+    float softening = 0.0f;
+
+    /**
+     * \brief Calculates the net acceleration on every body
+     * \param tree - tree built on positions and masses
+     * \param positions - body positions
+     * \param masses - body masses
+     * \param accelerations - receives one acceleration per body, bodies left
+     * out of the tree get zero
+     **/
+    void accelerations(
+        const LinearOcTree &tree, const std::vector<glm::vec3> &positions,
+        const std::vector<float> &masses, std::vector<glm::vec3> &accelerations
+    );
+
+private:
+    /**
+     * \brief Term of a sum over multi-indices, target += coefficient *
+     * source * power
+     **/
+    struct Term {
+        /** Multi-index written **/
+        std::uint16_t target;
+        /** Multi-index read from the source expansion **/
+        std::uint16_t source;
+        /** Multi-index of the power or derivative multiplied **/
+        std::uint16_t power;
+        /** Constant factor **/
+        double coefficient;
+    };
+
+    /**
+     * \brief Term of the M2L sum of one target multi-index, scaled source
+     * times derivative
+     **/
+    struct Product {
+        /** Multi-index read from the scaled multipole **/
+        std::uint16_t source;
+        /** Multi-index of the derivative of 1/r multiplied **/
+        std::uint16_t derivative;
+    };
+
+    /** Order the tables below were built for **/
+    std::uint32_t _table_order = 0;
+    /** Terms of an expansion, multi-indices with |n| <= order **/
+    std::size_t _terms = 0;
+    /** Exponents of each multi-index, sorted by degree **/
+    std::vector<glm::uvec3> _exponents;
+    /** Each multi-index minus one unit on its first non zero axis **/
+    std::vector<std::uint16_t> _lower;
+    /** Axis removed by _lower **/
+    std::vector<std::uint8_t> _lower_axis;
+    /** Each multi-index minus one unit on each axis, or _terms **/
+    std::vector<std::uint16_t> _minus_one[3];
+    /** Each multi-index minus two units on each axis, or _terms **/
+    std::vector<std::uint16_t> _minus_two[3];
+    /** Factors of the recurrence of the derivatives of 1/r, one per axis
+     * for each of the two sums, six per multi-index **/
+    std::vector<double> _recurrence;
+    /** (-1)^|n| / n! of each multi-index, scales multipoles for M2L **/
+    std::vector<double> _source_factors;
+    /** 1 / n! of each multi-index, turns M2L sums into Taylor
+     * coefficients **/
+    std::vector<double> _inverse_factorials;
+    /** Terms shifting a multipole to the parent center **/
+    std::vector<Term> _m2m;
+    /** Terms shifting a local expansion to a child center **/
+    std::vector<Term> _l2l;
+    /** Terms turning a scaled multipole into a local expansion, grouped by
+     * target multi-index **/
+    std::vector<Product> _m2l;
+    /** Offset of the terms of each target multi-index inside _m2l **/
+    std::vector<std::uint32_t> _m2l_offsets;
+
+    /** Tree of the current evaluation **/
+    const LinearOcTree *_tree = nullptr;
+    /** Positions of the current evaluation **/
+    const glm::vec3 *_positions = nullptr;
+    /** Masses of the current evaluation **/
+    const float *_masses = nullptr;
+    /** Accelerations of the current evaluation **/
+    glm::vec3 *_accelerations = nullptr;
+    /** Nodes down to the leafs, grouped by depth **/
+    std::vector<std::uint32_t> _levels;
+    /** Offset of each depth inside _levels **/
+    std::vector<std::uint32_t> _level_offsets;
+    /** Parent of each node **/
+    std::vector<std::uint32_t> _parents;
+    /** Leafs, nodes with at most leaf_size bodies or no children **/
+    std::vector<std::uint32_t> _leaves;
+    /** Offset of the bodies of each leaf inside the gathered arrays **/
+    std::vector<std::uint32_t> _first_body;
+    /** Bodies gathered by leaf **/
+    std::vector<std::uint32_t> _bodies;
+    /** X coordinates gathered by leaf **/
+    std::vector<float> _x;
+    /** Y coordinates gathered by leaf **/
+    std::vector<float> _y;
+    /** Z coordinates gathered by leaf **/
+    std::vector<float> _z;
+    /** Masses gathered by leaf **/
+    std::vector<float> _mass;
+    /** Radius of each node around its center of mass **/
+    std::vector<double> _radii;
+    /** Multipole of each node, _terms per node **/
+    std::vector<double> _multipoles;
+    /** Multipole of each node scaled by _source_factors **/
+    std::vector<double> _sources;
+    /** Local expansion of each node, _terms per node **/
+    std::vector<double> _locals;
+
+    /**
+     * \brief Builds the multi-index tables for order
+     **/
+    void prepare_tables();
+    /**
+     * \brief Is leaf for the expansions
+     * \param node - node
+     * \returns true if the node has no children or at most leaf_size
+     * bodies
+     **/
+    bool is_leaf(const LinearOcTree::Node &node) const;
+    /**
+     * \brief Groups the nodes by depth, fills their parents and gathers the
+     * bodies of each leaf
+     **/
+    void prepare_levels();
+    /**
+     * \brief Copies the bodies below a leaf to the gathered arrays
+     * \param leaf - index of the leaf
+     **/
+    void gather_bodies(std::uint32_t leaf);
+    /**
+     * \brief Fills the powers of an offset for every multi-index
+     * \param offset - offset
+     * \param powers - receives _terms values, must have room for one more
+     **/
+    void powers_of(const glm::dvec3 &offset, double *powers) const;
+    /**
+     * \brief Fills the derivatives of 1/r for every multi-index
+     * \param offset - offset, must not be zero
+     * \param derivatives - receives _terms values, must have room for one
+     * more
+     **/
+    void inverse_distance_derivatives(
+        const glm::dvec3 &offset, double *derivatives
+    ) const;
+    /**
+     * \brief Fills multipole and radius of a node from its bodies or
+     * children
+     * \param node - index of the node
+     **/
+    void upward(std::uint32_t node);
+    /**
+     * \brief Fills the scaled multipole of a node used by M2L
+     * \param node - index of the node
+     **/
+    void scale_sources(std::uint32_t node);
+    /**
+     * \brief Interaction of a source node on a target node
+     * \param source - index of the source node
+     * \param target - index of the target node
+     *
+     * Only the target subtree is written, so tasks on different target
+     * subtrees run concurrently
+     **/
+    void interact(std::uint32_t source, std::uint32_t target);
+    /**
+     * \brief Adds the multipole of a source node to the local expansion of
+     * a target node
+     * \param source - index of the source node
+     * \param target - index of the target node
+     **/
+    void m2l(std::uint32_t source, std::uint32_t target);
+    /**
+     * \brief Adds the direct attraction of the bodies of a source leaf on
+     * the bodies of a target leaf
+     * \param source - index of the source leaf
+     * \param target - index of the target leaf
+     **/
+    void p2p(std::uint32_t source, std::uint32_t target);
+    /**
+     * \brief Passes the local expansion of the parent down to a node, and to
+     * the bodies of leafs
+     * \param node - index of the node
+     **/
+    void downward(std::uint32_t node);
+};
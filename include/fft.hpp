@@ -0,0 +1,31 @@
+/**
+ * \file fft.hpp
+ * \brief Radix-2 fast Fourier transform
+ **/
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+/**
+ * \brief Twiddle factors of a transform
+ * \param n - amount of values of the transform, a power of two
+ * \returns exp(-2 pi i k / n) for k below n / 2
+ **/
+std::vector<std::complex<float>> fft_twiddles(std::size_t n);
+
+/**
+ * \brief In place transform of a power of two amount of values
+ * \param data - values
+ * \param n - amount of values, a power of two
+ * \param twiddles - twiddle factors of n, see fft_twiddles()
+ * \param inverse - inverse transform, left unscaled so a forward and an
+ * inverse transform multiply the values by n
+ *
+ * Iterative Cooley-Tukey, the values are put in bit reversed order first
+ **/
+void fft(
+    std::complex<float> *data, std::size_t n,
+    const std::complex<float> *twiddles, bool inverse
+);
@@ -2,7 +2,7 @@
 
 #include "axolote/object3d.hpp"
 
-#include "celestial_body.hpp"
+#include "body_store.hpp"
 #include <vector>
 
 class GravGrid : public axolote::Object3D {
@@ -10,9 +10,9 @@ public:
     GLuint ssbo = 0;
     double multiplier_constant = 1;
 
-    GravGrid(std::vector<std::shared_ptr<CelestialBody>> bodies);
+    GravGrid(const BodyStore &bodies);
 
-    void update_for_body(std::shared_ptr<CelestialBody> c);
+    void update_for_body(const glm::vec3 &pos, double mass);
     void draw() override;
 
     friend class CelestialBodySystem;
@@ -0,0 +1,323 @@
+/**
+ * \file gravity_kernel.hpp
+ * \brief Gravity kernels generic over their arithmetic
+ **/
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+
+/**
+ * \brief Arithmetic of the force kernels
+ *
+ * Positions and masses are stored as float whatever the precision. Float
+ * does everything in float and keeps the SIMD kernels, Mixed evaluates each
+ * pair in float and sums them in double, Double does both in double.
+ **/
+enum class Precision { Float, Mixed, Double };
+
+/**
+ * \brief Types of a precision
+ *
+ * Scalar is used for each pair and Accumulator for the sums
+ **/
+template <Precision precision>
+struct PrecisionTypes {
+    using Scalar = float;
+    using Accumulator = float;
+};
+
+template <>
+struct PrecisionTypes<Precision::Mixed> {
+    using Scalar = float;
+    using Accumulator = double;
+};
+
+template <>
+struct PrecisionTypes<Precision::Double> {
+    using Scalar = double;
+    using Accumulator = double;
+};
+
+/** Half the diagonal of a unit cube. The trees open a node unless its bmax
+ * is below this times theta times the distance, so a full cube with its
+ * center of mass in the middle opens like width < theta * distance **/
+#define OPENING_BMAX_SCALE 0.8660254f
+
+/**
+ * \brief Size an octree node is opened by
+ *
+ * Bmax is the reach of the bodies from the center of mass, see bmax_of(),
+ * and accepts nodes whose bodies sit in a corner of their cube from much
+ * closer. Width is the cube itself, the classic width < theta * distance,
+ * which stays more accurate on small sparse systems.
+ **/
+enum class Opening { Bmax, Width };
+
+/**
+ * \brief bmax of a node, the size of its opening test
+ * \param center_of_mass - center of mass of the node
+ * \param box_min - lower corner of the tight box of its bodies
+ * \param box_max - upper corner of the tight box of its bodies
+ * \returns distance from the center of mass to the farthest corner of the
+ * box, which bounds the distance to any of its bodies
+ **/
+inline float bmax_of(
+    const glm::vec3 &center_of_mass, const glm::vec3 &box_min,
+    const glm::vec3 &box_max
+) {
+    return glm::length(
+        glm::max(center_of_mass - box_min, box_max - center_of_mass)
+    );
+}
+
+/**
+ * \brief Size of the opening test of an octree node
+ * \param opening - opening criterion
+ * \param center_of_mass - center of mass of the node
+ * \param box_min - lower corner of the tight box of its bodies
+ * \param box_max - upper corner of the tight box of its bodies
+ * \param width - width of the cube of the node
+ * \returns size compared with OPENING_BMAX_SCALE times theta times the
+ * distance
+ **/
+inline float opening_size(
+    Opening opening, const glm::vec3 &center_of_mass, const glm::vec3 &box_min,
+    const glm::vec3 &box_max, float width
+) {
+    if (opening == Opening::Width)
+        return width * OPENING_BMAX_SCALE;
+
+    return bmax_of(center_of_mass, box_min, box_max);
+}
+
+/**
+ * \brief Is there a gap between two boxes
+ * \param a_min - lower corner of a box, a point is a box of no size
+ * \param a_max - upper corner of that box
+ * \param b_min - lower corner of another box
+ * \param b_max - upper corner of that box
+ * \returns true if the boxes are apart on some axis, false if they overlap
+ * or touch
+ *
+ * A node is only accepted as a point mass away from the box of its
+ * bodies. A large theta lets the opening test accept the node holding the
+ * position, past 2 / sqrt(3) with bmax and past 1 / sqrt(3) with
+ * Opening::Width, which would add a body's own mass to it.
+ **/
+inline bool are_boxes_apart(
+    const glm::vec3 &a_min, const glm::vec3 &a_max, const glm::vec3 &b_min,
+    const glm::vec3 &b_max
+) {
+    return a_max.x < b_min.x || b_max.x < a_min.x || a_max.y < b_min.y
+           || b_max.y < a_min.y || a_max.z < b_min.z || b_max.z < a_min.z;
+}
+
+/**
+ * \brief Calls a function with a precision as a compile-time constant
+ * \param precision - precision
+ * \param function - called with std::integral_constant<Precision, ...>
+ * \returns what the function returns
+ *
+ * Lets a caller pick the instantiation of a kernel once, outside of its
+ * loops
+ **/
+template <typename Function>
+inline auto with_precision(Precision precision, Function &&function) {
+    switch (precision) {
+    case Precision::Mixed:
+        return function(std::integral_constant<Precision, Precision::Mixed>{}
+        );
+    case Precision::Double:
+        return function(
+            std::integral_constant<Precision, Precision::Double>{}
+        );
+    default:
+        return function(std::integral_constant<Precision, Precision::Float>{}
+        );
+    }
+}
+
+/**
+ * \brief Calls a function with a flag as a compile-time constant
+ * \param flag - flag
+ * \param function - called with std::true_type or std::false_type
+ * \returns what the function returns
+ **/
+template <typename Function>
+inline auto with_flag(bool flag, Function &&function) {
+    if (flag)
+        return function(std::true_type{});
+    return function(std::false_type{});
+}
+
+/**
+ * \brief Acceleration towards a point mass
+ * \tparam Scalar - arithmetic of the pair
+ * \tparam softened - add the squared softening length to the distance
+ * \param pos - position
+ * \param other - position of the point, not pos
+ * \param mass - mass of the point
+ * \param softening2 - squared Plummer softening length, unused when not
+ * softened
+ * \returns acceleration
+ **/
+template <typename Scalar, bool softened>
+inline glm::vec<3, Scalar> point_acceleration(
+    const glm::vec3 &pos, const glm::vec3 &other, float mass,
+    Scalar softening2
+) {
+    const glm::vec<3, Scalar> offset
+        = glm::vec<3, Scalar>{other} - glm::vec<3, Scalar>{pos};
+    Scalar r2 = glm::dot(offset, offset);
+    if constexpr (softened)
+        r2 += softening2;
+    const Scalar inv_r = Scalar{1} / std::sqrt(r2);
+    return offset
+           * (static_cast<Scalar>(G) * static_cast<Scalar>(mass) * inv_r
+              * inv_r * inv_r);
+}
+
+/**
+ * \brief Portable direct sum of point masses on a position, divided by G
+ * \tparam Scalar - arithmetic of each pair
+ * \tparam Accumulator - arithmetic of the sums
+ * \param x - x of each source
+ * \param y - y of each source
+ * \param z - z of each source
+ * \param mass - mass of each source
+ * \param count - amount of sources
+ * \param pos - position
+ * \param softening2 - squared Plummer softening length
+ * \returns acceleration divided by G
+ *
+ * Sources at distance zero add nothing. Branch free so the compiler
+ * vectorizes it.
+ **/
+template <typename Scalar, typename Accumulator>
+inline glm::vec3 direct_sum_as(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, const glm::vec3 &pos, float softening2
+) {
+    const Scalar px = pos.x;
+    const Scalar py = pos.y;
+    const Scalar pz = pos.z;
+    const Scalar eps2 = softening2;
+    Accumulator ax = 0;
+    Accumulator ay = 0;
+    Accumulator az = 0;
+#pragma omp simd reduction(+ : ax, ay, az)
+    for (std::size_t j = 0; j < count; ++j) {
+        const Scalar dx = static_cast<Scalar>(x[j]) - px;
+        const Scalar dy = static_cast<Scalar>(y[j]) - py;
+        const Scalar dz = static_cast<Scalar>(z[j]) - pz;
+        const Scalar r2 = dx * dx + dy * dy + dz * dz + eps2;
+        const Scalar valid = r2 > Scalar{0};
+        const Scalar inv_r = valid / std::sqrt(r2 + (Scalar{1} - valid));
+        const Scalar s = static_cast<Scalar>(mass[j]) * inv_r * inv_r * inv_r;
+        ax += dx * s;
+        ay += dy * s;
+        az += dz * s;
+    }
+    return glm::vec3{ax, ay, az};
+}
+
+/** Entries of the table of the short range factor, over u² from 0 to
+ * SHORT_RANGE_TABLE_END **/
+#define SHORT_RANGE_TABLE_SIZE 1024
+/** Last u² of the table, the factor is 4e-4 there and taken as 0 past it **/
+#define SHORT_RANGE_TABLE_END 9.0
+
+/**
+ * \brief Table of the short range factor erfc(u) + 2u / sqrt(pi) exp(-u²)
+ * \returns factors at evenly spaced u², SHORT_RANGE_TABLE_END at index
+ * SHORT_RANGE_TABLE_SIZE, and two zeros past it
+ **/
+inline const float *short_range_table() {
+    static const std::array<float, SHORT_RANGE_TABLE_SIZE + 3> table = [] {
+        std::array<float, SHORT_RANGE_TABLE_SIZE + 3> t{};
+        for (std::size_t i = 0; i <= SHORT_RANGE_TABLE_SIZE; ++i) {
+            const double u = std::sqrt(
+                SHORT_RANGE_TABLE_END * static_cast<double>(i)
+                / SHORT_RANGE_TABLE_SIZE
+            );
+            t[i] = static_cast<float>(
+                std::erfc(u) + 1.1283791670955126 * u * std::exp(-u * u)
+            );
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+/**
+ * \brief Short range part of the direct sum of point masses on a position,
+ * divided by G
+ * \tparam Scalar - arithmetic of each pair
+ * \tparam Accumulator - arithmetic of the sums
+ * \param x - x of each source
+ * \param y - y of each source
+ * \param z - z of each source
+ * \param mass - mass of each source
+ * \param count - amount of sources
+ * \param pos - position
+ * \param softening2 - squared Plummer softening length
+ * \param split_radius - scale r_s of the Gaussian split
+ * \returns acceleration divided by G
+ *
+ * Each term is the Newtonian one times erfc(u) + 2u / sqrt(pi) exp(-u²),
+ * with u = r / 2r_s, the part of gravity a mesh smoothed by exp(-k² r_s²)
+ * leaves out. The factor is interpolated from short_range_table(), libm
+ * calls on each pair would cost more than the rest of the walk. Sources at
+ * distance zero add nothing. Branch free so the compiler vectorizes it.
+ **/
+template <typename Scalar, typename Accumulator>
+inline glm::vec3 short_range_sum_as(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, const glm::vec3 &pos, float softening2,
+    float split_radius
+) {
+    const float *table = short_range_table();
+    const Scalar px = pos.x;
+    const Scalar py = pos.y;
+    const Scalar pz = pos.z;
+    const Scalar eps2 = softening2;
+    // Table index of a squared distance
+    const Scalar to_index = static_cast<Scalar>(
+        SHORT_RANGE_TABLE_SIZE
+        / (SHORT_RANGE_TABLE_END * 4.0 * split_radius * split_radius)
+    );
+    // Distances past the table land on its zeros
+    const Scalar past = static_cast<Scalar>(SHORT_RANGE_TABLE_SIZE + 1);
+    Accumulator ax = 0;
+    Accumulator ay = 0;
+    Accumulator az = 0;
+#pragma omp simd reduction(+ : ax, ay, az)
+    for (std::size_t j = 0; j < count; ++j) {
+        const Scalar dx = static_cast<Scalar>(x[j]) - px;
+        const Scalar dy = static_cast<Scalar>(y[j]) - py;
+        const Scalar dz = static_cast<Scalar>(z[j]) - pz;
+        const Scalar d2 = dx * dx + dy * dy + dz * dz;
+        const Scalar r2 = d2 + eps2;
+        const Scalar t = std::min(d2 * to_index, past);
+        const int i = static_cast<int>(t);
+        const Scalar f = t - static_cast<Scalar>(i);
+        const Scalar split = static_cast<Scalar>(table[i])
+                             + f * static_cast<Scalar>(table[i + 1] - table[i]);
+        const Scalar valid = r2 > Scalar{0};
+        const Scalar inv_r = valid / std::sqrt(r2 + (Scalar{1} - valid));
+        const Scalar s = static_cast<Scalar>(mass[j]) * inv_r * inv_r * inv_r
+                         * split;
+        ax += dx * s;
+        ay += dy * s;
+        az += dz * s;
+    }
+    return glm::vec3{ax, ay, az};
+}
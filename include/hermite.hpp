@@ -0,0 +1,100 @@
+/**
+ * \file hermite.hpp
+ * \brief Fourth order Hermite integration of collisional few-body systems
+ **/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "body_store.hpp"
+
+/** Below this amount of bodies the loops run on a single thread **/
+#define HERMITE_PARALLEL_BODIES 256
+
+/**
+ * \brief Hermite predictor-corrector with a shared adaptive step
+ *
+ * Acceleration and jerk come from a direct sum over every pair, in double
+ * precision, and the corrector builds the second and third derivatives of
+ * the acceleration from them at both ends of a substep. Each step of dt is
+ * cut in substeps of the smallest Aarseth step of the bodies, so close
+ * encounters are resolved while quiet stretches take few substeps.
+ *
+ * The state is kept in double between steps and written to the bodies as
+ * float, it is reloaded whenever the bodies no longer match it, after a
+ * collision for instance.
+ **/
+class Hermite {
+public:
+    /** Plummer softening length, 0 for plain Newtonian gravity **/
+    float softening = 0.0f;
+    /** Accuracy parameter of the Aarseth step criterion **/
+    double eta = 0.02;
+    /** Accuracy parameter of the first step, eta * |a| / |j| **/
+    double eta_start = 0.01;
+    /** Substeps are never shorter than dt / max_substeps **/
+    std::uint32_t max_substeps = 4096;
+
+    /**
+     * \brief Advances the bodies by one step
+     * \param bodies - bodies
+     * \param dt - delta time
+     * \returns amount of substeps taken
+     **/
+    std::size_t step(BodyStore &bodies, double dt);
+
+private:
+    /** Position of each body **/
+    std::vector<glm::dvec3> _positions;
+    /** Velocity of each body **/
+    std::vector<glm::dvec3> _velocities;
+    /** Acceleration of each body **/
+    std::vector<glm::dvec3> _accelerations;
+    /** Jerk of each body **/
+    std::vector<glm::dvec3> _jerks;
+    /** Acceleration of each body at the end of the substep **/
+    std::vector<glm::dvec3> _new_accelerations;
+    /** Jerk of each body at the end of the substep **/
+    std::vector<glm::dvec3> _new_jerks;
+    /** Predicted x of each body **/
+    std::vector<double> _x;
+    /** Predicted y of each body **/
+    std::vector<double> _y;
+    /** Predicted z of each body **/
+    std::vector<double> _z;
+    /** Predicted x velocity of each body **/
+    std::vector<double> _vx;
+    /** Predicted y velocity of each body **/
+    std::vector<double> _vy;
+    /** Predicted z velocity of each body **/
+    std::vector<double> _vz;
+    /** Mass of each body times G **/
+    std::vector<double> _gm;
+    /** Length of the next substep, 0 when unknown **/
+    double _step = 0.0;
+
+    /**
+     * \brief Reloads the state if the bodies were changed outside of step()
+     * \param bodies - bodies
+     **/
+    void load(const BodyStore &bodies);
+    /**
+     * \brief Fills the columns with the predicted bodies
+     * \param h - time since the last correction
+     **/
+    void predict(double h);
+    /**
+     * \brief Acceleration and jerk of every body from the columns
+     **/
+    void evaluate();
+    /**
+     * \brief Corrects every body at the end of a substep
+     * \param h - length of the substep
+     * \returns length of the next substep
+     **/
+    double correct(double h);
+};
@@ -0,0 +1,178 @@
+/**
+ * \file integrator.hpp
+ * \brief Time integration of the bodies
+ **/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "body_store.hpp"
+
+/** Wisdom-Holman needs a body at least this many times heavier than all the
+ * others together, it falls back to leapfrog otherwise **/
+#define DOMINANT_MASS_RATIO 10.0
+
+/**
+ * \brief Advances the bodies in time, whatever solver gives the forces
+ *
+ * Euler is semi-implicit Euler, first order with one force evaluation per
+ * step. Leapfrog is kick-drift-kick, second order, and also costs a single
+ * evaluation per step because the accelerations at the end of a step are
+ * kept for the start of the next one. Yoshida chains three leapfrog steps
+ * with the Forest-Ruth/Yoshida weights into a fourth order scheme, three
+ * evaluations per step. Leapfrog and Yoshida are symplectic and time
+ * reversible, so the energy error stays bounded instead of drifting.
+ *
+ * Block is kick-drift-kick with a step per body. Steps are dt divided by a
+ * power of two, up to 2^block_levels, and each body gets the largest one
+ * below block_eta * |a| / |da/dt|, the derivative being estimated from its
+ * last two accelerations. Every body drifts on each substep but only the
+ * bodies at the end of their step get new forces and kicks, so bodies on
+ * slow orbits cost one evaluation per dt.
+ *
+ * WisdomHolman is the Wisdom-Holman mixed variable map in democratic
+ * heliocentric coordinates. Orbits around the dominant body, the heaviest one
+ * when it outweighs the others DOMINANT_MASS_RATIO times, are solved exactly
+ * by a universal variable Kepler solver. The forces between the other bodies
+ * are kicks from the solver, run with the mass of the dominant body set to
+ * zero. The error scales with the mass ratio instead of the Kepler force, so
+ * much longer steps keep the orbits.
+ **/
+class Integrator {
+public:
+    enum class Scheme { Euler, Leapfrog, Yoshida, Block, WisdomHolman };
+    Scheme scheme = Scheme::Euler;
+    /** Block: the smallest step is dt / 2^block_levels, at most 31 **/
+    std::uint32_t block_levels = 8;
+    /** Block: accuracy parameter of the step criterion **/
+    float block_eta = 0.05f;
+
+    /**
+     * \brief Evaluation of the accelerations
+     *
+     * Fills the acceleration of the flagged bodies, or of every body when
+     * given nullptr, from the current positions. Other accelerations may be
+     * left untouched.
+     **/
+    using Evaluate = std::function<void(const std::vector<std::uint8_t> *)>;
+
+    /**
+     * \brief Scheme of a name
+     * \param name - "euler", "leapfrog", "yoshida", "block" or
+     * "wisdom-holman"
+     * \param scheme - receives the scheme
+     * \returns false if the name is unknown, scheme is left untouched
+     **/
+    static bool parse(const std::string &name, Scheme &scheme);
+
+    /**
+     * \brief Advances the bodies by one step
+     * \param bodies - bodies
+     * \param accelerations - acceleration of each body, kept between steps
+     * \param dt - delta time
+     * \param evaluate - fills accelerations from the current positions
+     **/
+    void step(
+        BodyStore &bodies, std::vector<glm::vec3> &accelerations, double dt,
+        const Evaluate &evaluate
+    );
+    /**
+     * \brief Forgets the accelerations kept from the last step
+     *
+     * To be called whenever bodies are added, erased, merged or moved
+     * outside of step()
+     **/
+    void invalidate();
+    /**
+     * \brief Forgets everything kept about the bodies
+     **/
+    void reset();
+    /**
+     * \brief Drops what is kept about the bodies flagged as removed
+     * \param bodies - bodies, before BodyStore::compact()
+     **/
+    void erase_removed(const BodyStore &bodies);
+    /**
+     * \brief Follows the bodies moved by BodyStore::reorder()
+     * \param order - order given to BodyStore::reorder()
+     **/
+    void reorder(const std::vector<std::uint32_t> &order);
+
+private:
+    /** Do the accelerations match the current positions **/
+    bool _has_accelerations = false;
+    /** Block: level of the step of each body, dt / 2^level **/
+    std::vector<std::uint8_t> _levels;
+    /** Block: acceleration of each body at its previous evaluation **/
+    std::vector<glm::vec3> _previous_accelerations;
+    /** Block: is each body at the end of its step **/
+    std::vector<std::uint8_t> _active;
+    /** WisdomHolman: body left out of the accelerations kept, SIZE_MAX when
+     * none is **/
+    std::size_t _dominant = SIZE_MAX;
+    /** WisdomHolman: position of each body relative to the dominant one **/
+    std::vector<glm::dvec3> _heliocentric;
+    /** WisdomHolman: velocity of each body relative to the barycenter **/
+    std::vector<glm::dvec3> _barycentric;
+
+    /**
+     * \brief One kick-drift-kick step
+     * \param bodies - bodies
+     * \param accelerations - acceleration of each body
+     * \param dt - delta time
+     * \param evaluate - fills accelerations from the current positions
+     **/
+    void leapfrog(
+        BodyStore &bodies, std::vector<glm::vec3> &accelerations, double dt,
+        const Evaluate &evaluate
+    );
+    /**
+     * \brief One step of dt with a step per body
+     * \param bodies - bodies
+     * \param accelerations - acceleration of each body
+     * \param dt - delta time
+     * \param evaluate - fills accelerations from the current positions
+     **/
+    void block(
+        BodyStore &bodies, std::vector<glm::vec3> &accelerations, double dt,
+        const Evaluate &evaluate
+    );
+    /**
+     * \brief One Wisdom-Holman step
+     * \param bodies - bodies
+     * \param accelerations - acceleration of each body
+     * \param dt - delta time
+     * \param evaluate - fills accelerations from the current positions
+     **/
+    void wisdom_holman(
+        BodyStore &bodies, std::vector<glm::vec3> &accelerations, double dt,
+        const Evaluate &evaluate
+    );
+    /**
+     * \brief Evaluates the accelerations without the dominant body
+     * \param bodies - bodies
+     * \param dominant - index of the dominant body
+     * \param evaluate - fills accelerations from the current positions
+     **/
+    void evaluate_without(
+        BodyStore &bodies, std::size_t dominant, const Evaluate &evaluate
+    );
+    /**
+     * \brief Level a body should step at
+     * \param acceleration - its acceleration
+     * \param previous - its acceleration one step earlier
+     * \param elapsed - time between both
+     * \param dt - delta time of the whole step
+     * \returns level, between 0 and block_levels
+     **/
+    std::uint8_t block_level(
+        const glm::vec3 &acceleration, const glm::vec3 &previous,
+        double elapsed, double dt
+    ) const;
+};
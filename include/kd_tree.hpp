@@ -0,0 +1,205 @@
+/**
+ * \file kd_tree.hpp
+ * \brief Kd-tree alternative to the octree
+ **/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "body_store.hpp"
+#include "gravity_kernel.hpp"
+
+/** Buckets of the binned surface area heuristic, per axis **/
+#define KD_SAH_BINS 16
+/** Nodes below this depth always split at the median, so the depth of the
+ * tree stays bounded whatever the heuristic picks **/
+#define KD_MAX_SAH_DEPTH 48
+
+/**
+ * \brief Binary tree of axis aligned splits, for the Barnes-Hut walk
+ *
+ * Drop-in alternative to OcTree: bodies are inserted one by one, build()
+ * makes the tree and net_acceleration_on_body() walks it with the same
+ * opening test. Each node is split in two along one axis of the tight box of
+ * its bodies, so clustered inputs get nodes that follow the clusters instead
+ * of the mostly empty cubes of an octree.
+ *
+ * Nodes are POD in a flat array kept between builds, the two children of a
+ * node are stored one after the other and every node links to the node that
+ * follows its subtree, so the walk needs neither recursion nor a stack. The
+ * bodies of the leafs are copied as structure of arrays in leaf order.
+ **/
+class KdTree {
+public:
+    /** Marks a missing child **/
+    static constexpr std::uint32_t null_index = 0xFFFFFFFFu;
+
+    /**
+     * \brief Node of the kd-tree
+     *
+     * Every node owns the range [first_body, first_body + body_count) of the
+     * bodies in leaf order
+     **/
+    struct Node {
+        /** Center of mass of node **/
+        glm::vec3 center_of_mass;
+        /** Total mass of node **/
+        float total_mass;
+        /** Lower corner of the tight box of the bodies **/
+        glm::vec3 box_min;
+        /** Size of the opening test, see bmax_of() **/
+        float bmax;
+        /** Upper corner of the tight box of the bodies **/
+        glm::vec3 box_max;
+        /** Index of the first of the two children, null_index for leafs **/
+        std::uint32_t first_child;
+        /** Offset of the first body of the node in leaf order **/
+        std::uint32_t first_body;
+        /** Amount of bodies inside the node **/
+        std::uint32_t body_count;
+        /** Index of the node visited after this subtree, null_index for
+         * the last one **/
+        std::uint32_t next;
+
+        /**
+         * \brief Is leaf node
+         * \returns true if the node has no children
+         **/
+        bool is_leaf() const;
+    };
+
+    /**
+     * \brief Where a node is split
+     *
+     * Median halves the bodies along the longest axis of the box, which
+     * keeps the tree balanced. SAH takes the plane, among KD_SAH_BINS per
+     * axis, that minimizes the surface of the spheres around the two boxes
+     * weighted by their bodies, which hugs clusters tighter.
+     **/
+    enum class Split { Median, SAH };
+
+    /** Simulation precision parameter, see OcTree::theta **/
+    static double theta;
+    /** Split rule, applied from the next build **/
+    Split split = Split::Median;
+    /** Nodes with this many bodies or less are leafs **/
+    std::uint32_t leaf_size = 8;
+    /** Plummer softening length of the body to body sums, nodes accepted
+     * as point masses are never softened **/
+    float softening = 0.0f;
+
+    /**
+     * \brief Default constructor
+     **/
+    KdTree();
+    /**
+     * \brief Constructor
+     * \param bodies - bodies inserted, must outlive the tree
+     **/
+    KdTree(const BodyStore &bodies);
+
+    /**
+     * \brief Removes every body and node keeping the memory
+     * \param bodies - bodies inserted from now on, must outlive the tree
+     **/
+    void clear(const BodyStore &bodies);
+    /**
+     * \brief Queues a body for the next build()
+     * \param body - index of the body, left out if it is removed
+     **/
+    void insert(std::uint32_t body);
+    /**
+     * \brief Builds the tree on the queued bodies
+     **/
+    void build();
+    /**
+     * \brief Calculates the net acceleration on a body
+     * \param body - index of the body
+     * \param dt - delta time
+     * \returns net acceleration
+     **/
+    glm::vec3 net_acceleration_on_body(std::uint32_t body, double dt) const;
+    /**
+     * \brief Calculates the net acceleration on a body
+     * \tparam precision - precision of the sums, instantiated for every
+     * Precision
+     * \tparam softened - soften the body to body terms, true only when
+     * softening is positive
+     * \param body - index of the body, which does not have to be in the tree
+     * \returns net acceleration
+     **/
+    template <Precision precision, bool softened>
+    glm::vec3 net_acceleration_on_body(std::uint32_t body) const;
+
+    /**
+     * \brief Nodes getter
+     * \returns nodes in depth-first order, root first
+     **/
+    const std::vector<Node> &nodes() const;
+    /**
+     * \brief Bytes used by the nodes and bodies of the current build
+     * \returns size in bytes
+     **/
+    std::size_t memory_usage() const;
+
+private:
+    /** Bodies inserted **/
+    const BodyStore *_bodies = nullptr;
+    /** Node arena **/
+    std::vector<Node> _nodes;
+    /** Bodies of the tree, in leaf order once built **/
+    std::vector<std::uint32_t> _body_indices;
+    /** X of the bodies in leaf order **/
+    std::vector<float> _x;
+    /** Y of the bodies in leaf order **/
+    std::vector<float> _y;
+    /** Z of the bodies in leaf order **/
+    std::vector<float> _z;
+    /** Masses of the bodies in leaf order **/
+    std::vector<float> _mass;
+
+    /**
+     * \brief Builds a node and its subtree
+     * \param node - index of the node
+     * \param begin - first body of the node in leaf order
+     * \param end - one past its last body
+     * \param depth - depth of the node
+     * \param next - node visited after the subtree
+     **/
+    void build_node(
+        std::uint32_t node, std::uint32_t begin, std::uint32_t end,
+        std::uint32_t depth, std::uint32_t next
+    );
+    /**
+     * \brief Fills the tight box, center of mass and total mass of a node
+     * from its bodies
+     * \param node - index of the node
+     **/
+    void compute_moments(std::uint32_t node);
+    /**
+     * \brief Orders the bodies of a node on both sides of its split
+     * \param node - index of the node, its box must already be filled
+     * \param depth - depth of the node
+     * \returns offset of the first body of the second child, strictly
+     * inside the range of the node
+     **/
+    std::uint32_t partition(std::uint32_t node, std::uint32_t depth);
+    /**
+     * \brief Orders the bodies of a node around the median of an axis
+     * \param node - index of the node
+     * \param axis - axis of the split
+     * \returns offset of the first body of the second child
+     **/
+    std::uint32_t partition_median(std::uint32_t node, int axis);
+    /**
+     * \brief Orders the bodies of a node around the best binned SAH plane
+     * \param node - index of the node, its box must already be filled
+     * \returns offset of the first body of the second child, or the end of
+     * the node when no plane separates its bodies
+     **/
+    std::uint32_t partition_sah(std::uint32_t node);
+};
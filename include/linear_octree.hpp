@@ -0,0 +1,668 @@
+/**
+ * \file linear_octree.hpp
+ * \brief Arena-backed linear octree
+ **/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "gravity_kernel.hpp"
+
+/**
+ * \brief Octree stored as a flat array of POD nodes
+ *
+ * Nodes live in an arena that is kept between builds, so once it has grown to
+ * the working size rebuilding the tree every step does not touch the heap.
+ * The eight children of an internal node are stored contiguously, the blocks
+ * of children are laid out in depth-first order and both children and bodies
+ * are referenced by 32-bit indices. Every node also links to the node that
+ * follows its subtree, so traversals need neither recursion nor a stack.
+ *
+ * Based on Barnes-Hut algorithm
+ **/
+class LinearOcTree {
+public:
+    /** Marks a missing child or body **/
+    static constexpr std::uint32_t null_index = 0xFFFFFFFFu;
+
+    /**
+     * \brief Node of the linear octree
+     *
+     * Leafs own the range [first_body, first_body + body_count) of
+     * body_indices(). A leaf holds up to bucket_size bodies, more only when
+     * max_depth is reached.
+     **/
+    struct Node {
+        /** Center of mass of node **/
+        glm::vec3 center_of_mass;
+        /** Total mass of node **/
+        float total_mass;
+        /** 3D point where the cube starts **/
+        glm::vec3 cube_start;
+        /** Width of the cube **/
+        float width;
+        /** Size of the opening test, see opening_size() **/
+        float bmax;
+        /** Index of the first of the eight children, null_index for leafs **/
+        std::uint32_t first_child;
+        /** Offset of the first body of a leaf inside body_indices() **/
+        std::uint32_t first_body;
+        /** Amount of bodies inside the node **/
+        std::uint32_t body_count;
+        /** Index of the node visited after this subtree, null_index for
+         * the last one **/
+        std::uint32_t next;
+        /** Lower corner of the tight box of the bodies, which may be much
+         * smaller than the cube **/
+        glm::vec3 box_min;
+        /** Upper corner of the tight box of the bodies **/
+        glm::vec3 box_max;
+
+        /**
+         * \brief Is leaf node
+         * \returns true if the node has no children
+         **/
+        bool is_leaf() const;
+    };
+
+    /**
+     * \brief Expansion used for the nodes accepted by a traversal
+     *
+     * Higher orders are more accurate for the same theta, so theta can be
+     * raised and fewer nodes are opened
+     **/
+    enum class Multipole { Monopole, Quadrupole, Octupole };
+
+    /** Simulation precision parameter, see OcTree::theta **/
+    static double theta;
+    /** Size nodes are opened by, see OcTree::opening **/
+    static Opening opening;
+    /** Expansion of accepted nodes, applied from the next build **/
+    Multipole multipole = Multipole::Monopole;
+    /** 3D point where the root cube starts, applied from the next build **/
+    glm::vec3 initial_cube_start{-1000.0f, -1000.0f, -1000.0f};
+    /** Initial width for node, applied from the next build **/
+    float initial_width = 2000.0f;
+    /** Leafs are split once they hold more than this many bodies **/
+    std::uint32_t bucket_size = 8;
+    /** Nodes at this depth are always leafs, Morton keys resolve at most 21
+     * levels **/
+    std::uint32_t max_depth = 21;
+    /** Bodies sharing one interaction list in net_accelerations() **/
+    std::uint32_t group_size = 32;
+    /** Plummer softening length of the body to body sums, nodes accepted
+     * as point masses are never softened **/
+    float softening = 0.0f;
+    /** Scale r_s of the Gaussian split of TreePM. When positive,
+     * net_accelerations() and field_accelerations() only sum the short range
+     * part of gravity, with monopoles only, and leave out the nodes farther
+     * than split_cutoff times it **/
+    float split_radius = 0.0f;
+    /** Reach of the short range sums in split scales **/
+    float split_cutoff = 4.5f;
+    /** Arithmetic of the traversals, the higher moments are always summed
+     * in float **/
+    Precision precision = Precision::Float;
+    /** refit() gives up and asks for a rebuild after this many refits, 0
+     * to only rebuild when the tree degrades **/
+    std::uint32_t rebuild_interval = 0;
+    /** refit() splits the leafs that grow past this many bodies, should not
+     * be below bucket_size **/
+    std::uint32_t max_leaf_occupancy = 16;
+    /** refit() asks for a rebuild once the leafs it split made this many
+     * times the nodes of the build **/
+    float max_node_growth = 1.5f;
+    /** refit() asks for a rebuild once the leafs it split made the tree
+     * this many levels deeper than the build **/
+    std::uint32_t max_depth_growth = 2;
+    /** Keep the interaction list of each group between refits, see
+     * net_accelerations(). Not used while split_radius is positive **/
+    bool reuse_lists = false;
+    /** Bodies of a group may leave the box its list was recorded on by this
+     * fraction of the width of the group node before the tree is walked
+     * again for it **/
+    float list_margin = 0.05f;
+
+    /**
+     * \brief Default constructor
+     **/
+    LinearOcTree();
+    /**
+     * \brief Constructor
+     * \param initial_coord - initial start coordinate
+     **/
+    LinearOcTree(float initial_coord);
+    /**
+     * \brief Constructor
+     * \param cube_start - 3D point where the root cube starts
+     * \param width - width of the root cube
+     **/
+    LinearOcTree(const glm::vec3 &cube_start, float width);
+
+    /**
+     * \brief Removes every node keeping the arena memory
+     *
+     * Nodes are trivially destructible, so this is O(1)
+     **/
+    void clear();
+    /**
+     * \brief Builds the tree from scratch
+     * \param positions - body positions
+     * \param masses - body masses
+     *
+     * Both vectors are indexed by body and must outlive the traversals made
+     * on this build. Bodies outside the root cube are left out.
+     **/
+    void build(
+        const std::vector<glm::vec3> &positions,
+        const std::vector<float> &masses
+    );
+    /**
+     * \brief Builds the tree from scratch using Morton keys, in parallel
+     * \param positions - body positions
+     * \param masses - body masses
+     *
+     * Same contract and node layout as build(). The 63-bit keys are computed
+     * and radix sorted in parallel, the hierarchy is emitted from the sorted
+     * keys as independent subtrees and centers of mass and total masses are
+     * filled afterwards by a parallel bottom-up pass.
+     **/
+    void build_morton(
+        const std::vector<glm::vec3> &positions,
+        const std::vector<float> &masses
+    );
+    /**
+     * \brief Updates the tree to new body positions keeping its topology
+     * \param positions - body positions, same bodies and order as the build
+     * \param masses - body masses
+     * \returns false if the tree must be rebuilt instead, in which case it
+     * is left untouched
+     *
+     * Bodies still inside their leaf stay there, bodies that left it are
+     * moved to the leaf now containing them, leafs left with too many bodies
+     * are split, subtrees left with at most bucket_size bodies are merged
+     * into a leaf and every center of mass and total mass is refilled
+     * bottom-up. The nodes are then laid out again like a build, so the
+     * walks keep their locality. A rebuild is requested when a body left
+     * the root cube, when the root cube was changed, when the splits made
+     * the tree too large or too deep for max_node_growth or
+     * max_depth_growth, or after rebuild_interval refits.
+     **/
+    bool refit(
+        const std::vector<glm::vec3> &positions,
+        const std::vector<float> &masses
+    );
+    /**
+     * \brief Calculates the net acceleration on a body
+     * \param body - index of the body used on build()
+     * \returns net acceleration
+     **/
+    glm::vec3 net_acceleration_on_body(std::uint32_t body) const;
+    /**
+     * \brief Calculates the net acceleration at a position
+     * \param pos - position
+     * \param body - index of the body at pos, which is left out, or
+     * null_index
+     * \returns net acceleration
+     **/
+    glm::vec3 net_acceleration_at(
+        const glm::vec3 &pos, std::uint32_t body = null_index
+    ) const;
+
+    /**
+     * \brief Calculates the net acceleration on every body
+     * \param accelerations - receives one acceleration per body, bodies left
+     * out of the build get zero
+     * \param active - flag per body, only the flagged bodies are evaluated
+     * and the other accelerations are kept, nullptr for every body
+     *
+     * Bodies are processed in groups of nearby bodies. Each group walks the
+     * tree once, opening nodes against its bounding box, and the resulting
+     * list of point masses is evaluated for every body of the group in a
+     * tight loop. Groups are spread over the OpenMP threads.
+     *
+     * With reuse_lists the nodes kept by the walk of a group are recorded,
+     * the walk being made against its box grown by list_margin. Until the
+     * next build the list is refilled from the refitted moments of those
+     * nodes instead of walking the tree, as long as the bodies stay inside
+     * the grown box, every node still passes the opening test and no leaf
+     * of the list was split by a refit.
+     **/
+    void net_accelerations(
+        std::vector<glm::vec3> &accelerations,
+        const std::vector<std::uint8_t> *active = nullptr
+    );
+    /**
+     * \brief Calculates the net acceleration at positions that are not
+     * bodies of the tree
+     * \param targets - positions, such as test particles
+     * \param accelerations - receives one acceleration per target
+     *
+     * Targets are sorted by Morton key and cut into runs of group_size, each
+     * run walks the tree once like the groups of net_accelerations(). Runs
+     * are spread over the OpenMP threads.
+     **/
+    void field_accelerations(
+        const std::vector<glm::vec3> &targets,
+        std::vector<glm::vec3> &accelerations
+    );
+
+    /**
+     * \brief Walked groups getter
+     * \returns groups of the last net_accelerations() that walked the tree,
+     * the others reused their list
+     **/
+    std::size_t walked_groups() const;
+    /**
+     * \brief Groups getter
+     * \returns groups of the last net_accelerations()
+     **/
+    std::size_t group_count() const;
+    /**
+     * \brief Nodes getter
+     * \returns nodes in depth-first order, root first
+     **/
+    const std::vector<Node> &nodes() const;
+    /**
+     * \brief Body indices getter
+     * \returns body indices grouped by leaf
+     **/
+    const std::vector<std::uint32_t> &body_indices() const;
+    /**
+     * \brief Bytes used by the nodes of the current build
+     * \returns size in bytes
+     **/
+    std::size_t memory_usage() const;
+
+private:
+    /**
+     * \brief Subtree of a Morton build emitted by a single thread
+     **/
+    struct MortonSubtree {
+        /** Index of the subtree root **/
+        std::uint32_t node;
+        /** First sorted key of the subtree **/
+        std::uint32_t begin;
+        /** One past the last sorted key of the subtree **/
+        std::uint32_t end;
+        /** Depth of the subtree root **/
+        std::uint32_t depth;
+        /** Index of the first node below the subtree root **/
+        std::uint32_t first_child;
+        /** Amount of nodes below the subtree root **/
+        std::uint32_t size;
+    };
+
+    /**
+     * \brief Second and third moments of a node about its center of mass
+     *
+     * Raw moments, sum of m * x_i * x_j and m * x_i * x_j * x_k, keeping only
+     * the distinct components
+     **/
+    struct Multipoles {
+        /** xx, xy, xz, yy, yz, zz **/
+        float second[6];
+        /** xxx, xxy, xxz, xyy, xyz, xzz, yyy, yyz, yzz, zzz **/
+        float third[10];
+    };
+
+    /**
+     * \brief Point masses acting on a group of bodies, as structure of
+     * arrays
+     **/
+    struct InteractionList {
+        /** Bodies of the group **/
+        std::vector<std::uint32_t> bodies;
+        /** X coordinates **/
+        std::vector<float> x;
+        /** Y coordinates **/
+        std::vector<float> y;
+        /** Z coordinates **/
+        std::vector<float> z;
+        /** Masses **/
+        std::vector<float> mass;
+        /** Accepted nodes whose higher moments are added on top **/
+        std::vector<std::uint32_t> nodes;
+        /** Centers of mass, second and third moments of nodes, one column
+         * per component **/
+        std::vector<float> moments;
+    };
+
+    /**
+     * \brief Nodes kept by the walk of a group, see reuse_lists
+     **/
+    struct RecordedList {
+        /** Was the list recorded since the last build **/
+        bool is_recorded = false;
+        /** Lower corner of the box of the walk, the box of the bodies grown
+         * by the margin **/
+        glm::vec3 box_min;
+        /** Upper corner of the box of the walk **/
+        glm::vec3 box_max;
+        /** Nodes taken as point masses, and leafs whose bodies are summed
+         * directly flagged with the top bit **/
+        std::vector<std::uint32_t> entries;
+    };
+
+    /** Node arena **/
+    std::vector<Node> _nodes;
+    /** Body indices, grouped by leaf **/
+    std::vector<std::uint32_t> _body_indices;
+    /** Scratch buffer used to partition body indices **/
+    std::vector<std::uint32_t> _scratch;
+    /** Sorted Morton keys of the current build **/
+    std::vector<std::uint64_t> _keys;
+    /** Scratch buffer for the radix sort **/
+    std::vector<std::uint64_t> _key_scratch;
+    /** Subtrees of the current Morton build **/
+    std::vector<MortonSubtree> _subtrees;
+    /** Subtrees already given room by emit_morton_node() **/
+    std::size_t _reserved_subtrees = 0;
+    /** Internal nodes above the subtrees, in depth-first order **/
+    std::vector<std::uint32_t> _top_nodes;
+    /** Body count of the current build **/
+    std::uint32_t _body_count = 0;
+    /** Are the refit structures below filled for the current build **/
+    bool _refit_ready = false;
+    /** Refits since the last build **/
+    std::uint32_t _refits = 0;
+    /** Nodes of the last build **/
+    std::size_t _built_nodes = 0;
+    /** Levels of the last build **/
+    std::size_t _built_levels = 0;
+    /** Leaf of each body, null_index if it is not on the tree **/
+    std::vector<std::uint32_t> _body_leaf;
+    /** Leaf of each body after a refit **/
+    std::vector<std::uint32_t> _new_body_leaf;
+    /** Every leaf, in depth-first order **/
+    std::vector<std::uint32_t> _leaves;
+    /** Internal nodes grouped by depth **/
+    std::vector<std::uint32_t> _internal_nodes;
+    /** Offset of each depth inside _internal_nodes **/
+    std::vector<std::uint32_t> _level_offsets;
+    /** Per node scratch buffer **/
+    std::vector<std::uint32_t> _node_scratch;
+    /** Nodes being laid out again by relayout_nodes() **/
+    std::vector<Node> _node_arena_scratch;
+    /** Moments of each node, filled when the expansion is not a monopole **/
+    std::vector<Multipoles> _multipoles;
+    /** Expansion of the current build **/
+    Multipole _multipole = Multipole::Monopole;
+    /** Roots of the body groups used by net_accelerations() **/
+    std::vector<std::uint32_t> _groups;
+    /** Recorded list of each node that was a group root, see reuse_lists **/
+    std::vector<RecordedList> _recorded_lists;
+    /** The tree was rebuilt since the lists were recorded **/
+    bool _lists_stale = true;
+    /** Groups that walked the tree in the last net_accelerations() **/
+    std::size_t _walked_groups = 0;
+    /** Interaction list of each thread **/
+    std::vector<InteractionList> _interaction_lists;
+    /** Morton keys of the targets of field_accelerations(), sorted **/
+    std::vector<std::uint64_t> _target_keys;
+    /** Target of each sorted key **/
+    std::vector<std::uint32_t> _target_order;
+    /** Scratch values for the radix sort of the targets **/
+    std::vector<std::uint32_t> _target_scratch;
+    /** Positions of the current build **/
+    const glm::vec3 *_positions = nullptr;
+    /** Masses of the current build **/
+    const float *_masses = nullptr;
+
+    /**
+     * \brief Builds a node and its subtree
+     * \param node - index of the node, its cube must already be set
+     * \param begin - first body index of the node
+     * \param end - one past the last body index of the node
+     * \param depth - depth of the node
+     **/
+    void build_node(
+        std::uint32_t node, std::uint32_t begin, std::uint32_t end,
+        std::uint32_t depth
+    );
+    /**
+     * \brief Fills center of mass and total mass of a node
+     * \param node - index of the node
+     *
+     * Children of internal nodes must already be filled
+     **/
+    void compute_moments(std::uint32_t node);
+    /**
+     * \brief Fills the moments of every node for the selected expansion
+     *
+     * Centers of mass must already be filled
+     **/
+    void compute_multipoles();
+    /**
+     * \brief Acceleration added by the moments of an accepted node
+     * \tparam expansion - expansion of the build, not Monopole
+     * \param node - index of the node
+     * \param offset - position minus the center of mass of the node
+     * \returns acceleration on top of the monopole
+     **/
+    template <Multipole expansion>
+    glm::vec3
+    multipole_acceleration(std::uint32_t node, const glm::vec3 &offset) const;
+    /**
+     * \brief Acceleration of the point masses and moments of a list
+     * \tparam precision - precision of the sums
+     * \tparam expansion - expansion of the build
+     * \param list - interaction list
+     * \param pos - position
+     * \param softening2 - squared softening length
+     * \returns acceleration, only its short range part while split_radius
+     * is positive
+     **/
+    template <Precision precision, Multipole expansion>
+    glm::vec3 list_acceleration(
+        const InteractionList &list, const glm::vec3 &pos, float softening2
+    ) const;
+    /**
+     * \brief Acceleration added by the moments of the nodes of a list
+     * \tparam expansion - expansion of the build, not Monopole
+     * \param list - interaction list
+     * \param pos - position
+     * \returns acceleration on top of the monopoles
+     **/
+    template <Multipole expansion>
+    glm::vec3 multipole_list_acceleration(
+        const InteractionList &list, const glm::vec3 &pos
+    ) const;
+    /**
+     * \brief net_acceleration_at() for one precision and expansion
+     * \tparam precision - precision of the sums
+     * \tparam expansion - expansion of the build
+     * \tparam softened - soften the body to body terms
+     * \param pos - position
+     * \param body - index of the body at pos or null_index
+     * \returns net acceleration
+     **/
+    template <Precision precision, Multipole expansion, bool softened>
+    glm::vec3 walk_acceleration(const glm::vec3 &pos, std::uint32_t body) const;
+    /**
+     * \brief Evaluates every group for one precision and expansion
+     * \tparam precision - precision of the sums
+     * \tparam expansion - expansion of the build
+     * \param accelerations - receives the acceleration of each body
+     * \param active - flag per body or nullptr, see net_accelerations()
+     **/
+    template <Precision precision, Multipole expansion>
+    void evaluate_groups(
+        std::vector<glm::vec3> &accelerations,
+        const std::vector<std::uint8_t> *active
+    );
+    /**
+     * \brief Evaluates every run of targets for one precision and expansion
+     * \tparam precision - precision of the sums
+     * \tparam expansion - expansion of the build
+     * \param targets - positions
+     * \param accelerations - receives the acceleration at each target
+     **/
+    template <Precision precision, Multipole expansion>
+    void evaluate_targets(
+        const std::vector<glm::vec3> &targets,
+        std::vector<glm::vec3> &accelerations
+    );
+    /**
+     * \brief Resets the per build state and remembers the body arrays
+     * \param positions - body positions
+     * \param masses - body masses
+     **/
+    void start_build(
+        const std::vector<glm::vec3> &positions,
+        const std::vector<float> &masses
+    );
+    /**
+     * \brief Fills the next link of every node
+     **/
+    void link_nodes();
+    /**
+     * \brief Fills the leaf and level lists and the leaf of each body
+     **/
+    void prepare_refit();
+    /**
+     * \brief Lays the nodes out again like a Morton build, each block of
+     * children before the subtrees of its nodes
+     *
+     * Used once refit() appended the children of split leafs at the end of
+     * the arena or merged subtrees. Recorded interaction lists follow their
+     * nodes, the lists using a merged node are dropped.
+     **/
+    void relayout_nodes();
+    /**
+     * \brief Copies a node to its new place and lays out its subtree
+     * \param node - index of the node in the old arena
+     * \param target - index of the node in the new arena
+     * \param cursor - next free index of the new arena
+     * \returns next free index once the subtree is laid out
+     **/
+    std::uint32_t relayout_node(
+        std::uint32_t node, std::uint32_t target, std::uint32_t cursor
+    );
+    /**
+     * \brief Finds the leaf containing a position
+     * \param pos - position
+     * \returns leaf index, null_index if pos is outside of the root cube
+     **/
+    std::uint32_t find_leaf(const glm::vec3 &pos) const;
+    /**
+     * \brief Refills every center of mass and total mass, in parallel
+     *
+     * Requires prepare_refit()
+     **/
+    void update_moments();
+    /**
+     * \brief Fills the interaction list of a group
+     * \tparam expansion - expansion of the build
+     * \param group - index of the group root
+     * \param list - receives the bodies of the group and the point masses
+     * acting on them
+     * \param active - flag per body, only the flagged bodies are kept and
+     * nodes are opened against them, nullptr for every body
+     * \param recorded - recorded list of the group, reused when still valid
+     * and recorded again otherwise, nullptr to always walk the tree
+     * \returns true if the tree was walked
+     **/
+    template <Multipole expansion>
+    bool build_interaction_list(
+        std::uint32_t group, InteractionList &list,
+        const std::vector<std::uint8_t> *active, RecordedList *recorded
+    ) const;
+    /**
+     * \brief Fills the point masses of an interaction list
+     * \tparam expansion - expansion of the build
+     * \param box_min - lower corner of the box of the positions evaluated
+     * \param box_max - upper corner of that box
+     * \param list - receives the point masses and the accepted nodes
+     * \param entries - receives the nodes kept, see RecordedList, nullptr
+     * to not record them
+     **/
+    template <Multipole expansion>
+    void fill_interaction_list(
+        const glm::vec3 &box_min, const glm::vec3 &box_max,
+        InteractionList &list, std::vector<std::uint32_t> *entries = nullptr
+    ) const;
+    /**
+     * \brief Fills the point masses of an interaction list from a recorded
+     * list
+     * \tparam expansion - expansion of the build
+     * \param box_min - lower corner of the box of the positions evaluated
+     * \param box_max - upper corner of that box
+     * \param recorded - recorded list
+     * \param list - receives the point masses and the accepted nodes
+     * \returns false if a node no longer passes the opening test, the list
+     * must then be walked again
+     **/
+    template <Multipole expansion>
+    bool refill_interaction_list(
+        const glm::vec3 &box_min, const glm::vec3 &box_max,
+        const RecordedList &recorded, InteractionList &list
+    ) const;
+    /**
+     * \brief Fills the moment columns of the accepted nodes of a list
+     * \param list - interaction list
+     **/
+    void fill_moment_columns(InteractionList &list) const;
+    /**
+     * \brief Is a range of sorted keys emitted as a leaf
+     * \param begin - first sorted key
+     * \param end - one past the last sorted key
+     * \param depth - depth of the node
+     * \returns true if the range is a leaf
+     **/
+    bool is_morton_leaf(
+        std::uint32_t begin, std::uint32_t end, std::uint32_t depth
+    ) const;
+    /**
+     * \brief Splits a range of sorted keys into the ranges of its octants
+     * \param begin - first sorted key
+     * \param end - one past the last sorted key
+     * \param depth - depth of the node owning the range
+     * \param bounds - receives the 9 boundaries of the 8 octants
+     **/
+    void morton_child_bounds(
+        std::uint32_t begin, std::uint32_t end, std::uint32_t depth,
+        std::uint32_t bounds[9]
+    ) const;
+    /**
+     * \brief Collects the subtrees of a Morton build
+     * \param begin - first sorted key
+     * \param end - one past the last sorted key
+     * \param depth - depth of the node owning the range
+     * \param split_depth - depth of the subtree roots
+     * \returns amount of nodes above the subtrees, not counting the root
+     **/
+    std::uint32_t collect_morton_subtrees(
+        std::uint32_t begin, std::uint32_t end, std::uint32_t depth,
+        std::uint32_t split_depth
+    );
+    /**
+     * \brief Counts the nodes below a range of sorted keys
+     * \param begin - first sorted key
+     * \param end - one past the last sorted key
+     * \param depth - depth of the node owning the range
+     * \returns amount of nodes below the node
+     **/
+    std::uint32_t count_morton_nodes(
+        std::uint32_t begin, std::uint32_t end, std::uint32_t depth
+    ) const;
+    /**
+     * \brief Emits the children of a node from its range of sorted keys
+     * \param node - index of the node, its cube must already be set
+     * \param begin - first sorted key
+     * \param end - one past the last sorted key
+     * \param depth - depth of the node
+     * \param cursor - index where the next block of children goes
+     * \param split_depth - depth where subtrees are reserved instead of
+     * emitted, 0 to emit everything
+     * \returns index after the last emitted node
+     **/
+    std::uint32_t emit_morton_node(
+        std::uint32_t node, std::uint32_t begin, std::uint32_t end,
+        std::uint32_t depth, std::uint32_t cursor, std::uint32_t split_depth
+    );
+};
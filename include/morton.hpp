@@ -0,0 +1,76 @@
+/**
+ * \file morton.hpp
+ * \brief Morton (Z-order) keys and radix sort
+ **/
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+/** Bits used per axis on a Morton key **/
+#define MORTON_BITS_PER_AXIS 21
+/** Key given to positions outside of the encoded cube, sorts after all **/
+#define MORTON_INVALID_KEY (std::uint64_t{1} << 63)
+
+/**
+ * \brief Spreads the lower 21 bits of a value so there are two zeros between
+ * each of them
+ * \param v - value
+ * \returns spread value
+ **/
+inline std::uint64_t morton_expand_bits(std::uint64_t v) {
+    v &= 0x1FFFFF;
+    v = (v | v << 32) & 0x1F00000000FFFF;
+    v = (v | v << 16) & 0x1F0000FF0000FF;
+    v = (v | v << 8) & 0x100F00F00F00F00F;
+    v = (v | v << 4) & 0x10C30C30C30C30C3;
+    v = (v | v << 2) & 0x1249249249249249;
+    return v;
+}
+
+/**
+ * \brief Calculates the 63-bit Morton key of a position inside a cube
+ * \param pos - position
+ * \param cube_start - 3D point where the cube starts
+ * \param width - width of the cube
+ * \returns key, or MORTON_INVALID_KEY if the position is outside the cube
+ *
+ * Each 3-bit group is an octant index with x on bit 2, y on bit 1 and z on
+ * bit 0, the most significant group being the octant of the root
+ **/
+inline std::uint64_t morton_key(
+    const glm::vec3 &pos, const glm::vec3 &cube_start, float width
+) {
+    constexpr float cells = static_cast<float>(1u << MORTON_BITS_PER_AXIS);
+    glm::vec3 cell = (pos - cube_start) * (cells / width);
+    if (!(cell.x >= 0.0f && cell.y >= 0.0f && cell.z >= 0.0f && cell.x <= cells
+          && cell.y <= cells && cell.z <= cells))
+        return MORTON_INVALID_KEY;
+
+    // Positions exactly on the upper face belong to the last cell
+    constexpr float last = cells - 1.0f;
+    std::uint64_t x = static_cast<std::uint64_t>(std::min(cell.x, last));
+    std::uint64_t y = static_cast<std::uint64_t>(std::min(cell.y, last));
+    std::uint64_t z = static_cast<std::uint64_t>(std::min(cell.z, last));
+    return morton_expand_bits(x) << 2 | morton_expand_bits(y) << 1
+           | morton_expand_bits(z);
+}
+
+/**
+ * \brief Stable parallel LSD radix sort of key/value pairs
+ * \param keys - keys to sort
+ * \param values - values moved along with the keys
+ * \param key_scratch - scratch buffer, resized as needed
+ * \param value_scratch - scratch buffer, resized as needed
+ *
+ * Uses the OpenMP threads available. Byte passes where every key has the same
+ * digit are skipped.
+ **/
+void radix_sort(
+    std::vector<std::uint64_t> &keys, std::vector<std::uint32_t> &values,
+    std::vector<std::uint64_t> &key_scratch,
+    std::vector<std::uint32_t> &value_scratch
+);
@@ -5,13 +5,14 @@
  **/
 #pragma once
 
-#include <cstdlib>
+#include <cstdint>
 #include <memory>
 #include <ostream>
 
-#include <glm/fwd.hpp>
+#include <glm/glm.hpp>
 
-#include "celestial_body.hpp"
+#include "body_store.hpp"
+#include "gravity_kernel.hpp"
 
 /**
  * \brief Octree class
@@ -31,14 +32,18 @@ public:
         glm::vec3 cube_start;
         /** Width of the cube **/
         float width;
-        /** Celestial body **/
-        std::shared_ptr<CelestialBody> body;
+        /** Index of the body of a leaf, BodyStore::null_index if empty **/
+        std::uint32_t body = BodyStore::null_index;
         /** Center of mass of node **/
         glm::vec3 center_of_mass;
         /** Total mass of node **/
         double total_mass = 0.0;
         /** Is leaf node **/
         bool is_leaf = true;
+        /** Lower corner of the tight box of the bodies **/
+        glm::vec3 box_min;
+        /** Upper corner of the tight box of the bodies **/
+        glm::vec3 box_max;
 
         /** left up front **/
         std::unique_ptr<Node> luf;
@@ -57,6 +62,20 @@ public:
         /** right bottom back **/
         std::unique_ptr<Node> rbb;
 
+        /** x of the center of mass of each child, one lane per child in the
+         * order of child(). The lanes are filled by split() and kept by
+         * insert(), a leaf leaves them unset **/
+        float child_x[8];
+        /** y of the center of mass of each child **/
+        float child_y[8];
+        /** z of the center of mass of each child **/
+        float child_z[8];
+        /** Total mass of each child **/
+        float child_mass[8];
+        /** Opening size of each child, see opening_size(), 0 for leaves so
+         * the opening test always accepts them **/
+        float child_bmax[8];
+
         /**
          * \brief Default constructor
          * \author João Vitor Espig (JotaEspig)
@@ -73,17 +92,20 @@ public:
         /**
          * \brief Insert a body into the node
          * \author João Vitor Espig (JotaEspig)
-         * \param body - celestial body
+         * \param bodies - bodies of the tree
+         * \param body - index of the body
          **/
-        void insert(const std::shared_ptr<CelestialBody> &body);
+        void insert(const BodyStore &bodies, std::uint32_t body);
         /**
          * \brief split the node into 8 leafs
          * \author João Vitor Espig (JotaEspig)
          *
+         * \param bodies - bodies of the tree
+         *
          * Turns a leaf node into a normal node with 8 leafs (where one of them
          * is the previous leaf node)
          **/
-        void split();
+        void split(const BodyStore &bodies);
         /**
          * \brief Gets the correct child node according to a position inside it
          * \author João Vitor Espig (JotaEspig)
@@ -91,23 +113,46 @@ public:
          * \returns correct child node
          **/
         std::unique_ptr<Node> &find_correct_child(const glm::vec3 &pos);
+        /**
+         * \brief Lane of the child holding a position
+         * \param pos - position
+         * \returns lane, right on bit 2, up on bit 1 and front on bit 0
+         **/
+        std::uint32_t child_index(const glm::vec3 &pos) const;
+        /**
+         * \brief Child of a lane
+         * \param lane - lane, see child_index()
+         * \returns child, nullptr before the node is split
+         **/
+        std::unique_ptr<Node> &child(std::uint32_t lane);
+        /**
+         * \brief Child of a lane
+         * \param lane - lane, see child_index()
+         * \returns child, nullptr before the node is split
+         **/
+        const std::unique_ptr<Node> &child(std::uint32_t lane) const;
         /**
          * \brief Calculates the final acceleration vector on a body
          * \author João Vitor Espig (JotaEspig)
-         * \param body - celestial body
-         * \param dt - delta time
+         * \tparam precision - precision of the sums
+         * \tparam softened - soften the body to body terms
+         * \param bodies - bodies of the tree
+         * \param body - index of the body
+         * \param softening2 - squared softening length
+         * \param can_accept_held - can theta accept a child holding the
+         * body in its tight box, which is then opened instead
          * \returns total acceleration
+         *
+         * The opening test and the point masses of the eight children are
+         * evaluated together in one vectorized pass over their lanes, only
+         * the children that must be opened are descended into
          **/
-        glm::vec3 net_acceleration_on_body(
-            std::shared_ptr<CelestialBody> body, double dt
+        template <Precision precision, bool softened>
+        glm::vec<3, typename PrecisionTypes<precision>::Accumulator>
+        net_acceleration_on_body(
+            const BodyStore &bodies, std::uint32_t body, float softening2,
+            bool can_accept_held
         ) const;
-        /**
-         * \brief Calculates the ratio width / distance to center of mass
-         * \author João Vitor Espig (JotaEspig)
-         * \param pos - position
-         * \returns ratio
-         **/
-        double ratio_width_distance(const glm::vec3 &pos) const;
 
         /** Overload of << operator **/
         friend std::ostream &operator<<(std::ostream &os, Node node);
@@ -117,22 +162,26 @@ public:
 
     private:
         /**
-         * \brief Should the body be counted for acceleration calculation
-         * \author João Vitor Espig (JotaEspig)
-         * \param other - other body
-         * \returns true if the body should be called
+         * \brief Copies a child into its lane
+         * \param lane - lane of the child
          **/
-        bool
-        should_be_called(const std::shared_ptr<CelestialBody> &other) const;
+        void refresh_child(std::uint32_t lane);
     };
 
     /** Simulation precision parameter, a high value means a low simulation
      * accuracy but it becomes quickier, and a low value means the opposite **/
     static double theta;
-    /** Initial start coordinate **/
-    float initial_coord = -1000.0f;
+    /** Size nodes are opened by, applied from the next build. KdTree has
+     * no cubes and always opens by bmax **/
+    static Opening opening;
+    /** Plummer softening length of the body to body sums, nodes accepted
+     * as point masses are never softened. Static like theta since the tree
+     * is built anew each step **/
+    static float softening;
+    /** 3D point where the root cube starts **/
+    glm::vec3 initial_cube_start{-1000.0f, -1000.0f, -1000.0f};
     /** Initial width for node **/
-    float initial_width = std::abs(2 * initial_coord);
+    float initial_width = 2000.0f;
 
     /** Root node **/
     std::unique_ptr<Node> root;
@@ -145,24 +194,52 @@ public:
     /**
      * \brief Constructor
      * \author João Vitor Espig (JotaEspig)
+     * \param bodies - bodies inserted, must outlive the tree
      * \param initial_coord - initial start coordinate
      **/
-    OcTree(float initial_coord);
+    OcTree(const BodyStore &bodies, float initial_coord);
+    /**
+     * \brief Constructor
+     * \param bodies - bodies inserted, must outlive the tree
+     * \param cube_start - 3D point where the root cube starts
+     * \param width - width of the root cube
+     **/
+    OcTree(const BodyStore &bodies, const glm::vec3 &cube_start, float width);
 
     /**
      * \brief Insert a body into the octree
      * \author João Vitor Espig (JotaEspig)
-     * \param body - celestial body
+     * \param body - index of the body, left out if it is removed or outside
+     * of the root cube
+     **/
+    void insert(std::uint32_t body);
+    /**
+     * \brief Is inside the root cube
+     * \param pos - position
+     * \returns true if pos is inside the root cube or on its faces
      **/
-    void insert(const std::shared_ptr<CelestialBody> &body);
+    bool contains(const glm::vec3 &pos) const;
     /**
      * \brief Calculates the net acceleration on a body
      * \author João Vitor Espig (JotaEspig)
-     * \param body - celestial body
+     * \param body - index of the body
      * \param dt - delta time
      * \returns net acceleration
      **/
-    glm::vec3 net_acceleration_on_body(
-        std::shared_ptr<CelestialBody> body, double dt
-    ) const;
+    glm::vec3 net_acceleration_on_body(std::uint32_t body, double dt) const;
+    /**
+     * \brief Calculates the net acceleration on a body
+     * \tparam precision - precision of the sums, instantiated for every
+     * Precision
+     * \tparam softened - soften the body to body terms, true only when
+     * softening is positive
+     * \param body - index of the body
+     * \returns net acceleration
+     **/
+    template <Precision precision, bool softened>
+    glm::vec3 net_acceleration_on_body(std::uint32_t body) const;
+
+private:
+    /** Bodies inserted **/
+    const BodyStore *_bodies = nullptr;
 };
@@ -0,0 +1,138 @@
+/**
+ * \file particle_mesh.hpp
+ * \brief Long range gravity on a mesh, the PM half of TreePM
+ **/
+#pragma once
+
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+/**
+ * \brief Particle-mesh solver of the long range part of gravity
+ *
+ * Masses are deposited on a cubic mesh with cloud-in-cell weights and
+ * convolved with the Green's function of the long range potential, -G
+ * erf(r / 2 r_s) / r, through FFTs. The mesh is padded to twice its size so
+ * the convolution is isolated, not periodic. Accelerations are taken from
+ * the potential by finite differences and interpolated back with the same
+ * cloud-in-cell weights. The rest of gravity, the short range part, is left
+ * to the tree walk, see LinearOcTree::split_radius.
+ **/
+class ParticleMesh {
+public:
+    /** Nodes per side of the mesh, a power of two of at least 8 since the
+     * FFTs are radix 2. The padded mesh of the FFTs has twice as many **/
+    std::uint32_t grid_size = 32;
+    /** Split scale r_s in cells, the mesh resolves gravity smoothed over a
+     * few of them **/
+    float split_cells = 2.0f;
+
+    /**
+     * \brief Fills the potential of the bodies on the mesh
+     * \param positions - body positions
+     * \param masses - body masses
+     * \param cube_start - 3D point where the cube holding the bodies starts
+     * \param width - width of that cube
+     *
+     * The mesh covers the cube and two nodes more on each side, bodies
+     * outside of it are clamped to its border
+     **/
+    void solve(
+        const std::vector<glm::vec3> &positions,
+        const std::vector<float> &masses, const glm::vec3 &cube_start,
+        float width
+    );
+    /**
+     * \brief Adds the long range acceleration at some positions
+     * \param positions - positions
+     * \param accelerations - one acceleration per position, the long range
+     * acceleration is added to the flagged ones
+     * \param active - flag per position, nullptr for every position
+     **/
+    void add_accelerations(
+        const std::vector<glm::vec3> &positions,
+        std::vector<glm::vec3> &accelerations,
+        const std::vector<std::uint8_t> *active = nullptr
+    ) const;
+    /**
+     * \brief Long range potential at a position
+     * \param pos - position
+     * \returns potential interpolated from the mesh of the last solve()
+     **/
+    float potential_at(const glm::vec3 &pos) const;
+    /**
+     * \brief Split scale of the last solve()
+     * \returns r_s in length units
+     **/
+    float split_radius() const;
+
+private:
+    /** 3D point of the first node **/
+    glm::vec3 _mesh_start{0.0f, 0.0f, 0.0f};
+    /** Distance between nodes **/
+    float _spacing = 0.0f;
+    /** Nodes per side of the current mesh **/
+    std::uint32_t _size = 0;
+    /** Split scale r_s of the current Green's function **/
+    float _split_radius = 0.0f;
+    /** Twiddle factors of the padded size **/
+    std::vector<std::complex<float>> _twiddles;
+    /** Transform of the Green's function on the padded mesh, real since the
+     * function is even **/
+    std::vector<float> _green;
+    /** Padded mesh, masses and then potential **/
+    std::vector<std::complex<float>> _padded;
+    /** Potential on the nodes **/
+    std::vector<float> _potential;
+    /** Acceleration on the nodes **/
+    std::vector<glm::vec3> _field;
+    /** Line buffer of each thread for the strided transforms **/
+    std::vector<std::vector<std::complex<float>>> _lines;
+
+    /**
+     * \brief Fills the transform of the Green's function for the current
+     * size, spacing and split scale
+     **/
+    void compute_green();
+    /**
+     * \brief Transforms the padded mesh along its three axes
+     * \param inverse - inverse transform
+     *
+     * Lines known to be zero before a forward transform, or not needed
+     * after an inverse one, are skipped, they hold the padding
+     **/
+    void transform(bool inverse);
+    /**
+     * \brief Transforms the lines of the padded mesh along one axis
+     * \param stride - distance between the values of a line
+     * \param line_stride - distance between two lines of the same plane
+     * \param plane_stride - distance between two planes of lines
+     * \param lines - lines per plane transformed
+     * \param planes - planes transformed
+     * \param inverse - inverse transform
+     **/
+    void transform_axis(
+        std::size_t stride, std::size_t line_stride, std::size_t plane_stride,
+        std::size_t lines, std::size_t planes, bool inverse
+    );
+    /**
+     * \brief Node index of a node
+     * \param x - x of the node
+     * \param y - y of the node
+     * \param z - z of the node
+     * \returns index inside _potential and _field
+     **/
+    std::size_t node(std::uint32_t x, std::uint32_t y, std::uint32_t z) const;
+    /**
+     * \brief Cloud-in-cell stencil of a position
+     * \param pos - position
+     * \param cell - receives the lower node of the stencil
+     * \param weight - receives the weight of the upper node on each axis
+     **/
+    void stencil(
+        const glm::vec3 &pos, glm::uvec3 &cell, glm::vec3 &weight
+    ) const;
+};
@@ -2,15 +2,18 @@
 #define DEBUG
 
 #include <algorithm>
+#include <chrono>
 #include <cstddef>
 #include <fstream>
 #include <iomanip>
 #include <ios>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <axolote/engine.hpp>
@@ -20,11 +23,23 @@
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/string_cast.hpp>
 #include <nlohmann/json.hpp>
+#include <omp.h>
 
 #include "app.hpp"
+#include "constants.hpp"
+#include "direct_sum.hpp"
 #include "gravitational_grid.hpp"
+#include "kd_tree.hpp"
+#include "linear_octree.hpp"
+#include "octree.hpp"
 #include "utils.hpp"
 
+/** Hermite is left out of the benchmark of larger systems, it is meant for
+ * few bodies and may take many substeps per step **/
+#define HERMITE_BENCHMARK_MAX_BODIES 1000
+/** Steps between two sorts of the bodies in the sorted benchmarks **/
+#define BENCHMARK_REORDER_INTERVAL 20
+
 #define UNUSED(x) (void)(x)
 
 struct BenchmarkResult {
@@ -61,6 +76,83 @@ void to_json(nlohmann::json &j, const BodyDataJSON &body_data) {
     };
 }
 
+/**
+ * \brief Finds the result of a benchmark entry
+ * \param results - results of the benchmark
+ * \param name - name of the entry
+ * \returns result of the entry, nullptr when it was skipped
+ **/
+static const BenchmarkResult *
+find_result(const std::vector<BenchmarkResult> &results, const char *name) {
+    const auto it = std::find_if(
+        results.begin(), results.end(),
+        [name](const BenchmarkResult &r) { return r.name == name; }
+    );
+    return it != results.end() ? &*it : nullptr;
+}
+
+/**
+ * \brief Counts the nodes of a pointer based octree
+ * \param node - subtree root
+ * \returns amount of nodes
+ **/
+static std::size_t count_nodes(const std::unique_ptr<OcTree::Node> &node) {
+    if (node == nullptr)
+        return 0;
+
+    return 1 + count_nodes(node->luf) + count_nodes(node->lub)
+           + count_nodes(node->lbf) + count_nodes(node->lbb)
+           + count_nodes(node->ruf) + count_nodes(node->rub)
+           + count_nodes(node->rbf) + count_nodes(node->rbb);
+}
+
+/**
+ * \brief Accelerations by direct summation, in double precision
+ * \param positions - positions of the bodies
+ * \param masses - masses of the bodies
+ * \returns acceleration on each body
+ **/
+static std::vector<glm::dvec3> direct_accelerations(
+    const std::vector<glm::vec3> &positions, const std::vector<float> &masses
+) {
+    std::vector<glm::dvec3> accelerations(positions.size());
+#pragma omp parallel for schedule(dynamic, 64)
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        glm::dvec3 acceleration{0.0, 0.0, 0.0};
+        for (std::size_t j = 0; j < positions.size(); ++j) {
+            const glm::dvec3 offset
+                = glm::dvec3{positions[j]} - glm::dvec3{positions[i]};
+            const double r = glm::length(offset);
+            if (r > 0.0)
+                acceleration += offset * (G * masses[j] / (r * r * r));
+        }
+        accelerations[i] = acceleration;
+    }
+    return accelerations;
+}
+
+/**
+ * \brief Mean relative error of approximated accelerations
+ * \param accelerations - approximated accelerations
+ * \param exact - accelerations by direct summation
+ * \returns mean of |a - exact| / |exact| over the bodies
+ **/
+static double mean_relative_error(
+    const std::vector<glm::vec3> &accelerations,
+    const std::vector<glm::dvec3> &exact
+) {
+    double sum = 0.0;
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < exact.size(); ++i) {
+        const double magnitude = glm::length(exact[i]);
+        if (magnitude == 0.0)
+            continue;
+        sum += glm::length(glm::dvec3{accelerations[i]} - exact[i]) / magnitude;
+        ++count;
+    }
+    return count == 0 ? 0.0 : sum / count;
+}
+
 void App::process_input() {
     KeyState l_key_state = get_key_state(Key::L);
     if (l_key_state == KeyState::PRESSED && !is_key_pressed(Key::L)) {
@@ -115,6 +207,7 @@ void App::main_loop(const char *json_filename, bool use_grav_grid) {
     using json = nlohmann::json;
     std::ifstream file(json_filename);
     json data = json::parse(file);
+    apply_options(data);
     double dt_multiplier = data["dt_multiplier"];
 
     std::string original_title = title();
@@ -148,8 +241,8 @@ void App::main_loop(const char *json_filename, bool use_grav_grid) {
     latitude = 30.0f;
 
     if (use_grav_grid) {
-        auto bodies = bodies_system->celestial_bodies();
-        auto grav_grid = std::make_shared<GravGrid>(bodies);
+        auto grav_grid
+            = std::make_shared<GravGrid>(bodies_system->celestial_bodies());
         grav_grid->bind_shader(gravgrid_shader);
         scene->add_drawable(grav_grid);
 
@@ -188,30 +281,74 @@ void App::benchmark(
 
     std::ifstream file(json_filename);
     json data = json::parse(file);
+    apply_options(data);
 
     const double dt = (1.0 / 60.0) * static_cast<double>(data["dt_multiplier"]);
 
     const std::vector<BenchmarkEntry> algorithms = {
         {CelestialBodySystem::SimulationAlgorithm::Naive, "Naive O(n²)"},
+        {CelestialBodySystem::SimulationAlgorithm::NaiveOpenMP,
+         "Naive O(n²) + OpenMP"},
         {CelestialBodySystem::SimulationAlgorithm::BarnesHut, "Barnes-Hut"},
         {CelestialBodySystem::SimulationAlgorithm::BarnesHutOpenMP,
          "Barnes-Hut + OpenMP"},
+        {CelestialBodySystem::SimulationAlgorithm::BarnesHutOpenMP,
+         "Barnes-Hut + OpenMP (sorted)",
+         CelestialBodySystem::TreeBuilder::Insertion, false, false,
+         BENCHMARK_REORDER_INTERVAL},
+        {CelestialBodySystem::SimulationAlgorithm::BarnesHutOpenMP,
+         "Barnes-Hut + OpenMP (Morton)",
+         CelestialBodySystem::TreeBuilder::Morton},
+        {CelestialBodySystem::SimulationAlgorithm::BarnesHutOpenMP,
+         "Barnes-Hut + OpenMP (refit)",
+         CelestialBodySystem::TreeBuilder::Morton, true},
+        {CelestialBodySystem::SimulationAlgorithm::BarnesHutOpenMP,
+         "Barnes-Hut + OpenMP (list reuse)",
+         CelestialBodySystem::TreeBuilder::Morton, true, true},
+        {CelestialBodySystem::SimulationAlgorithm::BarnesHutOpenMP,
+         "Barnes-Hut + OpenMP (kd-tree)",
+         CelestialBodySystem::TreeBuilder::KdTree},
+        {CelestialBodySystem::SimulationAlgorithm::BarnesHutOpenMP,
+         "Barnes-Hut + OpenMP (kd, sorted)",
+         CelestialBodySystem::TreeBuilder::KdTree, false, false,
+         BENCHMARK_REORDER_INTERVAL},
+        {CelestialBodySystem::SimulationAlgorithm::FMM, "Fast multipole"},
+        {CelestialBodySystem::SimulationAlgorithm::TreePM, "TreePM"},
+        {CelestialBodySystem::SimulationAlgorithm::Hermite, "Hermite"},
     };
 
     std::cout << "=============================================\n";
     std::cout << "Benchmark\n";
     std::cout << "Configuration    : " << json_filename << '\n';
     std::cout << "Simulation steps : " << simulation_steps << '\n';
+    std::cout << "Integrator       : "
+              << data.value("integrator", std::string{"euler"}) << '\n';
+    std::cout << "Direct sum ISA   : " << direct_sum_isa()
+              << ", tree walks baseline\n";
     std::cout << "=============================================\n\n";
 
     std::vector<BenchmarkResult> results;
+    // Names of the sorted entries and of the same entries in load order
+    std::vector<std::pair<const char *, const char *>> reordered;
 
     constexpr std::size_t warmup_steps = 100;
 
     for (const auto &benchmark : algorithms) {
+        if (benchmark.algorithm
+                == CelestialBodySystem::SimulationAlgorithm::Hermite
+            && data["bodies"].size() > HERMITE_BENCHMARK_MAX_BODIES) {
+            std::cout << "Skipping " << benchmark.name << ", more than "
+                      << HERMITE_BENCHMARK_MAX_BODIES << " bodies\n\n";
+            continue;
+        }
+
         // Reset simulation
         bodies_system->setup_using_json(data);
         bodies_system->algorithm = benchmark.algorithm;
+        bodies_system->tree_builder = benchmark.tree_builder;
+        bodies_system->octree_refit = benchmark.octree_refit;
+        bodies_system->linear_octree.reuse_lists = benchmark.reuse_lists;
+        bodies_system->reorder_interval = benchmark.reorder_interval;
 
         // Warm-up (not measured)
         std::cout << "Warming up " << benchmark.name << "...\n";
@@ -223,6 +360,10 @@ void App::benchmark(
         // Restart simulation so every algorithm starts from the same state
         bodies_system->setup_using_json(data);
         bodies_system->algorithm = benchmark.algorithm;
+        bodies_system->tree_builder = benchmark.tree_builder;
+        bodies_system->octree_refit = benchmark.octree_refit;
+        bodies_system->linear_octree.reuse_lists = benchmark.reuse_lists;
+        bodies_system->reorder_interval = benchmark.reorder_interval;
 
         auto start = std::chrono::steady_clock::now();
 
@@ -274,7 +415,22 @@ void App::benchmark(
             steps_per_second,
             body_steps_per_second,
             simulated_seconds_per_second,
+            elapsed_seconds,
         });
+        if (benchmark.reorder_interval == 0)
+            continue;
+        const auto unsorted = std::find_if(
+            algorithms.begin(), algorithms.end(),
+            [&benchmark](const BenchmarkEntry &entry) {
+                return entry.reorder_interval == 0
+                       && entry.algorithm == benchmark.algorithm
+                       && entry.tree_builder == benchmark.tree_builder
+                       && entry.octree_refit == benchmark.octree_refit
+                       && entry.reuse_lists == benchmark.reuse_lists;
+            }
+        );
+        if (unsorted != algorithms.end())
+            reordered.emplace_back(benchmark.name, unsorted->name);
     }
 
     std::cout << "\n";
@@ -282,17 +438,17 @@ void App::benchmark(
     std::cout << "Benchmark Summary\n";
     std::cout << "=============================================\n\n";
 
-    std::cout << std::left << std::setw(24) << "Algorithm" << std::right
+    std::cout << std::left << std::setw(32) << "Algorithm" << std::right
               << std::setw(15) << "Time (s)" << std::setw(18) << "Steps/s"
               << std::setw(15) << "Speedup" << std::setw(18) << "Sim sec/s"
               << '\n';
 
-    std::cout << std::string(90, '-') << '\n';
+    std::cout << std::string(98, '-') << '\n';
 
     const double baseline = results.front().steps_per_second;
 
     for (const auto &r : results) {
-        std::cout << std::left << std::setw(24) << r.name << std::right
+        std::cout << std::left << std::setw(32) << r.name << std::right
                   << std::setw(15) << std::fixed << std::setprecision(3)
                   << r.elapsed_seconds << std::setw(18) << std::setprecision(2)
                   << r.steps_per_second << std::setw(14)
@@ -314,9 +470,22 @@ void App::benchmark(
         std::cout << "  Improvement : +" << improvement << "%\n\n";
     };
 
-    printComparison(results[0], results[1]);
-    printComparison(results[1], results[2]);
-    printComparison(results[0], results[2]);
+    // Entries are looked up by name, the list grows and some entries are
+    // skipped on larger systems
+    const std::pair<const char *, const char *> comparisons[] = {
+        {"Naive O(n²)", "Naive O(n²) + OpenMP"},
+        {"Naive O(n²)", "Barnes-Hut"},
+        {"Barnes-Hut", "Barnes-Hut + OpenMP"},
+        {"Naive O(n²)", "Barnes-Hut + OpenMP"},
+        {"Barnes-Hut + OpenMP", "Barnes-Hut + OpenMP (Morton)"},
+        {"Barnes-Hut + OpenMP (Morton)", "Barnes-Hut + OpenMP (refit)"},
+    };
+    for (const auto &[a, b] : comparisons) {
+        const BenchmarkResult *result_a = find_result(results, a);
+        const BenchmarkResult *result_b = find_result(results, b);
+        if (result_a != nullptr && result_b != nullptr)
+            printComparison(*result_a, *result_b);
+    }
 
     const auto winner = std::max_element(
         results.begin(), results.end(),
@@ -329,6 +498,431 @@ void App::benchmark(
     std::cout << "Speed  : " << std::fixed << std::setprecision(2)
               << winner->steps_per_second << " steps/s\n";
 
+    // The Barnes-Hut + OpenMP entries only differ by their tree and the
+    // order of the bodies
+    const BenchmarkResult *fastest_tree = nullptr;
+    for (const auto &r : results) {
+        if (r.algorithm
+            != CelestialBodySystem::SimulationAlgorithm::BarnesHutOpenMP)
+            continue;
+        if (fastest_tree == nullptr
+            || r.steps_per_second > fastest_tree->steps_per_second)
+            fastest_tree = &r;
+    }
+    const auto fastest_entry = std::find_if(
+        algorithms.begin(), algorithms.end(),
+        [fastest_tree](const BenchmarkEntry &entry) {
+            return fastest_tree->name == entry.name;
+        }
+    );
+    // Options of main that run the simulation on that tree, the reuse of
+    // the lists implies the refit and the refit implies the Morton tree
+    std::string tree_options;
+    if (fastest_entry->reuse_lists)
+        tree_options += " --reuse-lists";
+    else if (fastest_entry->octree_refit)
+        tree_options += " --refit";
+    else if (fastest_entry->tree_builder
+             == CelestialBodySystem::TreeBuilder::Morton)
+        tree_options += " --morton";
+    else if (fastest_entry->tree_builder
+             == CelestialBodySystem::TreeBuilder::KdTree)
+        tree_options += " --kdtree";
+    if (fastest_entry->reorder_interval > 0)
+        tree_options
+            += " --reorder " + std::to_string(fastest_entry->reorder_interval);
+    std::cout << "Fastest tree : " << fastest_tree->name << " ("
+              << fastest_tree->steps_per_second << " steps/s)\n";
+    std::cout << "Run it with  : " << json_filename << tree_options
+              << "\n\n";
+
+    // Step time each tree gains from sorting the bodies
+    for (const auto &[sorted, unsorted] : reordered) {
+        const BenchmarkResult *before = find_result(results, unsorted);
+        const BenchmarkResult *after = find_result(results, sorted);
+        if (before == nullptr || after == nullptr)
+            continue;
+
+        const double before_ms
+            = before->elapsed_seconds / before->iterations * 1000.0;
+        const double after_ms
+            = after->elapsed_seconds / after->iterations * 1000.0;
+        std::cout << "Sorting every " << BENCHMARK_REORDER_INTERVAL
+                  << " steps, " << unsorted << '\n';
+        std::cout << "  Step time   : " << std::fixed << std::setprecision(3)
+                  << before_ms << " ms -> " << after_ms << " ms\n";
+        std::cout << "  Gain        : " << std::setprecision(2)
+                  << (before_ms - after_ms) / before_ms * 100.0 << "%\n\n";
+    }
+
+    std::cout << "=============================================\n\n";
+
+    benchmark_octrees(data, 50);
+}
+
+void App::apply_options(nlohmann::json &data) const {
+    if (!integrator.empty())
+        data["integrator"] = integrator;
+}
+
+void App::benchmark_octrees(nlohmann::json &data, std::size_t repetitions) {
+    using clock = std::chrono::steady_clock;
+
+    bodies_system->setup_using_json(data);
+    const BodyStore &bodies = bodies_system->celestial_bodies();
+    const std::vector<glm::vec3> positions = bodies.positions();
+    const std::vector<float> masses = bodies.masses();
+
+    std::cout << "=============================================\n";
+    std::cout << "Octree Benchmark\n";
+    std::cout << "Bodies      : " << bodies.size() << '\n';
+    std::cout << "Repetitions : " << repetitions << '\n';
+    std::cout << "=============================================\n\n";
+
+    // Both trees are traversed on a single thread so only the layout differs
+    glm::vec3 acc_sum{0.0f, 0.0f, 0.0f};
+
+    OcTree octree;
+    double octree_build = 0.0;
+    double octree_traversal = 0.0;
+    for (std::size_t r = 0; r < repetitions; ++r) {
+        auto start = clock::now();
+        octree = OcTree{bodies, 1000.0f};
+        for (std::uint32_t i = 0; i < bodies.size(); ++i) {
+            octree.insert(i);
+        }
+        auto built = clock::now();
+        for (std::uint32_t i = 0; i < bodies.size(); ++i) {
+            acc_sum += octree.net_acceleration_on_body(i, 0.0);
+        }
+        auto traversed = clock::now();
+
+        octree_build += std::chrono::duration<double>(built - start).count();
+        octree_traversal
+            += std::chrono::duration<double>(traversed - built).count();
+    }
+    const std::size_t octree_nodes = count_nodes(octree.root);
+
+    LinearOcTree linear_octree;
+    double linear_build = 0.0;
+    double linear_traversal = 0.0;
+    for (std::size_t r = 0; r < repetitions; ++r) {
+        auto start = clock::now();
+        linear_octree.build(positions, masses);
+        auto built = clock::now();
+        for (std::uint32_t i = 0; i < positions.size(); ++i) {
+            acc_sum += linear_octree.net_acceleration_on_body(i);
+        }
+        auto traversed = clock::now();
+
+        linear_build += std::chrono::duration<double>(built - start).count();
+        linear_traversal
+            += std::chrono::duration<double>(traversed - built).count();
+    }
+    const std::size_t linear_nodes = linear_octree.nodes().size();
+
+    double morton_build = 0.0;
+    double morton_traversal = 0.0;
+    for (std::size_t r = 0; r < repetitions; ++r) {
+        auto start = clock::now();
+        linear_octree.build_morton(positions, masses);
+        auto built = clock::now();
+        for (std::uint32_t i = 0; i < positions.size(); ++i) {
+            acc_sum += linear_octree.net_acceleration_on_body(i);
+        }
+        auto traversed = clock::now();
+
+        morton_build += std::chrono::duration<double>(built - start).count();
+        morton_traversal
+            += std::chrono::duration<double>(traversed - built).count();
+    }
+    const std::size_t morton_nodes = linear_octree.nodes().size();
+
+    KdTree kd_tree{bodies};
+    const KdTree::Split splits[] = {KdTree::Split::Median, KdTree::Split::SAH};
+    double kd_build[2] = {0.0, 0.0};
+    double kd_traversal[2] = {0.0, 0.0};
+    std::size_t kd_nodes[2];
+    for (int s = 0; s < 2; ++s) {
+        kd_tree.split = splits[s];
+        for (std::size_t r = 0; r < repetitions; ++r) {
+            auto start = clock::now();
+            kd_tree.clear(bodies);
+            for (std::uint32_t i = 0; i < bodies.size(); ++i) {
+                kd_tree.insert(i);
+            }
+            kd_tree.build();
+            auto built = clock::now();
+            for (std::uint32_t i = 0; i < bodies.size(); ++i) {
+                acc_sum += kd_tree.net_acceleration_on_body(i, 0.0);
+            }
+            auto traversed = clock::now();
+
+            kd_build[s]
+                += std::chrono::duration<double>(built - start).count();
+            kd_traversal[s]
+                += std::chrono::duration<double>(traversed - built).count();
+        }
+        kd_nodes[s] = kd_tree.nodes().size();
+    }
+
+    std::vector<glm::vec3> accelerations;
+    double grouped_build = 0.0;
+    double grouped_traversal = 0.0;
+    for (std::size_t r = 0; r < repetitions; ++r) {
+        auto start = clock::now();
+        linear_octree.build_morton(positions, masses);
+        auto built = clock::now();
+        linear_octree.net_accelerations(accelerations);
+        for (auto &acc : accelerations) {
+            acc_sum += acc;
+        }
+        auto traversed = clock::now();
+
+        grouped_build += std::chrono::duration<double>(built - start).count();
+        grouped_traversal
+            += std::chrono::duration<double>(traversed - built).count();
+    }
+
+    // Refit needs moving bodies, so they drift along their velocities and
+    // are compared against a Morton rebuild on the same positions
+    const double dt = (1.0 / 60.0) * static_cast<double>(data["dt_multiplier"]);
+    std::vector<glm::vec3> moved_positions = positions;
+    LinearOcTree rebuilt_octree;
+    double rebuilt_build = 0.0;
+    double rebuilt_traversal = 0.0;
+    double refit_build = 0.0;
+    double refit_traversal = 0.0;
+    std::size_t rebuilds = 0;
+    linear_octree.clear();
+    for (std::size_t r = 0; r < repetitions; ++r) {
+        for (std::size_t i = 0; i < bodies.size(); ++i) {
+            moved_positions[i]
+                += bodies.velocities()[i] * static_cast<float>(dt);
+        }
+
+        auto start = clock::now();
+        rebuilt_octree.build_morton(moved_positions, masses);
+        auto built = clock::now();
+        for (std::uint32_t i = 0; i < positions.size(); ++i) {
+            acc_sum += rebuilt_octree.net_acceleration_on_body(i);
+        }
+        auto traversed = clock::now();
+
+        rebuilt_build += std::chrono::duration<double>(built - start).count();
+        rebuilt_traversal
+            += std::chrono::duration<double>(traversed - built).count();
+
+        start = clock::now();
+        if (!linear_octree.refit(moved_positions, masses)) {
+            linear_octree.build_morton(moved_positions, masses);
+            ++rebuilds;
+        }
+        built = clock::now();
+        for (std::uint32_t i = 0; i < positions.size(); ++i) {
+            acc_sum += linear_octree.net_acceleration_on_body(i);
+        }
+        traversed = clock::now();
+
+        refit_build += std::chrono::duration<double>(built - start).count();
+        refit_traversal
+            += std::chrono::duration<double>(traversed - built).count();
+    }
+    const std::size_t rebuilt_nodes = rebuilt_octree.nodes().size();
+    const std::size_t refit_nodes = linear_octree.nodes().size();
+
+    // Grouped walks of the same moving bodies on the refitted tree, walking
+    // the tree for every group or reusing the interaction lists
+    double list_traversal[2] = {0.0, 0.0};
+    std::size_t walked_groups = 0;
+    std::size_t groups = 0;
+    for (int reuse = 0; reuse < 2; ++reuse) {
+        moved_positions = positions;
+        linear_octree.clear();
+        linear_octree.reuse_lists = reuse == 1;
+        for (std::size_t r = 0; r < repetitions; ++r) {
+            for (std::size_t i = 0; i < bodies.size(); ++i) {
+                moved_positions[i]
+                    += bodies.velocities()[i] * static_cast<float>(dt);
+            }
+            if (!linear_octree.refit(moved_positions, masses))
+                linear_octree.build_morton(moved_positions, masses);
+
+            auto start = clock::now();
+            linear_octree.net_accelerations(accelerations);
+            acc_sum += accelerations[0];
+            auto traversed = clock::now();
+
+            list_traversal[reuse]
+                += std::chrono::duration<double>(traversed - start).count();
+            if (reuse == 1) {
+                walked_groups += linear_octree.walked_groups();
+                groups += linear_octree.group_count();
+            }
+        }
+    }
+    linear_octree.reuse_lists = false;
+
+    // Higher orders are compared at equal accuracy: each one takes the widest
+    // theta whose error stays within the monopole error at theta 0.5
+    const std::vector<glm::dvec3> exact
+        = direct_accelerations(positions, masses);
+    const LinearOcTree::Multipole orders[] = {
+        LinearOcTree::Multipole::Monopole, LinearOcTree::Multipole::Quadrupole,
+        LinearOcTree::Multipole::Octupole
+    };
+    const char *order_names[] = {"Monopole", "Quadrupole", "Octupole"};
+    const double saved_theta = LinearOcTree::theta;
+    double order_theta[3];
+    double order_error[3];
+    double order_step[3];
+    for (int o = 0; o < 3; ++o) {
+        linear_octree.multipole = orders[o];
+        LinearOcTree::theta = 0.5;
+        linear_octree.build_morton(positions, masses);
+        linear_octree.net_accelerations(accelerations);
+        order_theta[o] = LinearOcTree::theta;
+        order_error[o] = mean_relative_error(accelerations, exact);
+
+        // The monopole sets the target, the others widen theta up to it
+        for (int t = 6; o > 0 && t <= 15; ++t) {
+            LinearOcTree::theta = t / 10.0;
+            linear_octree.build_morton(positions, masses);
+            linear_octree.net_accelerations(accelerations);
+            const double error = mean_relative_error(accelerations, exact);
+            if (error > order_error[0])
+                break;
+            order_theta[o] = LinearOcTree::theta;
+            order_error[o] = error;
+        }
+
+        LinearOcTree::theta = order_theta[o];
+        auto start = clock::now();
+        for (std::size_t r = 0; r < repetitions; ++r) {
+            linear_octree.build_morton(positions, masses);
+            linear_octree.net_accelerations(accelerations);
+            acc_sum += accelerations[0];
+        }
+        auto stepped = clock::now();
+        order_step[o] = std::chrono::duration<double>(stepped - start).count()
+                        / repetitions;
+    }
+    LinearOcTree::theta = saved_theta;
+    linear_octree.multipole = LinearOcTree::Multipole::Monopole;
+    UNUSED(acc_sum);
+
+    auto print_tree = [&](const char *name, std::size_t nodes,
+                          std::size_t bytes_per_node, double build,
+                          double traversal) {
+        std::cout << name << '\n';
+        std::cout << "---------------------------------------------\n";
+        std::cout << "Nodes                 : " << nodes << '\n';
+        std::cout << "Bytes / node          : " << bytes_per_node << '\n';
+        std::cout << "Tree size             : " << std::fixed
+                  << std::setprecision(2)
+                  << nodes * bytes_per_node / 1024.0 << " KiB\n";
+        std::cout << "Build / step          : " << std::setprecision(3)
+                  << build * 1000.0 / repetitions << " ms\n";
+        std::cout << "Traversal / step      : "
+                  << traversal * 1000.0 / repetitions << " ms\n\n";
+    };
+
+    // OcTree nodes are separate heap blocks, so malloc bookkeeping is on top
+    // of the reported size
+    print_tree(
+        "OcTree (unique_ptr nodes)", octree_nodes, sizeof(OcTree::Node),
+        octree_build, octree_traversal
+    );
+    print_tree(
+        "LinearOcTree (arena)", linear_nodes, sizeof(LinearOcTree::Node),
+        linear_build, linear_traversal
+    );
+    print_tree(
+        "LinearOcTree (Morton, parallel)", morton_nodes,
+        sizeof(LinearOcTree::Node), morton_build, morton_traversal
+    );
+    print_tree(
+        "LinearOcTree (Morton, grouped walk)", morton_nodes,
+        sizeof(LinearOcTree::Node), grouped_build, grouped_traversal
+    );
+    print_tree(
+        "LinearOcTree (Morton, moving bodies)", rebuilt_nodes,
+        sizeof(LinearOcTree::Node), rebuilt_build, rebuilt_traversal
+    );
+    print_tree(
+        "LinearOcTree (refit, moving bodies)", refit_nodes,
+        sizeof(LinearOcTree::Node), refit_build, refit_traversal
+    );
+    print_tree(
+        "KdTree (median split)", kd_nodes[0], sizeof(KdTree::Node),
+        kd_build[0], kd_traversal[0]
+    );
+    print_tree(
+        "KdTree (SAH split)", kd_nodes[1], sizeof(KdTree::Node), kd_build[1],
+        kd_traversal[1]
+    );
+
+    std::cout << "LinearOcTree vs OcTree\n";
+    std::cout << "  Build speedup     : " << std::fixed << std::setprecision(2)
+              << octree_build / linear_build << "x\n";
+    std::cout << "  Traversal speedup : "
+              << octree_traversal / linear_traversal << "x\n";
+    std::cout << "LinearOcTree (Morton) vs OcTree\n";
+    std::cout << "  Build speedup     : " << octree_build / morton_build
+              << "x (" << omp_get_max_threads() << " threads)\n";
+    std::cout << "LinearOcTree (grouped walk) vs LinearOcTree (Morton)\n";
+    std::cout << "  Traversal speedup : "
+              << morton_traversal / grouped_traversal << "x ("
+              << omp_get_max_threads() << " threads)\n";
+    std::cout << "LinearOcTree (refit) vs LinearOcTree (Morton)\n";
+    std::cout << "  Build speedup     : " << rebuilt_build / refit_build
+              << "x (" << rebuilds << " rebuilds in " << repetitions
+              << " steps)\n";
+    std::cout << "  Traversal speedup : " << rebuilt_traversal / refit_traversal
+              << "x\n\n";
+    std::cout << "LinearOcTree (list reuse) vs LinearOcTree (refit), grouped "
+                 "walk\n";
+    std::cout << "  Traversal speedup : "
+              << list_traversal[0] / list_traversal[1] << "x ("
+              << std::setprecision(1) << 100.0 * walked_groups / groups
+              << "% of the groups walked)\n\n";
+
+    // Build and walk of one body at a time on the same bodies, the grouped
+    // walk and the refit are left out
+    const std::pair<const char *, double> trees[] = {
+        {"OcTree", octree_build + octree_traversal},
+        {"LinearOcTree", linear_build + linear_traversal},
+        {"LinearOcTree (Morton)", morton_build + morton_traversal},
+        {"KdTree (median split)", kd_build[0] + kd_traversal[0]},
+        {"KdTree (SAH split)", kd_build[1] + kd_traversal[1]},
+    };
+    const auto fastest_build_walk = std::min_element(
+        std::begin(trees), std::end(trees),
+        [](const auto &a, const auto &b) { return a.second < b.second; }
+    );
+    std::cout << "Fastest build+walk : " << fastest_build_walk->first << " ("
+              << std::setprecision(3)
+              << fastest_build_walk->second * 1000.0 / repetitions
+              << " ms build + traversal / step)\n";
+    std::cout << "KdTree (SAH) vs OcTree\n";
+    std::cout << "  Traversal speedup : " << std::setprecision(2)
+              << octree_traversal / kd_traversal[1] << "x\n\n";
+
+    std::cout << "LinearOcTree multipoles at equal accuracy (grouped walk)\n";
+    std::cout << "---------------------------------------------\n";
+    for (int o = 0; o < 3; ++o) {
+        std::cout << order_names[o] << '\n';
+        std::cout << "  Theta             : " << std::setprecision(2)
+                  << order_theta[o] << '\n';
+        std::cout << "  Mean error        : " << std::scientific
+                  << std::setprecision(3) << order_error[o] << std::fixed
+                  << '\n';
+        std::cout << "  Step              : " << order_step[o] * 1000.0
+                  << " ms (" << std::setprecision(1) << 1.0 / order_step[o]
+                  << " steps/s)\n";
+        std::cout << "  Speedup           : " << std::setprecision(2)
+                  << order_step[0] / order_step[o] << "x\n";
+    }
     std::cout << "=============================================\n";
 }
 
@@ -336,6 +930,7 @@ void App::bake(const char *json_filename) {
     using json = nlohmann::json;
     std::ifstream file(json_filename);
     json data = json::parse(file);
+    apply_options(data);
     double dt_multiplier = data["dt_multiplier"];
 
     // Current scene is needed for process input from user
@@ -365,17 +960,17 @@ void App::bake(const char *json_filename) {
 
         bodies_system->update(_absolute_time, dt);
 
-        int i = 0;
-        int size = bodies_system->celestial_bodies().size();
+        const BodyStore &bodies = bodies_system->celestial_bodies();
+        int size = bodies.size();
         outputfile << "[";
-        for (auto &c : bodies_system->celestial_bodies()) {
-            BodyDataJSON b = {c->mass(), c->pos.x, c->pos.y, c->pos.z};
+        for (int i = 0; i < size; ++i) {
+            const glm::vec3 &pos = bodies.positions()[i];
+            BodyDataJSON b = {bodies.masses()[i], pos.x, pos.y, pos.z};
             json outputjson = b;
             outputfile << outputjson;
             if (i < size - 1) {
                 outputfile << ",";
             }
-            ++i;
         }
         outputfile << "]";
 
@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include <glm/geometric.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "body_store.hpp"
+
+#define BASE_MASS_INTERPOLATION 200.0f
+#define START_COLOR        \
+    glm::vec3 {            \
+        0.0f, 0.749f, 1.0f \
+    }
+#define END_COLOR           \
+    glm::vec3 {             \
+        1.0f, 0.4549f, 0.0f \
+    }
+#define COLOR_INTERPOLATION(c1, c2, f)                      \
+    glm::vec3 {                                             \
+        c1.x + (c2.x - c1.x) * f, c1.y + (c2.y - c1.y) * f, \
+            c1.z + (c2.z - c1.z) * f                        \
+    }
+
+// ---- HANDLE ----
+
+BodyStore::Handle::Handle(BodyStore *store, Id id) :
+  _store{store},
+  _id{id} {
+}
+
+BodyStore::Id BodyStore::Handle::id() const {
+    return _id;
+}
+
+bool BodyStore::Handle::is_valid() const {
+    return _store != nullptr && _store->index_of(_id) != null_index;
+}
+
+std::size_t BodyStore::Handle::index() const {
+    return _store->index_of(_id);
+}
+
+glm::vec3 &BodyStore::Handle::pos() const {
+    return _store->_positions[index()];
+}
+
+glm::vec3 &BodyStore::Handle::velocity() const {
+    return _store->_velocities[index()];
+}
+
+float BodyStore::Handle::mass() const {
+    return _store->_masses[index()];
+}
+
+float BodyStore::Handle::radius() const {
+    return _store->_radii[index()];
+}
+
+// ---- BODY STORE ----
+
+std::size_t BodyStore::size() const {
+    return _positions.size();
+}
+
+bool BodyStore::empty() const {
+    return _positions.empty();
+}
+
+void BodyStore::clear() {
+    _positions.clear();
+    _velocities.clear();
+    _masses.clear();
+    _radii.clear();
+    _colors.clear();
+    _removed.clear();
+    _ids.clear();
+    _indices.clear();
+}
+
+void BodyStore::reserve(std::size_t count) {
+    _positions.reserve(count);
+    _velocities.reserve(count);
+    _masses.reserve(count);
+    _radii.reserve(count);
+    _colors.reserve(count);
+    _removed.reserve(count);
+    _ids.reserve(count);
+    _indices.reserve(count);
+}
+
+BodyStore::Handle
+BodyStore::add(float mass, const glm::vec3 &pos, const glm::vec3 &velocity) {
+    const Id id = _indices.size();
+    _indices.push_back(_positions.size());
+    _positions.push_back(pos);
+    _velocities.push_back(velocity);
+    _masses.push_back(0.0f);
+    _radii.push_back(0.0f);
+    _colors.push_back(START_COLOR);
+    _removed.push_back(0);
+    _ids.push_back(id);
+    set_mass(_positions.size() - 1, mass);
+    return Handle{this, id};
+}
+
+BodyStore::Handle BodyStore::handle(std::size_t body) {
+    return Handle{this, _ids[body]};
+}
+
+BodyStore::Handle BodyStore::find(Id id) {
+    return Handle{this, id};
+}
+
+std::uint32_t BodyStore::index_of(Id id) const {
+    if (id >= _indices.size())
+        return null_index;
+    return _indices[id];
+}
+
+const std::vector<glm::vec3> &BodyStore::positions() const {
+    return _positions;
+}
+
+std::vector<glm::vec3> &BodyStore::positions() {
+    return _positions;
+}
+
+const std::vector<glm::vec3> &BodyStore::velocities() const {
+    return _velocities;
+}
+
+std::vector<glm::vec3> &BodyStore::velocities() {
+    return _velocities;
+}
+
+const std::vector<float> &BodyStore::masses() const {
+    return _masses;
+}
+
+const std::vector<float> &BodyStore::radii() const {
+    return _radii;
+}
+
+const std::vector<glm::vec3> &BodyStore::colors() const {
+    return _colors;
+}
+
+const std::vector<BodyStore::Id> &BodyStore::ids() const {
+    return _ids;
+}
+
+void BodyStore::set_mass(std::size_t body, float mass) {
+    _masses[body] = mass;
+    _radii[body] = std::max(0.5f, std::log2(mass) / 2.0f);
+    _colors[body] = COLOR_INTERPOLATION(
+        START_COLOR, END_COLOR, mass / BASE_MASS_INTERPOLATION
+    );
+}
+
+void BodyStore::remove(std::size_t body) {
+    _removed[body] = 1;
+}
+
+bool BodyStore::is_removed(std::size_t body) const {
+    return _removed[body];
+}
+
+std::size_t BodyStore::compact() {
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < _positions.size(); ++i) {
+        if (_removed[i]) {
+            _indices[_ids[i]] = null_index;
+            continue;
+        }
+
+        if (kept != i) {
+            _positions[kept] = _positions[i];
+            _velocities[kept] = _velocities[i];
+            _masses[kept] = _masses[i];
+            _radii[kept] = _radii[i];
+            _colors[kept] = _colors[i];
+            _removed[kept] = 0;
+            _ids[kept] = _ids[i];
+            _indices[_ids[i]] = kept;
+        }
+        ++kept;
+    }
+
+    const std::size_t erased = _positions.size() - kept;
+    _positions.resize(kept);
+    _velocities.resize(kept);
+    _masses.resize(kept);
+    _radii.resize(kept);
+    _colors.resize(kept);
+    _removed.resize(kept);
+    _ids.resize(kept);
+    return erased;
+}
+
+void BodyStore::reorder(const std::vector<std::uint32_t> &order) {
+    auto gather = [&order](auto &values) {
+        std::remove_reference_t<decltype(values)> sorted(values.size());
+        for (std::size_t i = 0; i < order.size(); ++i)
+            sorted[i] = values[order[i]];
+        values.swap(sorted);
+    };
+    gather(_positions);
+    gather(_velocities);
+    gather(_masses);
+    gather(_radii);
+    gather(_colors);
+    gather(_removed);
+    gather(_ids);
+    for (std::size_t i = 0; i < _ids.size(); ++i)
+        _indices[_ids[i]] = i;
+}
+
+bool BodyStore::is_colliding(std::size_t a, std::size_t b) const {
+    return (_radii[a] + _radii[b])
+           > glm::distance(_positions[a], _positions[b]);
+}
+
+bool BodyStore::should_merge(std::size_t a, std::size_t b) const {
+    bool is_massive_enough = std::max(_masses[a], _masses[b]) >= 50.0f;
+    bool is_close_enough = glm::distance(_positions[a], _positions[b])
+                           < std::max(_radii[a], _radii[b]) * 0.1f;
+    return is_massive_enough || is_close_enough;
+}
+
+void BodyStore::collide(std::size_t a, std::size_t b) {
+    // If the two bodies are way too close to each other, they are merged
+    if (should_merge(a, b)) {
+        merge(a, b);
+        return;
+    }
+
+    glm::vec3 dir = glm::normalize(_positions[a] - _positions[b]);
+    float dist = glm::length(_positions[a] - _positions[b]);
+
+    float inv_mass_a = 1 / (_masses[a] + 1);
+    float inv_mass_b = 1 / (_masses[b] + 1);
+    float r = (_radii[a] + _radii[b]) / 2;
+    glm::vec3 mtd
+        = dir * ((2 * r - dist) * inv_mass_a / (inv_mass_a + inv_mass_b));
+    _positions[a] += mtd;
+
+    float impact_speed = glm::dot(_velocities[a] - _velocities[b], dir);
+    glm::vec3 force = dir * (impact_speed * 0.5f);
+    _velocities[a] -= force;
+}
+
+void BodyStore::merge(std::size_t a, std::size_t b) {
+    float new_mass = _masses[a] + _masses[b];
+    _positions[a]
+        = (_positions[a] * _masses[a] + _positions[b] * _masses[b]) / new_mass;
+    _velocities[a]
+        = (_velocities[a] * _masses[a] + _velocities[b] * _masses[b])
+          / new_mass;
+    set_mass(a, new_mass);
+    remove(b);
+}
+
+glm::mat4 BodyStore::model_matrix(std::size_t body) const {
+    const float radius = _radii[body];
+    glm::mat4 mat = glm::translate(glm::mat4{1.0f}, _positions[body]);
+    return glm::scale(mat, glm::vec3{radius, radius, radius});
+}
@@ -1,7 +1,13 @@
 #define DEBUG
 #include <axolote/utils.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <axolote/glad/glad.h>
@@ -12,15 +18,184 @@
 #include <omp.h>
 
 #include "celestial_body_system.hpp"
+#include "morton.hpp"
 #include "octree.hpp"
 
 #define UNUSED(x) (void)(x)
+/** Padding always kept around the bodies, rounding would leave the extreme
+ * ones out of the root cube otherwise **/
+#define MIN_DOMAIN_PADDING 1e-4f
+/** Width of the root cube of a system without extent **/
+#define MIN_DOMAIN_WIDTH 1.0f
+/** Smallest particle mesh, two margin nodes on each side leave a few cells
+ * for the cube **/
+#define MIN_PM_GRID 8
+/** Largest particle mesh, its padded FFT mesh already takes 64 GiB **/
+#define MAX_PM_GRID 1024
 
 void CelestialBodySystem::setup_using_json(nlohmann::json &data) {
     using json = nlohmann::json;
 
-    _celestial_bodies.clear();
+    _bodies.clear();
+    integrator.reset();
+    linear_octree.clear();
+    _root_width = 0.0f;
+    _steps_since_reorder = 0;
+    fixed_domain = data.contains("domain");
+    if (fixed_domain) {
+        json domain = data["domain"];
+        domain_width = domain["width"];
+        glm::vec3 center;
+        center.x = domain["center"]["x"];
+        center.y = domain["center"]["y"];
+        center.z = domain["center"]["z"];
+        domain_start = center - domain_width / 2;
+    }
+    if (data.contains("collisions"))
+        detect_collisions = data["collisions"];
+    if (data.contains("domain_padding"))
+        domain_padding = data["domain_padding"];
+    if (data.contains("domain_hysteresis"))
+        domain_hysteresis = data["domain_hysteresis"];
+    if (data.contains("rebuild_interval"))
+        linear_octree.rebuild_interval = data["rebuild_interval"];
+    if (data.contains("reuse_lists"))
+        linear_octree.reuse_lists = data["reuse_lists"];
+    if (data.contains("list_margin"))
+        linear_octree.list_margin = data["list_margin"];
+    if (data.contains("bucket_size"))
+        linear_octree.bucket_size = data["bucket_size"];
+    if (data.contains("max_tree_depth"))
+        linear_octree.max_depth = data["max_tree_depth"];
+    if (data.contains("theta")) {
+        OcTree::theta = data["theta"];
+        LinearOcTree::theta = data["theta"];
+        KdTree::theta = data["theta"];
+    }
+    if (data.contains("opening")) {
+        std::string name = data["opening"];
+        Opening opening = Opening::Bmax;
+        if (name == "width")
+            opening = Opening::Width;
+        else if (name != "bmax")
+            axolote::debug(
+                axolote::DebugType::WARNING,
+                "Unknown opening \"%s\", using bmax", name.c_str()
+            );
+        OcTree::opening = opening;
+        LinearOcTree::opening = opening;
+    }
+    if (data.contains("kd_leaf_size"))
+        kd_tree.leaf_size = data["kd_leaf_size"];
+    if (data.contains("kd_split")) {
+        std::string split = data["kd_split"];
+        if (split == "median")
+            kd_tree.split = KdTree::Split::Median;
+        else if (split == "sah")
+            kd_tree.split = KdTree::Split::SAH;
+        else {
+            kd_tree.split = KdTree::Split::Median;
+            axolote::debug(
+                axolote::DebugType::WARNING,
+                "Unknown kd-tree split \"%s\", using median", split.c_str()
+            );
+        }
+    }
+    if (data.contains("integrator")) {
+        std::string name = data["integrator"];
+        if (!Integrator::parse(name, integrator.scheme))
+            axolote::debug(
+                axolote::DebugType::WARNING,
+                "Unknown integrator \"%s\", keeping the current one",
+                name.c_str()
+            );
+    }
+    if (data.contains("block_levels"))
+        integrator.block_levels = data["block_levels"];
+    if (data.contains("block_eta"))
+        integrator.block_eta = data["block_eta"];
+    if (data.contains("softening")) {
+        direct.softening = data["softening"];
+        OcTree::softening = data["softening"];
+        kd_tree.softening = data["softening"];
+        linear_octree.softening = data["softening"];
+        fmm.softening = data["softening"];
+        hermite.softening = data["softening"];
+    }
+    if (data.contains("hermite_eta"))
+        hermite.eta = data["hermite_eta"];
+    if (data.contains("fmm_order"))
+        fmm.order = data["fmm_order"];
+    if (data.contains("fmm_theta"))
+        fmm.theta = data["fmm_theta"];
+    if (data.contains("test_particle_mass")) {
+        test_particle_mass = data["test_particle_mass"];
+        collision_detector.test_particle_mass = data["test_particle_mass"];
+    }
+    if (data.contains("heavy_bodies"))
+        heavy_bodies = data["heavy_bodies"];
+    if (data.contains("heavy_mass_fraction"))
+        heavy_mass_fraction = data["heavy_mass_fraction"];
+    if (data.contains("reorder_interval"))
+        reorder_interval = data["reorder_interval"];
+    if (data.contains("fmm_leaf_size"))
+        fmm.leaf_size = data["fmm_leaf_size"];
+    if (data.contains("pm_grid")) {
+        const std::int64_t grid_size = data["pm_grid"];
+        // The FFTs of the mesh are radix 2
+        bool is_power_of_two = (grid_size & (grid_size - 1)) == 0;
+        if (grid_size >= MIN_PM_GRID && grid_size <= MAX_PM_GRID
+            && is_power_of_two)
+            mesh.grid_size = grid_size;
+        else {
+            mesh.grid_size = ParticleMesh{}.grid_size;
+            axolote::debug(
+                axolote::DebugType::WARNING,
+                "pm_grid %lld is not a power of two from %d to %d, using %u",
+                static_cast<long long>(grid_size), MIN_PM_GRID, MAX_PM_GRID,
+                mesh.grid_size
+            );
+        }
+    }
+    if (data.contains("pm_split_cells"))
+        mesh.split_cells = data["pm_split_cells"];
+    if (data.contains("precision")) {
+        std::string name = data["precision"];
+        if (name == "float")
+            precision = Precision::Float;
+        else if (name == "mixed")
+            precision = Precision::Mixed;
+        else if (name == "double")
+            precision = Precision::Double;
+        else {
+            precision = Precision::Float;
+            axolote::debug(
+                axolote::DebugType::WARNING,
+                "Unknown precision \"%s\", using float", name.c_str()
+            );
+        }
+        direct.precision = precision;
+        linear_octree.precision = precision;
+    }
+    if (data.contains("multipole")) {
+        std::string multipole = data["multipole"];
+        if (multipole == "monopole")
+            linear_octree.multipole = LinearOcTree::Multipole::Monopole;
+        else if (multipole == "quadrupole")
+            linear_octree.multipole = LinearOcTree::Multipole::Quadrupole;
+        else if (multipole == "octupole")
+            linear_octree.multipole = LinearOcTree::Multipole::Octupole;
+        else {
+            linear_octree.multipole = LinearOcTree::Multipole::Monopole;
+            axolote::debug(
+                axolote::DebugType::WARNING,
+                "Unknown multipole \"%s\", using monopole", multipole.c_str()
+            );
+        }
+    }
+
     json bodies = data["bodies"];
+    _bodies.reserve(bodies.size());
     for (auto &e : bodies) {
         glm::vec3 pos;
         glm::vec3 vel;
@@ -35,7 +210,12 @@ void CelestialBodySystem::setup_using_json(nlohmann::json &data) {
 }
 
 void CelestialBodySystem::setup_using_baked_frame_json(nlohmann::json &data) {
-    _celestial_bodies.clear();
+    _bodies.clear();
+    integrator.reset();
+    _bodies.reserve(data.size());
+    linear_octree.clear();
+    _root_width = 0.0f;
+    _steps_since_reorder = 0;
     for (auto &e : data) {
         double mass = e["m"];
         glm::vec3 pos;
@@ -51,16 +231,7 @@ void CelestialBodySystem::setup_using_baked_frame_json(nlohmann::json &data) {
 }
 
 void CelestialBodySystem::setup_instanced_vbo() {
-    std::size_t amount = _celestial_bodies.size();
-    std::vector<glm::mat4> model_matrices;
-    for (std::size_t i = 0; i < amount; ++i) {
-        model_matrices.push_back(_celestial_bodies[i]->mat);
-    }
-
-    std::vector<glm::vec4> colors;
-    for (std::size_t i = 0; i < amount; ++i) {
-        colors.push_back({_celestial_bodies[i]->color(), 1.0f});
-    }
+    pack_instances();
 
     std::shared_ptr<axolote::gl::VAO> vao = sphere.vao;
     vao->bind();
@@ -68,7 +239,7 @@ void CelestialBodySystem::setup_instanced_vbo() {
     // Colors VBO
     instanced_colors_vbo->bind();
     instanced_colors_vbo->buffer_data(
-        colors.size() * sizeof(glm::vec4), colors.data(), GL_DYNAMIC_DRAW
+        _colors.size() * sizeof(glm::vec4), _colors.data(), GL_DYNAMIC_DRAW
     );
     vao->link_attrib(instanced_colors_vbo, 1, 4, GL_FLOAT, 0, (void *)0);
     vao->attrib_divisor(instanced_colors_vbo, 1, 1);
@@ -80,7 +251,7 @@ void CelestialBodySystem::setup_instanced_vbo() {
 
     instanced_matrices_vbo->bind();
     instanced_matrices_vbo->buffer_data(
-        model_matrices.size() * sizeof(glm::mat4), model_matrices.data(),
+        _model_matrices.size() * sizeof(glm::mat4), _model_matrices.data(),
         GL_DYNAMIC_DRAW
     );
     vao->link_attrib(
@@ -107,63 +278,426 @@ void CelestialBodySystem::setup_instanced_vbo() {
     update_vbos();
 }
 
-std::shared_ptr<CelestialBody>
+BodyStore::Handle
 CelestialBodySystem::add_body(double mass, glm::vec3 pos, glm::vec3 vel) {
-    std::shared_ptr<CelestialBody> body{new CelestialBody{mass, vel, pos}};
-    _celestial_bodies.push_back(body);
-    return body;
+    integrator.invalidate();
+    return _bodies.add(mass, pos, vel);
 }
 
-void CelestialBodySystem::build_octree() {
-    octree = OcTree{};
-    for (auto &c : celestial_bodies()) {
-        octree.insert(c);
+void CelestialBodySystem::build_octree(
+    const std::vector<std::uint8_t> *active
+) {
+    switch (tree_builder) {
+    case TreeBuilder::Insertion:
+        update_root_cube();
+        octree = OcTree{_bodies, _root_start, _root_width};
+        for (std::uint32_t k = 0; k < source_count(); ++k) {
+            octree.insert(source_body(k));
+        }
+        break;
+
+    case TreeBuilder::Morton:
+        build_linear_octree();
+        linear_octree.net_accelerations(source_accelerations(), active);
+        break;
+
+    case TreeBuilder::KdTree:
+        kd_tree.clear(_bodies);
+        for (std::uint32_t k = 0; k < source_count(); ++k) {
+            kd_tree.insert(source_body(k));
+        }
+        kd_tree.build();
+        break;
     }
 }
 
+void CelestialBodySystem::build_linear_octree() {
+    update_root_cube();
+    linear_octree.initial_cube_start = _root_start;
+    linear_octree.initial_width = _root_width;
+    const std::vector<glm::vec3> &positions = source_positions();
+    const std::vector<float> &masses = source_masses();
+    // Block steps build once per substep, mostly with few bodies moved far.
+    // Interaction lists only outlive refits.
+    const bool refit = octree_refit || linear_octree.reuse_lists
+                       || integrator.scheme == Integrator::Scheme::Block;
+    if (!refit || !linear_octree.refit(positions, masses))
+        linear_octree.build_morton(positions, masses);
+}
+
+void CelestialBodySystem::resolve_collisions() {
+    const std::size_t merged = collision_detector.resolve(_bodies);
+    // Bounces move bodies too
+    if (!collision_detector.pairs().empty())
+        integrator.invalidate();
+    if (merged == 0)
+        return;
+
+    integrator.erase_removed(_bodies);
+    _bodies.compact();
+    // Body indices shift when bodies are erased, the tree can't be refitted
+    linear_octree.clear();
+}
+
+void CelestialBodySystem::update_root_cube() {
+    if (fixed_domain) {
+        _root_start = domain_start;
+        _root_width = domain_width;
+        return;
+    }
+
+    float min_x = FLT_MAX, min_y = FLT_MAX, min_z = FLT_MAX;
+    float max_x = -FLT_MAX, max_y = -FLT_MAX, max_z = -FLT_MAX;
+#pragma omp parallel for schedule(static) reduction(min : min_x, min_y, min_z) \
+    reduction(max : max_x, max_y, max_z)
+    for (std::size_t i = 0; i < _bodies.size(); ++i) {
+        if (_bodies.is_removed(i))
+            continue;
+
+        const glm::vec3 &p = _bodies.positions()[i];
+        min_x = std::min(min_x, p.x);
+        min_y = std::min(min_y, p.y);
+        min_z = std::min(min_z, p.z);
+        max_x = std::max(max_x, p.x);
+        max_y = std::max(max_y, p.y);
+        max_z = std::max(max_z, p.z);
+    }
+    if (min_x > max_x)
+        return;
+
+    const glm::vec3 low{min_x, min_y, min_z};
+    const glm::vec3 high{max_x, max_y, max_z};
+    const float extent
+        = std::max({high.x - low.x, high.y - low.y, high.z - low.z});
+    const glm::vec3 root_end = _root_start + _root_width;
+    bool is_inside = _root_width > 0.0f && low.x >= _root_start.x
+                     && low.y >= _root_start.y && low.z >= _root_start.z
+                     && high.x <= root_end.x && high.y <= root_end.y
+                     && high.z <= root_end.z;
+    if (is_inside && extent >= domain_hysteresis * _root_width)
+        return;
+
+    const float padding = std::max(domain_padding, MIN_DOMAIN_PADDING);
+    _root_width
+        = std::max(extent * (1.0f + 2.0f * padding), MIN_DOMAIN_WIDTH);
+    _root_start = (low + high) * 0.5f - _root_width * 0.5f;
+}
+
+bool CelestialBodySystem::is_outside_domain(const glm::vec3 &pos) const {
+    if (!fixed_domain)
+        return false;
+
+    const glm::vec3 domain_end = domain_start + domain_width;
+    return pos.x < domain_start.x || pos.y < domain_start.y
+           || pos.z < domain_start.z || pos.x > domain_end.x
+           || pos.y > domain_end.y || pos.z > domain_end.z;
+}
+
 void CelestialBodySystem::simulate(double dt) {
+    if (detect_collisions)
+        resolve_collisions();
+    erase_outside_domain();
+    // Sorted on the first step too, the load order has no locality. Hermite
+    // is meant for few bodies and keeps per body state of its own.
+    if (reorder_interval > 0 && algorithm != SimulationAlgorithm::Hermite
+        && _steps_since_reorder++ % reorder_interval == 0)
+        reorder_bodies();
+
+    // Hermite needs the jerks too and chooses its own substeps
+    if (algorithm == SimulationAlgorithm::Hermite) {
+        hermite.step(_bodies, dt);
+        return;
+    }
+    integrator.step(
+        _bodies, _accelerations, dt,
+        [this](const std::vector<std::uint8_t> *active) {
+            evaluate_accelerations(active);
+        }
+    );
+}
+
+void CelestialBodySystem::evaluate_accelerations(
+    const std::vector<std::uint8_t> *active
+) {
+    split_sources(active);
+    if (!_split) {
+        evaluate_sources(active);
+        return;
+    }
+
+    evaluate_sources(active != nullptr ? &_source_active : nullptr);
+    _accelerations.resize(_bodies.size());
+#pragma omp parallel for schedule(static)
+    for (std::size_t k = 0; k < _sources.size(); ++k) {
+        if (active == nullptr || _source_active[k])
+            _accelerations[_sources[k]] = _source_accelerations[k];
+    }
+    target_accelerations(active);
+    if (!_heavy.empty())
+        add_heavy_accelerations(active);
+}
+
+void CelestialBodySystem::split_sources(
+    const std::vector<std::uint8_t> *active
+) {
+    const std::vector<float> &masses = _bodies.masses();
+    select_heavy_bodies();
+    _sources.clear();
+    _test_particles.clear();
+    std::size_t h = 0;
+    for (std::uint32_t i = 0; i < _bodies.size(); ++i) {
+        if (h < _heavy.size() && _heavy[h] == i)
+            ++h;
+        else if (masses[i] <= test_particle_mass)
+            _test_particles.push_back(i);
+        else
+            _sources.push_back(i);
+    }
+    _split = !_test_particles.empty() || !_heavy.empty();
+    if (!_split)
+        return;
+
+    const std::size_t n = _sources.size();
+    _source_positions.resize(n);
+    _source_masses.resize(n);
+    if (active != nullptr)
+        _source_active.resize(n);
+#pragma omp parallel for schedule(static)
+    for (std::size_t k = 0; k < n; ++k) {
+        const std::uint32_t i = _sources[k];
+        _source_positions[k] = _bodies.positions()[i];
+        _source_masses[k] = masses[i];
+        if (active != nullptr)
+            _source_active[k] = (*active)[i];
+    }
+
+    _heavy_positions.resize(_heavy.size());
+    _heavy_masses.resize(_heavy.size());
+    for (std::size_t k = 0; k < _heavy.size(); ++k) {
+        _heavy_positions[k] = _bodies.positions()[_heavy[k]];
+        _heavy_masses[k] = masses[_heavy[k]];
+    }
+}
+
+void CelestialBodySystem::select_heavy_bodies() {
+    _heavy.clear();
+    const bool is_tree = algorithm == SimulationAlgorithm::BarnesHut
+                         || algorithm == SimulationAlgorithm::BarnesHutOpenMP
+                         || algorithm == SimulationAlgorithm::FMM
+                         || algorithm == SimulationAlgorithm::TreePM;
+    if (!is_tree || (heavy_bodies == 0 && heavy_mass_fraction <= 0.0f))
+        return;
+
+    const std::vector<float> &masses = _bodies.masses();
+    _mass_order.clear();
+    double total_mass = 0.0;
+    for (std::uint32_t i = 0; i < _bodies.size(); ++i) {
+        if (masses[i] > test_particle_mass) {
+            _mass_order.push_back(i);
+            total_mass += masses[i];
+        }
+    }
+
+    // Heaviest first, ties go to the lowest index so the pick is stable
+    const std::size_t picked
+        = std::min<std::size_t>(heavy_bodies, _mass_order.size());
+    if (picked > 0)
+        std::nth_element(
+            _mass_order.begin(), _mass_order.begin() + (picked - 1),
+            _mass_order.end(),
+            [&masses](std::uint32_t a, std::uint32_t b) {
+                return masses[a] > masses[b]
+                       || (masses[a] == masses[b] && a < b);
+            }
+        );
+    const double fraction_mass = heavy_mass_fraction > 0.0f
+                                     ? heavy_mass_fraction * total_mass
+                                     : INFINITY;
+    for (std::size_t k = 0; k < _mass_order.size(); ++k) {
+        const std::uint32_t i = _mass_order[k];
+        if (k < picked || masses[i] >= fraction_mass)
+            _heavy.push_back(i);
+    }
+    std::sort(_heavy.begin(), _heavy.end());
+}
+
+std::uint32_t CelestialBodySystem::source_count() const {
+    return !_split ? _bodies.size() : _sources.size();
+}
+
+std::uint32_t CelestialBodySystem::source_body(std::uint32_t source) const {
+    return !_split ? source : _sources[source];
+}
+
+const std::vector<glm::vec3> &CelestialBodySystem::source_positions() const {
+    return !_split ? _bodies.positions() : _source_positions;
+}
+
+const std::vector<float> &CelestialBodySystem::source_masses() const {
+    return !_split ? _bodies.masses() : _source_masses;
+}
+
+std::vector<glm::vec3> &CelestialBodySystem::source_accelerations() {
+    return !_split ? _accelerations : _source_accelerations;
+}
+
+void CelestialBodySystem::evaluate_sources(
+    const std::vector<std::uint8_t> *active
+) {
+    // Only TreePM leaves the long range part of gravity to the mesh
+    linear_octree.split_radius = 0.0f;
     switch (algorithm) {
     case SimulationAlgorithm::Naive:
-        naive_algorithm(dt);
+        naive_algorithm(active);
+        break;
+
+    case SimulationAlgorithm::NaiveOpenMP:
+        naive_algorithm_openmp(active);
         break;
 
     case SimulationAlgorithm::BarnesHut:
-        barnes_hut_algorithm(dt);
+        barnes_hut_algorithm(active);
         break;
 
     case SimulationAlgorithm::BarnesHutOpenMP:
-        barnes_hut_algorithm_openmp(dt);
+        barnes_hut_algorithm_openmp(active);
+        break;
+
+    case SimulationAlgorithm::FMM:
+        fmm_algorithm();
+        break;
+
+    case SimulationAlgorithm::TreePM:
+        tree_pm_algorithm(active);
+        break;
+
+    case SimulationAlgorithm::Hermite:
+        // Only reached outside of simulate(), same forces as Hermite
+        naive_algorithm_openmp(active);
         break;
     }
 }
 
-std::vector<std::shared_ptr<CelestialBody>>
-CelestialBodySystem::celestial_bodies() const {
-    return _celestial_bodies;
+void CelestialBodySystem::target_accelerations(
+    const std::vector<std::uint8_t> *active
+) {
+    _targets.clear();
+    for (auto i : _test_particles) {
+        if (active == nullptr || (*active)[i])
+            _targets.push_back(i);
+    }
+    for (auto i : _heavy) {
+        if (active == nullptr || (*active)[i])
+            _targets.push_back(i);
+    }
+    const std::size_t n = _targets.size();
+    _target_positions.resize(n);
+    _target_accelerations.resize(n);
+#pragma omp parallel for schedule(static)
+    for (std::size_t t = 0; t < n; ++t)
+        _target_positions[t] = _bodies.positions()[_targets[t]];
+
+    switch (algorithm) {
+    case SimulationAlgorithm::Naive:
+    case SimulationAlgorithm::NaiveOpenMP:
+    case SimulationAlgorithm::Hermite:
+        direct.field_accelerations(
+            _source_positions, _source_masses, _target_positions,
+            _target_accelerations
+        );
+        break;
+
+    case SimulationAlgorithm::BarnesHut:
+    case SimulationAlgorithm::BarnesHutOpenMP:
+        if (tree_builder == TreeBuilder::Morton) {
+            linear_octree.field_accelerations(
+                _target_positions, _target_accelerations
+            );
+            break;
+        }
+        // Targets were never inserted, the walk never meets them
+        with_precision(precision, [&](auto p) {
+            with_flag(is_tree_softened(), [&](auto softened) {
+                constexpr Precision walk = decltype(p)::value;
+                constexpr bool soft = decltype(softened)::value;
+                const bool kd = tree_builder == TreeBuilder::KdTree;
+#pragma omp parallel for schedule(dynamic, 64)
+                for (std::size_t t = 0; t < n; ++t) {
+                    const std::uint32_t b = _targets[t];
+                    _target_accelerations[t]
+                        = kd ? kd_tree.net_acceleration_on_body<walk, soft>(b)
+                             : octree.net_acceleration_on_body<walk, soft>(b);
+                }
+            });
+        });
+        break;
+
+    case SimulationAlgorithm::FMM:
+        // The expansions are only kept for the sources, the targets walk the
+        // same tree as TreeBuilder::Morton
+        linear_octree.field_accelerations(
+            _target_positions, _target_accelerations
+        );
+        break;
+
+    case SimulationAlgorithm::TreePM:
+        linear_octree.field_accelerations(
+            _target_positions, _target_accelerations
+        );
+        mesh.add_accelerations(_target_positions, _target_accelerations);
+        break;
+    }
+
+#pragma omp parallel for schedule(static)
+    for (std::size_t t = 0; t < n; ++t)
+        _accelerations[_targets[t]] = _target_accelerations[t];
 }
 
-void CelestialBodySystem::update_vbos() {
-    std::vector<glm::mat4> model_matrices;
-    std::vector<glm::vec4> colors;
-    for (auto &c : _celestial_bodies) {
-        c->update_values();
-        model_matrices.push_back(c->mat);
-        colors.push_back({c->color(), 1.0f});
+void CelestialBodySystem::add_heavy_accelerations(
+    const std::vector<std::uint8_t> *active
+) {
+    // A handful of sources, every body is summed, flagged or not
+    direct.field_accelerations(
+        _heavy_positions, _heavy_masses, _bodies.positions(),
+        _heavy_accelerations
+    );
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < _bodies.size(); ++i) {
+        if (active == nullptr || (*active)[i])
+            _accelerations[i] += _heavy_accelerations[i];
     }
+}
+
+const BodyStore &CelestialBodySystem::celestial_bodies() const {
+    return _bodies;
+}
+
+void CelestialBodySystem::update_vbos() {
+    pack_instances();
     instanced_colors_vbo->bind();
     glBufferSubData(
-        GL_ARRAY_BUFFER, 0, colors.size() * sizeof(glm::vec4), colors.data()
+        GL_ARRAY_BUFFER, 0, _colors.size() * sizeof(glm::vec4), _colors.data()
     );
     instanced_colors_vbo->unbind();
 
     instanced_matrices_vbo->bind();
     glBufferSubData(
-        GL_ARRAY_BUFFER, 0, model_matrices.size() * sizeof(glm::mat4),
-        model_matrices.data()
+        GL_ARRAY_BUFFER, 0, _model_matrices.size() * sizeof(glm::mat4),
+        _model_matrices.data()
     );
     instanced_matrices_vbo->unbind();
 }
 
+void CelestialBodySystem::pack_instances() {
+    _model_matrices.resize(_bodies.size());
+    _colors.resize(_bodies.size());
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < _bodies.size(); ++i) {
+        _model_matrices[i] = _bodies.model_matrix(i);
+        _colors[i] = glm::vec4{_bodies.colors()[i], 1.0f};
+    }
+}
+
 void CelestialBodySystem::bind_shader(
     std::shared_ptr<axolote::gl::Shader> shader_program
 ) {
@@ -189,7 +723,7 @@ void CelestialBodySystem::draw() {
     sphere.vao->bind();
     glDrawElementsInstanced(
         GL_TRIANGLES, sphere.indices().size(), GL_UNSIGNED_INT, 0,
-        _celestial_bodies.size()
+        _bodies.size()
     );
     sphere.vao->unbind();
 }
@@ -198,64 +732,164 @@ void CelestialBodySystem::draw(const glm::mat4 &mat) {
     UNUSED(mat);
 }
 
-void CelestialBodySystem::naive_algorithm(double dt) {
-    for (auto body0 : _celestial_bodies) {
-        for (auto body1 : _celestial_bodies) {
-            if (body0 == body1)
-                continue;
+void CelestialBodySystem::naive_algorithm(
+    const std::vector<std::uint8_t> *active
+) {
+    if (active != nullptr)
+        direct.active_accelerations(
+            source_positions(), source_masses(), active,
+            source_accelerations()
+        );
+    else
+        direct.accelerations(
+            source_positions(), source_masses(), source_accelerations()
+        );
+}
 
-            glm::vec3 acc = body0->calculate_acceleration_vec(*body1);
-            body0->velocity += acc * (float)dt;
-            body0->pos += body0->velocity * (float)dt;
-        }
-    }
+void CelestialBodySystem::naive_algorithm_openmp(
+    const std::vector<std::uint8_t> *active
+) {
+    // Pairs are only worth sharing when every body needs its force, and
+    // the shared sums are float only
+    if (active != nullptr || direct.precision != Precision::Float)
+        direct.active_accelerations(
+            source_positions(), source_masses(), active,
+            source_accelerations()
+        );
+    else
+        direct.symmetric_accelerations(
+            source_positions(), source_masses(), source_accelerations()
+        );
 }
 
-void CelestialBodySystem::barnes_hut_algorithm(double dt) {
-    build_octree();
+void CelestialBodySystem::barnes_hut_algorithm(
+    const std::vector<std::uint8_t> *active
+) {
+    build_octree(active);
+    if (tree_builder == TreeBuilder::Morton)
+        return;
 
-    std::vector<std::shared_ptr<CelestialBody>> active_bodies;
-    for (auto &c : _celestial_bodies) {
-        bool should_erase = std::abs(c->pos.x) > octree.initial_width / 2
-                            || std::abs(c->pos.y) > octree.initial_width / 2
-                            || std::abs(c->pos.z) > octree.initial_width / 2
-                            || c->merged;
+    with_precision(precision, [&](auto p) {
+        with_flag(is_tree_softened(), [&](auto softened) {
+            octree_accelerations<
+                decltype(p)::value, decltype(softened)::value>(active, false);
+        });
+    });
+}
 
-        if (!should_erase) {
-            active_bodies.push_back(c);
-            glm::vec3 acc = octree.net_acceleration_on_body(c, dt);
-            c->velocity += acc * (float)dt;
-            c->pos += c->velocity * (float)dt;
-        }
+void CelestialBodySystem::barnes_hut_algorithm_openmp(
+    const std::vector<std::uint8_t> *active
+) {
+    build_octree(active);
+    if (tree_builder == TreeBuilder::Morton)
+        return;
+
+    with_precision(precision, [&](auto p) {
+        with_flag(is_tree_softened(), [&](auto softened) {
+            octree_accelerations<
+                decltype(p)::value, decltype(softened)::value>(active, true);
+        });
+    });
+}
+
+bool CelestialBodySystem::is_tree_softened() const {
+    if (tree_builder == TreeBuilder::KdTree)
+        return kd_tree.softening > 0.0f;
+    return OcTree::softening > 0.0f;
+}
+
+template <Precision precision, bool softened>
+void CelestialBodySystem::octree_accelerations(
+    const std::vector<std::uint8_t> *active, bool parallel
+) {
+    std::vector<glm::vec3> &accelerations = source_accelerations();
+    const std::uint32_t n = source_count();
+    const bool kd = tree_builder == TreeBuilder::KdTree;
+    accelerations.resize(n);
+    // Runs of consecutive bodies, once reordered they walk the same nodes
+#pragma omp parallel for schedule(dynamic, 64) if (parallel)
+    for (std::uint32_t k = 0; k < n; ++k) {
+        if (active != nullptr && !(*active)[k])
+            continue;
+
+        const std::uint32_t body = source_body(k);
+        accelerations[k]
+            = kd ? kd_tree.net_acceleration_on_body<precision, softened>(body)
+                 : octree.net_acceleration_on_body<precision, softened>(body);
     }
+}
 
-    _celestial_bodies = std::move(active_bodies);
+void CelestialBodySystem::fmm_algorithm() {
+    build_linear_octree();
+    fmm.accelerations(
+        linear_octree, source_positions(), source_masses(),
+        source_accelerations()
+    );
 }
 
-void CelestialBodySystem::barnes_hut_algorithm_openmp(double dt) {
-    build_octree();
+void CelestialBodySystem::tree_pm_algorithm(
+    const std::vector<std::uint8_t> *active
+) {
+    build_linear_octree();
+    mesh.solve(source_positions(), source_masses(), _root_start, _root_width);
+    linear_octree.split_radius = mesh.split_radius();
+    linear_octree.net_accelerations(source_accelerations(), active);
+    mesh.add_accelerations(source_positions(), source_accelerations(), active);
+}
 
-    std::vector<std::shared_ptr<CelestialBody>> active_bodies;
-    active_bodies.reserve(_celestial_bodies.size());
-    for (auto &c : _celestial_bodies) {
-        bool should_erase = std::abs(c->pos.x) > octree.initial_width / 2
-                            || std::abs(c->pos.y) > octree.initial_width / 2
-                            || std::abs(c->pos.z) > octree.initial_width / 2
-                            || c->merged;
+void CelestialBodySystem::erase_outside_domain() {
+    if (!fixed_domain)
+        return;
 
-        if (!should_erase)
-            active_bodies.push_back(c);
+    const std::vector<glm::vec3> &positions = _bodies.positions();
+    std::size_t erased = 0;
+#pragma omp parallel for schedule(static) reduction(+ : erased)
+    for (std::size_t i = 0; i < _bodies.size(); ++i) {
+        if (is_outside_domain(positions[i])) {
+            _bodies.remove(i);
+            ++erased;
+        }
     }
+    if (erased == 0)
+        return;
+
+    integrator.erase_removed(_bodies);
+    _bodies.compact();
+    integrator.invalidate();
+    // Body indices shift when bodies are erased, the tree can't be refitted
+    linear_octree.clear();
+}
 
-#pragma omp parallel for schedule(dynamic)
-    for (std::size_t i = 0; i < active_bodies.size(); ++i) {
-        auto &c = active_bodies[i];
-        glm::vec3 acc = octree.net_acceleration_on_body(c, dt);
-        c->velocity += acc * static_cast<float>(dt);
-        c->pos += c->velocity * static_cast<float>(dt);
+void CelestialBodySystem::reorder_bodies() {
+    const std::uint32_t n = _bodies.size();
+    if (n < 2)
+        return;
+
+    // Bodies outside of a fixed domain get the invalid key and go last
+    update_root_cube();
+    const std::vector<glm::vec3> &positions = _bodies.positions();
+    _reorder_keys.resize(n);
+    _reorder_order.resize(n);
+#pragma omp parallel for schedule(static)
+    for (std::uint32_t i = 0; i < n; ++i) {
+        _reorder_keys[i] = morton_key(positions[i], _root_start, _root_width);
+        _reorder_order[i] = i;
     }
+    radix_sort(
+        _reorder_keys, _reorder_order, _reorder_key_scratch, _reorder_scratch
+    );
 
-    _celestial_bodies = std::move(active_bodies);
+    _bodies.reorder(_reorder_order);
+    integrator.reorder(_reorder_order);
+    if (_accelerations.size() == n) {
+        _reordered_accelerations.resize(n);
+#pragma omp parallel for schedule(static)
+        for (std::uint32_t i = 0; i < n; ++i)
+            _reordered_accelerations[i] = _accelerations[_reorder_order[i]];
+        _accelerations.swap(_reordered_accelerations);
+    }
+    // Body indices changed, the tree can't be refitted
+    linear_octree.clear();
 }
 
 void CelestialBodySystem::update_gravity_grid() {
@@ -267,8 +901,10 @@ void CelestialBodySystem::update_gravity_grid() {
         grav_grid->_displacements.begin(), grav_grid->_displacements.end(), 0.0f
     );
 
-    for (auto &body : _celestial_bodies) {
-        grav_grid->update_for_body(body);
+    for (std::size_t i = 0; i < _bodies.size(); ++i) {
+        grav_grid->update_for_body(
+            _bodies.positions()[i], _bodies.masses()[i]
+        );
     }
 }
 
@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include <omp.h>
+
+#include "collision_detector.hpp"
+#include "morton.hpp"
+
+/** Largest cell coordinate on each axis, cells are keyed by Morton keys **/
+#define MAX_CELL ((1u << MORTON_BITS_PER_AXIS) - 1)
+
+/** Empty slot of the cell table **/
+#define NO_CELL 0xFFFFFFFFu
+
+/** Neighbour cells after the own cell, each pair of cells is visited once **/
+static const glm::ivec3 forward_neighbours[13] = {
+    {1, 0, 0},   {-1, 1, 0}, {0, 1, 0},  {1, 1, 0}, {-1, -1, 1},
+    {0, -1, 1},  {1, -1, 1}, {-1, 0, 1}, {0, 0, 1}, {1, 0, 1},
+    {-1, 1, 1},  {0, 1, 1},  {1, 1, 1},
+};
+
+/** Own cell and every cell around it, searched for each test particle **/
+static const glm::ivec3 all_neighbours[27] = {
+    {-1, -1, -1}, {0, -1, -1}, {1, -1, -1}, {-1, 0, -1}, {0, 0, -1},
+    {1, 0, -1},   {-1, 1, -1}, {0, 1, -1},  {1, 1, -1},  {-1, -1, 0},
+    {0, -1, 0},   {1, -1, 0},  {-1, 0, 0},  {0, 0, 0},   {1, 0, 0},
+    {-1, 1, 0},   {0, 1, 0},   {1, 1, 0},   {-1, -1, 1}, {0, -1, 1},
+    {1, -1, 1},   {-1, 0, 1},  {0, 0, 1},   {1, 0, 1},   {-1, 1, 1},
+    {0, 1, 1},    {1, 1, 1},
+};
+
+/**
+ * \brief Morton key of a cell
+ * \param cell - integer coordinates of the cell
+ * \returns key
+ **/
+static std::uint64_t cell_key(const glm::uvec3 &cell) {
+    return morton_expand_bits(cell.x) << 2 | morton_expand_bits(cell.y) << 1
+           | morton_expand_bits(cell.z);
+}
+
+/**
+ * \brief Spreads a cell key over the slots of the cell table
+ * \param key - key of the cell
+ * \returns hash, Fibonacci hashing
+ **/
+static std::size_t hash_key(std::uint64_t key) {
+    return (key * 0x9E3779B97F4A7C15) >> 32;
+}
+
+std::size_t CollisionDetector::resolve(BodyStore &bodies) {
+    find_pairs(bodies);
+    if (_pairs.empty())
+        return 0;
+
+    _merges.resize(_pairs.size());
+#pragma omp parallel for schedule(static)
+    for (std::size_t p = 0; p < _pairs.size(); ++p) {
+        const auto [a, b] = _pairs[p];
+        _merges[p] = bodies.should_merge(a, b);
+    }
+
+    const std::uint32_t n = bodies.size();
+    _parents.resize(n);
+    std::iota(_parents.begin(), _parents.end(), 0);
+    _merging.assign(n, 0);
+    for (std::size_t p = 0; p < _pairs.size(); ++p) {
+        if (!_merges[p])
+            continue;
+
+        const auto [a, b] = _pairs[p];
+        join(a, b);
+        _merging[a] = 1;
+        _merging[b] = 1;
+    }
+
+    // Groups merge into their lowest index, in index order
+    std::size_t merged = 0;
+    for (std::uint32_t i = 0; i < n; ++i) {
+        if (!_merging[i])
+            continue;
+
+        const std::uint32_t root = find_root(i);
+        if (root != i) {
+            bodies.merge(root, i);
+            ++merged;
+        }
+    }
+
+    // Bodies that merged are new bodies, the other pairs bounce
+    for (std::size_t p = 0; p < _pairs.size(); ++p) {
+        const auto [a, b] = _pairs[p];
+        if (_merges[p] || _merging[a] || _merging[b])
+            continue;
+
+        bodies.collide(a, b);
+        if (bodies.is_removed(b)) {
+            _merging[b] = 1;
+            ++merged;
+        }
+    }
+    return merged;
+}
+
+const std::vector<std::pair<std::uint32_t, std::uint32_t>> &
+CollisionDetector::pairs() const {
+    return _pairs;
+}
+
+void CollisionDetector::find_pairs(const BodyStore &bodies) {
+    _pairs.clear();
+    const std::uint32_t n = bodies.size();
+    const std::vector<glm::vec3> &positions = bodies.positions();
+    const std::vector<float> &radii = bodies.radii();
+    const std::vector<float> &masses = bodies.masses();
+    float min_x = FLT_MAX, min_y = FLT_MAX, min_z = FLT_MAX;
+    float max_x = -FLT_MAX, max_y = -FLT_MAX, max_z = -FLT_MAX;
+    float max_radius = 0.0f;
+#pragma omp parallel for schedule(static) reduction(min : min_x, min_y, min_z) \
+    reduction(max : max_x, max_y, max_z, max_radius)
+    for (std::uint32_t i = 0; i < n; ++i) {
+        if (bodies.is_removed(i))
+            continue;
+
+        const glm::vec3 &p = positions[i];
+        min_x = std::min(min_x, p.x);
+        min_y = std::min(min_y, p.y);
+        min_z = std::min(min_z, p.z);
+        max_x = std::max(max_x, p.x);
+        max_y = std::max(max_y, p.y);
+        max_z = std::max(max_z, p.z);
+        max_radius = std::max(max_radius, radii[i]);
+    }
+    if (min_x > max_x)
+        return;
+
+    // Colliding bodies are closer than two of the largest radii, so they
+    // share a cell or sit in neighbouring ones
+    const glm::vec3 low{min_x, min_y, min_z};
+    const float extent
+        = std::max({max_x - min_x, max_y - min_y, max_z - min_z});
+    const float cell_width
+        = std::max(2.0f * max_radius, extent / static_cast<float>(MAX_CELL));
+
+    _keys.resize(n);
+    _sorted_bodies.resize(n);
+    _cells.resize(n);
+#pragma omp parallel for schedule(static)
+    for (std::uint32_t i = 0; i < n; ++i) {
+        _sorted_bodies[i] = i;
+        if (bodies.is_removed(i)) {
+            _keys[i] = MORTON_INVALID_KEY;
+            continue;
+        }
+
+        const glm::vec3 cell = (positions[i] - low) / cell_width;
+        _cells[i] = glm::min(glm::uvec3{cell}, glm::uvec3{MAX_CELL});
+        // Test particles keep their cell but stay out of the grid
+        _keys[i] = masses[i] <= test_particle_mass ? MORTON_INVALID_KEY
+                                                    : cell_key(_cells[i]);
+    }
+    radix_sort(_keys, _sorted_bodies, _key_scratch, _value_scratch);
+
+    const std::uint32_t count
+        = std::lower_bound(_keys.begin(), _keys.end(), MORTON_INVALID_KEY)
+          - _keys.begin();
+    _test_particles.clear();
+    for (std::uint32_t s = count; s < n; ++s) {
+        if (!bodies.is_removed(_sorted_bodies[s]))
+            _test_particles.push_back(_sorted_bodies[s]);
+    }
+    _x.resize(count);
+    _y.resize(count);
+    _z.resize(count);
+    _radii.resize(count);
+#pragma omp parallel for schedule(static)
+    for (std::uint32_t s = 0; s < count; ++s) {
+        const std::uint32_t i = _sorted_bodies[s];
+        _x[s] = positions[i].x;
+        _y[s] = positions[i].y;
+        _z[s] = positions[i].z;
+        _radii[s] = radii[i];
+    }
+    _cell_keys.clear();
+    _cell_starts.clear();
+    for (std::uint32_t s = 0; s < count; ++s) {
+        if (s == 0 || _keys[s] != _keys[s - 1]) {
+            _cell_keys.push_back(_keys[s]);
+            _cell_starts.push_back(s);
+        }
+    }
+    _cell_starts.push_back(count);
+
+    std::size_t table_size = 16;
+    while (table_size < 2 * _cell_keys.size())
+        table_size *= 2;
+    _cell_table.assign(table_size, NO_CELL);
+    for (std::uint32_t c = 0; c < _cell_keys.size(); ++c) {
+        std::size_t slot = hash_key(_cell_keys[c]) & (table_size - 1);
+        while (_cell_table[slot] != NO_CELL)
+            slot = (slot + 1) & (table_size - 1);
+        _cell_table[slot] = c;
+    }
+
+    _thread_pairs.resize(omp_get_max_threads());
+#pragma omp parallel
+    {
+        auto &local = _thread_pairs[omp_get_thread_num()];
+        local.clear();
+
+#pragma omp for schedule(dynamic, 64)
+        for (std::size_t c = 0; c < _cell_keys.size(); ++c) {
+            const std::uint32_t begin = _cell_starts[c];
+            const std::uint32_t end = _cell_starts[c + 1];
+            for (std::uint32_t s = begin; s < end; ++s) {
+                for (std::uint32_t t = s + 1; t < end; ++t)
+                    add_if_colliding(s, t, local);
+            }
+
+            const glm::ivec3 cell{_cells[_sorted_bodies[begin]]};
+            for (const glm::ivec3 &offset : forward_neighbours) {
+                const glm::ivec3 neighbour = cell + offset;
+                if (neighbour.x < 0 || neighbour.y < 0 || neighbour.z < 0
+                    || neighbour.x > static_cast<int>(MAX_CELL)
+                    || neighbour.y > static_cast<int>(MAX_CELL)
+                    || neighbour.z > static_cast<int>(MAX_CELL))
+                    continue;
+
+                const std::size_t other
+                    = find_cell(cell_key(glm::uvec3{neighbour}));
+                if (other == _cell_keys.size())
+                    continue;
+
+                for (std::uint32_t s = begin; s < end; ++s) {
+                    for (std::uint32_t t = _cell_starts[other];
+                         t < _cell_starts[other + 1]; ++t)
+                        add_if_colliding(s, t, local);
+                }
+            }
+        }
+
+#pragma omp for schedule(dynamic, 64)
+        for (std::size_t p = 0; p < _test_particles.size(); ++p) {
+            const std::uint32_t i = _test_particles[p];
+            const glm::ivec3 cell{_cells[i]};
+            for (const glm::ivec3 &offset : all_neighbours) {
+                const glm::ivec3 neighbour = cell + offset;
+                if (neighbour.x < 0 || neighbour.y < 0 || neighbour.z < 0
+                    || neighbour.x > static_cast<int>(MAX_CELL)
+                    || neighbour.y > static_cast<int>(MAX_CELL)
+                    || neighbour.z > static_cast<int>(MAX_CELL))
+                    continue;
+
+                const std::size_t other
+                    = find_cell(cell_key(glm::uvec3{neighbour}));
+                if (other == _cell_keys.size())
+                    continue;
+
+                for (std::uint32_t t = _cell_starts[other];
+                     t < _cell_starts[other + 1]; ++t)
+                    add_if_touching(bodies, i, t, local);
+            }
+        }
+    }
+
+    for (auto &local : _thread_pairs)
+        _pairs.insert(_pairs.end(), local.begin(), local.end());
+    std::sort(_pairs.begin(), _pairs.end());
+}
+
+void CollisionDetector::add_if_colliding(
+    std::uint32_t s, std::uint32_t t,
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> &pairs
+) const {
+    const float dx = _x[t] - _x[s];
+    const float dy = _y[t] - _y[s];
+    const float dz = _z[t] - _z[s];
+    const float radii = _radii[s] + _radii[t];
+    if (dx * dx + dy * dy + dz * dz < radii * radii) {
+        const std::uint32_t i = _sorted_bodies[s];
+        const std::uint32_t j = _sorted_bodies[t];
+        pairs.emplace_back(std::min(i, j), std::max(i, j));
+    }
+}
+
+void CollisionDetector::add_if_touching(
+    const BodyStore &bodies, std::uint32_t i, std::uint32_t t,
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> &pairs
+) const {
+    const glm::vec3 &p = bodies.positions()[i];
+    const float dx = _x[t] - p.x;
+    const float dy = _y[t] - p.y;
+    const float dz = _z[t] - p.z;
+    const float radii = bodies.radii()[i] + _radii[t];
+    if (dx * dx + dy * dy + dz * dz < radii * radii) {
+        const std::uint32_t j = _sorted_bodies[t];
+        pairs.emplace_back(std::min(i, j), std::max(i, j));
+    }
+}
+
+std::size_t CollisionDetector::find_cell(std::uint64_t key) const {
+    const std::size_t mask = _cell_table.size() - 1;
+    for (std::size_t slot = hash_key(key) & mask;; slot = (slot + 1) & mask) {
+        const std::uint32_t c = _cell_table[slot];
+        if (c == NO_CELL)
+            return _cell_keys.size();
+        if (_cell_keys[c] == key)
+            return c;
+    }
+}
+
+std::uint32_t CollisionDetector::find_root(std::uint32_t body) {
+    while (_parents[body] != body) {
+        _parents[body] = _parents[_parents[body]];
+        body = _parents[body];
+    }
+    return body;
+}
+
+void CollisionDetector::join(std::uint32_t a, std::uint32_t b) {
+    a = find_root(a);
+    b = find_root(b);
+    if (a < b)
+        _parents[b] = a;
+    else if (b < a)
+        _parents[a] = b;
+}
@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <omp.h>
+
+#include "constants.hpp"
+#include "direct_sum.hpp"
+#include "direct_sum_simd.hpp"
+
+/**
+ * \brief Portable variant of DirectSumKernel
+ **/
+static void direct_sum_portable(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, float px, float py, float pz, float softening2,
+    float *out
+) {
+    const glm::vec3 acceleration = direct_sum_as<float, float>(
+        x, y, z, mass, count, glm::vec3{px, py, pz}, softening2
+    );
+    out[0] = acceleration.x;
+    out[1] = acceleration.y;
+    out[2] = acceleration.z;
+}
+
+/**
+ * \brief Portable variant of TilePairKernel
+ **/
+static void add_tile_pair_portable(
+    const float *x, const float *y, const float *z, const float *masses,
+    std::size_t n, std::size_t first, std::size_t first_end,
+    std::size_t second, std::size_t second_end, float softening2, float *acc
+) {
+    add_tile_pair_loop(
+        x, y, z, masses, n, first, first_end, second, second_end, softening2,
+        acc
+    );
+}
+
+/**
+ * \brief Portable variant of ShortRangeKernel
+ **/
+static void short_range_sum_portable(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, float px, float py, float pz, float softening2,
+    const ShortRangeTable &table, float *out
+) {
+    short_range_sum_loop(
+        x, y, z, mass, count, px, py, pz, softening2, table, out
+    );
+}
+
+/**
+ * \brief Kernels built for one instruction set
+ **/
+struct DirectSumVariant {
+    /** Name reported by direct_sum_isa() **/
+    const char *name;
+    /** Kernel of direct_sum() **/
+    DirectSumKernel direct_sum;
+    /** Kernel of DirectSum::symmetric_accelerations() **/
+    TilePairKernel add_tile_pair;
+    /** Kernel of short_range_sum() **/
+    ShortRangeKernel short_range_sum;
+};
+
+/**
+ * \brief Best variant the CPU runs
+ * \returns variant
+ *
+ * Without DIRECT_SUM_DISPATCH, set by the build on x86 with GCC or Clang,
+ * only the portable variant is built
+ **/
+static DirectSumVariant select_variant() {
+#if defined(DIRECT_SUM_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("fma"))
+        return {
+            "avx512", direct_sum_avx512, add_tile_pair_avx512,
+            short_range_sum_avx512
+        };
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return {
+            "avx2", direct_sum_avx2, add_tile_pair_avx2, short_range_sum_avx2
+        };
+#endif
+    return {
+        "portable", direct_sum_portable, add_tile_pair_portable,
+        short_range_sum_portable
+    };
+}
+
+/** Variant picked at startup **/
+static const DirectSumVariant variant = select_variant();
+
+glm::vec3 direct_sum(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, const glm::vec3 &pos, float softening2
+) {
+    float acceleration[3];
+    variant.direct_sum(
+        x, y, z, mass, count, pos.x, pos.y, pos.z, softening2, acceleration
+    );
+    return glm::vec3{acceleration[0], acceleration[1], acceleration[2]};
+}
+
+glm::vec3 short_range_sum(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, const glm::vec3 &pos, float softening2,
+    float split_radius
+) {
+    const ShortRangeTable table{
+        short_range_table(),
+        static_cast<float>(
+            SHORT_RANGE_TABLE_SIZE
+            / (SHORT_RANGE_TABLE_END * 4.0 * split_radius * split_radius)
+        ),
+        static_cast<float>(SHORT_RANGE_TABLE_SIZE + 1)
+    };
+    float acceleration[3];
+    variant.short_range_sum(
+        x, y, z, mass, count, pos.x, pos.y, pos.z, softening2, table,
+        acceleration
+    );
+    return glm::vec3{acceleration[0], acceleration[1], acceleration[2]};
+}
+
+const char *direct_sum_isa() {
+    return variant.name;
+}
+
+// ---- DIRECT SUM ----
+
+void DirectSum::accelerations(
+    const std::vector<glm::vec3> &positions, const std::vector<float> &masses,
+    std::vector<glm::vec3> &accelerations
+) {
+    gather(positions);
+    with_precision(precision, [&](auto p) {
+        sum_accelerations<decltype(p)::value>(positions, masses, accelerations);
+    });
+}
+
+void DirectSum::symmetric_accelerations(
+    const std::vector<glm::vec3> &positions, const std::vector<float> &masses,
+    std::vector<glm::vec3> &accelerations
+) {
+    gather(positions);
+
+    const std::size_t n = positions.size();
+    const std::size_t tiles = (n + DIRECT_SUM_TILE - 1) / DIRECT_SUM_TILE;
+    const float softening2 = softening * softening;
+    _thread_accelerations.resize(omp_get_max_threads());
+    std::size_t threads = 1;
+#pragma omp parallel
+    {
+        std::vector<float> &acc = _thread_accelerations[omp_get_thread_num()];
+        acc.assign(3 * n, 0.0f);
+#pragma omp single
+        threads = omp_get_num_threads();
+
+        // Rows get shorter, the longest are handed out first
+#pragma omp for schedule(dynamic)
+        for (std::size_t a = 0; a < tiles; ++a) {
+            const std::size_t first = a * DIRECT_SUM_TILE;
+            const std::size_t first_end = std::min(first + DIRECT_SUM_TILE, n);
+            for (std::size_t b = a; b < tiles; ++b) {
+                const std::size_t second = b * DIRECT_SUM_TILE;
+                const std::size_t second_end
+                    = std::min(second + DIRECT_SUM_TILE, n);
+                add_tile_pair(
+                    first, first_end, second, second_end, masses.data(),
+                    softening2, acc.data()
+                );
+            }
+        }
+    }
+
+    accelerations.resize(n);
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < n; ++i) {
+        glm::vec3 sum{0.0f, 0.0f, 0.0f};
+        for (std::size_t t = 0; t < threads; ++t) {
+            const std::vector<float> &acc = _thread_accelerations[t];
+            sum += glm::vec3{acc[i], acc[n + i], acc[2 * n + i]};
+        }
+        accelerations[i] = sum * static_cast<float>(G);
+    }
+}
+
+void DirectSum::active_accelerations(
+    const std::vector<glm::vec3> &positions, const std::vector<float> &masses,
+    const std::vector<std::uint8_t> *active,
+    std::vector<glm::vec3> &accelerations
+) {
+    gather(positions);
+    with_precision(precision, [&](auto p) {
+        sum_active_accelerations<decltype(p)::value>(
+            positions, masses, active, accelerations
+        );
+    });
+}
+
+void DirectSum::field_accelerations(
+    const std::vector<glm::vec3> &positions, const std::vector<float> &masses,
+    const std::vector<glm::vec3> &targets,
+    std::vector<glm::vec3> &accelerations
+) {
+    gather(positions);
+    with_precision(precision, [&](auto p) {
+        sum_field_accelerations<decltype(p)::value>(
+            masses, targets, accelerations
+        );
+    });
+}
+
+void DirectSum::gather(const std::vector<glm::vec3> &positions) {
+    const std::size_t n = positions.size();
+    _x.resize(n);
+    _y.resize(n);
+    _z.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        _x[i] = positions[i].x;
+        _y[i] = positions[i].y;
+        _z[i] = positions[i].z;
+    }
+}
+
+template <Precision precision>
+void DirectSum::sum_accelerations(
+    const std::vector<glm::vec3> &positions, const std::vector<float> &masses,
+    std::vector<glm::vec3> &accelerations
+) const {
+    const std::size_t n = positions.size();
+    accelerations.resize(n);
+    const float softening2 = softening * softening;
+    for (std::size_t i = 0; i < n; ++i) {
+        const glm::vec3 acceleration = direct_sum_in<precision>(
+            _x.data(), _y.data(), _z.data(), masses.data(), n, positions[i],
+            softening2
+        );
+        accelerations[i] = acceleration * static_cast<float>(G);
+    }
+}
+
+template <Precision precision>
+void DirectSum::sum_active_accelerations(
+    const std::vector<glm::vec3> &positions, const std::vector<float> &masses,
+    const std::vector<std::uint8_t> *active,
+    std::vector<glm::vec3> &accelerations
+) const {
+    const std::size_t n = positions.size();
+    accelerations.resize(n);
+    const float softening2 = softening * softening;
+#pragma omp parallel for schedule(dynamic, 64)
+    for (std::size_t i = 0; i < n; ++i) {
+        if (active != nullptr && !(*active)[i])
+            continue;
+
+        const glm::vec3 acceleration = direct_sum_in<precision>(
+            _x.data(), _y.data(), _z.data(), masses.data(), n, positions[i],
+            softening2
+        );
+        accelerations[i] = acceleration * static_cast<float>(G);
+    }
+}
+
+template <Precision precision>
+void DirectSum::sum_field_accelerations(
+    const std::vector<float> &masses, const std::vector<glm::vec3> &targets,
+    std::vector<glm::vec3> &accelerations
+) const {
+    const std::size_t n = _x.size();
+    accelerations.resize(targets.size());
+    const float softening2 = softening * softening;
+#pragma omp parallel for schedule(dynamic, 64)
+    for (std::size_t i = 0; i < targets.size(); ++i) {
+        const glm::vec3 acceleration = direct_sum_in<precision>(
+            _x.data(), _y.data(), _z.data(), masses.data(), n, targets[i],
+            softening2
+        );
+        accelerations[i] = acceleration * static_cast<float>(G);
+    }
+}
+
+void DirectSum::add_tile_pair(
+    std::size_t first, std::size_t first_end, std::size_t second,
+    std::size_t second_end, const float *masses, float softening2, float *acc
+) const {
+    variant.add_tile_pair(
+        _x.data(), _y.data(), _z.data(), masses, _x.size(), first, first_end,
+        second, second_end, softening2, acc
+    );
+}
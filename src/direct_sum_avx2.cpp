@@ -0,0 +1,93 @@
+#include <cstddef>
+
+#include "direct_sum_simd.hpp"
+
+// Built with -mavx2 -mfma, empty when the build system did not add them
+#if defined(__AVX2__) && defined(__FMA__)
+
+#include <immintrin.h>
+
+/**
+ * \brief Adds the eight lanes of a vector
+ * \param v - vector
+ * \returns sum
+ **/
+static inline float horizontal_sum(__m256 v) {
+    __m128 sum
+        = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+void direct_sum_avx2(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, float px, float py, float pz, float softening2,
+    float *out
+) {
+    const __m256 vx = _mm256_set1_ps(px);
+    const __m256 vy = _mm256_set1_ps(py);
+    const __m256 vz = _mm256_set1_ps(pz);
+    const __m256 eps2 = _mm256_set1_ps(softening2);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256i lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 ax = zero;
+    __m256 ay = zero;
+    __m256 az = zero;
+    for (std::size_t j = 0; j < count; j += 8) {
+        // Lanes past the end load zero masses
+        const int left = count - j < 8 ? static_cast<int>(count - j) : 8;
+        const __m256i lanes
+            = _mm256_cmpgt_epi32(_mm256_set1_epi32(left), lane_index);
+        const __m256 dx = _mm256_sub_ps(_mm256_maskload_ps(x + j, lanes), vx);
+        const __m256 dy = _mm256_sub_ps(_mm256_maskload_ps(y + j, lanes), vy);
+        const __m256 dz = _mm256_sub_ps(_mm256_maskload_ps(z + j, lanes), vz);
+        const __m256 r2 = _mm256_fmadd_ps(
+            dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_fmadd_ps(dz, dz, eps2))
+        );
+        const __m256 valid = _mm256_cmp_ps(r2, zero, _CMP_GT_OQ);
+        __m256 inv_r = _mm256_and_ps(valid, _mm256_rsqrt_ps(r2));
+        for (int step = 0; step < DIRECT_SUM_NEWTON_STEPS; ++step) {
+            const __m256 half_r2 = _mm256_mul_ps(_mm256_set1_ps(0.5f), r2);
+            inv_r = _mm256_mul_ps(
+                inv_r, _mm256_fnmadd_ps(
+                           half_r2, _mm256_mul_ps(inv_r, inv_r),
+                           _mm256_set1_ps(1.5f)
+                       )
+            );
+        }
+        const __m256 inv_r3
+            = _mm256_mul_ps(inv_r, _mm256_mul_ps(inv_r, inv_r));
+        const __m256 s
+            = _mm256_mul_ps(_mm256_maskload_ps(mass + j, lanes), inv_r3);
+        ax = _mm256_fmadd_ps(dx, s, ax);
+        ay = _mm256_fmadd_ps(dy, s, ay);
+        az = _mm256_fmadd_ps(dz, s, az);
+    }
+    out[0] = horizontal_sum(ax);
+    out[1] = horizontal_sum(ay);
+    out[2] = horizontal_sum(az);
+}
+
+void add_tile_pair_avx2(
+    const float *x, const float *y, const float *z, const float *masses,
+    std::size_t n, std::size_t first, std::size_t first_end,
+    std::size_t second, std::size_t second_end, float softening2, float *acc
+) {
+    add_tile_pair_loop(
+        x, y, z, masses, n, first, first_end, second, second_end, softening2,
+        acc
+    );
+}
+
+void short_range_sum_avx2(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, float px, float py, float pz, float softening2,
+    const ShortRangeTable &table, float *out
+) {
+    short_range_sum_loop(
+        x, y, z, mass, count, px, py, pz, softening2, table, out
+    );
+}
+
+#endif
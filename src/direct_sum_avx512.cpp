@@ -0,0 +1,101 @@
+#include <cstddef>
+
+#include "direct_sum_simd.hpp"
+
+// Built with -mavx512f -mfma, empty when the build system did not add them
+#if defined(__AVX512F__) && defined(__FMA__)
+
+#include <immintrin.h>
+
+/**
+ * \brief Adds the sixteen lanes of a vector
+ * \param v - vector
+ * \returns sum
+ *
+ * Folded with shuffles that merge into v, the unmasked forms and
+ * _mm512_reduce_add_ps() start from an undefined vector that trips
+ * -Wuninitialized on GCC 12
+ **/
+static inline float horizontal_sum(__m512 v) {
+    const __mmask16 all = 0xFFFF;
+    v = _mm512_add_ps(v, _mm512_mask_shuffle_f32x4(v, all, v, v, 0x4E));
+    v = _mm512_add_ps(v, _mm512_mask_shuffle_f32x4(v, all, v, v, 0xB1));
+    v = _mm512_add_ps(v, _mm512_mask_permute_ps(v, all, v, 0x4E));
+    v = _mm512_add_ps(v, _mm512_mask_permute_ps(v, all, v, 0xB1));
+    return _mm512_cvtss_f32(v);
+}
+
+void direct_sum_avx512(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, float px, float py, float pz, float softening2,
+    float *out
+) {
+    const __m512 vx = _mm512_set1_ps(px);
+    const __m512 vy = _mm512_set1_ps(py);
+    const __m512 vz = _mm512_set1_ps(pz);
+    const __m512 eps2 = _mm512_set1_ps(softening2);
+    const __m512 zero = _mm512_setzero_ps();
+    __m512 ax = zero;
+    __m512 ay = zero;
+    __m512 az = zero;
+    for (std::size_t j = 0; j < count; j += 16) {
+        // Lanes past the end load zero masses
+        const std::size_t left = count - j;
+        const __mmask16 lanes
+            = left >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << left) - 1);
+        const __m512 sx = _mm512_maskz_loadu_ps(lanes, x + j);
+        const __m512 sy = _mm512_maskz_loadu_ps(lanes, y + j);
+        const __m512 sz = _mm512_maskz_loadu_ps(lanes, z + j);
+        const __m512 dx = _mm512_sub_ps(sx, vx);
+        const __m512 dy = _mm512_sub_ps(sy, vy);
+        const __m512 dz = _mm512_sub_ps(sz, vz);
+        const __m512 r2 = _mm512_fmadd_ps(
+            dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_fmadd_ps(dz, dz, eps2))
+        );
+        const __mmask16 valid
+            = _mm512_mask_cmp_ps_mask(lanes, r2, zero, _CMP_GT_OQ);
+        __m512 inv_r = _mm512_maskz_rsqrt14_ps(valid, r2);
+        for (int step = 0; step < DIRECT_SUM_NEWTON_STEPS; ++step) {
+            const __m512 half_r2 = _mm512_mul_ps(_mm512_set1_ps(0.5f), r2);
+            inv_r = _mm512_mul_ps(
+                inv_r, _mm512_fnmadd_ps(
+                           half_r2, _mm512_mul_ps(inv_r, inv_r),
+                           _mm512_set1_ps(1.5f)
+                       )
+            );
+        }
+        const __m512 inv_r3
+            = _mm512_mul_ps(inv_r, _mm512_mul_ps(inv_r, inv_r));
+        const __m512 s
+            = _mm512_mul_ps(_mm512_maskz_loadu_ps(lanes, mass + j), inv_r3);
+        ax = _mm512_fmadd_ps(dx, s, ax);
+        ay = _mm512_fmadd_ps(dy, s, ay);
+        az = _mm512_fmadd_ps(dz, s, az);
+    }
+    out[0] = horizontal_sum(ax);
+    out[1] = horizontal_sum(ay);
+    out[2] = horizontal_sum(az);
+}
+
+void add_tile_pair_avx512(
+    const float *x, const float *y, const float *z, const float *masses,
+    std::size_t n, std::size_t first, std::size_t first_end,
+    std::size_t second, std::size_t second_end, float softening2, float *acc
+) {
+    add_tile_pair_loop(
+        x, y, z, masses, n, first, first_end, second, second_end, softening2,
+        acc
+    );
+}
+
+void short_range_sum_avx512(
+    const float *x, const float *y, const float *z, const float *mass,
+    std::size_t count, float px, float py, float pz, float softening2,
+    const ShortRangeTable &table, float *out
+) {
+    short_range_sum_loop(
+        x, y, z, mass, count, px, py, pz, softening2, table, out
+    );
+}
+
+#endif
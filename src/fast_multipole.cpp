@@ -0,0 +1,493 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <omp.h>
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include "constants.hpp"
+#include "direct_sum.hpp"
+#include "fast_multipole.hpp"
+
+/** Highest expansion order, bounds the scratch arrays on the stack **/
+#define FMM_MAX_ORDER 8
+/** Terms of an expansion of FMM_MAX_ORDER **/
+#define FMM_MAX_TERMS                                                          \
+    ((FMM_MAX_ORDER + 1) * (FMM_MAX_ORDER + 2) * (FMM_MAX_ORDER + 3) / 6)
+/** Node pairs where both sides hold more bodies than this split the target
+ * into tasks **/
+#define FMM_TASK_BODIES 256
+/** Marks a multi-index above the order while building the tables **/
+#define NO_INDEX 0xFFFF
+
+/**
+ * \brief Binomial coefficient
+ * \param n - n
+ * \param k - k, at most n
+ * \returns n choose k
+ **/
+static double binomial(unsigned n, unsigned k) {
+    double result = 1.0;
+    for (unsigned i = 1; i <= k; ++i)
+        result = result * (n - k + i) / i;
+    return result;
+}
+
+/**
+ * \brief Binomial coefficient of multi-indices
+ * \param n - n
+ * \param k - k, at most n on every axis
+ * \returns product of the binomial coefficients of each axis
+ **/
+static double binomial(const glm::uvec3 &n, const glm::uvec3 &k) {
+    return binomial(n.x, k.x) * binomial(n.y, k.y) * binomial(n.z, k.z);
+}
+
+void FastMultipole::accelerations(
+    const LinearOcTree &tree, const std::vector<glm::vec3> &positions,
+    const std::vector<float> &masses, std::vector<glm::vec3> &accelerations
+) {
+    accelerations.assign(positions.size(), glm::vec3{0.0f, 0.0f, 0.0f});
+    if (tree.nodes().empty())
+        return;
+
+    const std::uint32_t clamped_order
+        = std::clamp<std::uint32_t>(order, 1, FMM_MAX_ORDER);
+    if (clamped_order != _table_order) {
+        _table_order = clamped_order;
+        prepare_tables();
+    }
+
+    _tree = &tree;
+    _positions = positions.data();
+    _masses = masses.data();
+    _accelerations = accelerations.data();
+    prepare_levels();
+
+    const std::size_t node_count = tree.nodes().size();
+    _radii.resize(node_count);
+    _multipoles.resize(node_count * _terms);
+    _sources.resize(node_count * _terms);
+    _locals.assign(node_count * _terms, 0.0);
+
+    for (std::size_t level = _level_offsets.size() - 1; level-- > 0;) {
+#pragma omp parallel for schedule(dynamic, 64)
+        for (std::uint32_t i = _level_offsets[level];
+             i < _level_offsets[level + 1]; ++i)
+            upward(_levels[i]);
+    }
+
+#pragma omp parallel
+#pragma omp single
+    interact(0, 0);
+
+    for (std::size_t level = 0; level + 1 < _level_offsets.size(); ++level) {
+#pragma omp parallel for schedule(dynamic, 64)
+        for (std::uint32_t i = _level_offsets[level];
+             i < _level_offsets[level + 1]; ++i)
+            downward(_levels[i]);
+    }
+}
+
+void FastMultipole::prepare_tables() {
+    const std::uint32_t p = _table_order;
+    const std::uint32_t side = p + 1;
+    std::vector<std::uint16_t> lookup(side * side * side, NO_INDEX);
+    auto index_of = [&](const glm::uvec3 &e) -> std::uint16_t {
+        if (e.x + e.y + e.z > p)
+            return NO_INDEX;
+        return lookup[(e.x * side + e.y) * side + e.z];
+    };
+
+    _exponents.clear();
+    for (std::uint32_t degree = 0; degree <= p; ++degree) {
+        for (std::uint32_t x = degree + 1; x-- > 0;) {
+            for (std::uint32_t y = degree - x + 1; y-- > 0;) {
+                const glm::uvec3 e{x, y, degree - x - y};
+                lookup[(e.x * side + e.y) * side + e.z] = _exponents.size();
+                _exponents.push_back(e);
+            }
+        }
+    }
+    _terms = _exponents.size();
+
+    // Missing neighbours point past the last term, where the scratch arrays
+    // keep a zero, so the loops using them need no branches
+    const std::uint16_t missing = _terms;
+    _lower.assign(_terms, missing);
+    _lower_axis.assign(_terms, 0);
+    _recurrence.assign(6 * _terms, 0.0);
+    _source_factors.assign(_terms, 1.0);
+    _inverse_factorials.assign(_terms, 1.0);
+    for (int axis = 0; axis < 3; ++axis) {
+        _minus_one[axis].assign(_terms, missing);
+        _minus_two[axis].assign(_terms, missing);
+    }
+    for (std::size_t i = 1; i < _terms; ++i) {
+        const glm::uvec3 &e = _exponents[i];
+        for (int axis = 2; axis >= 0; --axis) {
+            glm::uvec3 lower = e;
+            if (e[axis] >= 1) {
+                --lower[axis];
+                _minus_one[axis][i] = index_of(lower);
+                _lower[i] = _minus_one[axis][i];
+                _lower_axis[i] = axis;
+            }
+            if (e[axis] >= 2) {
+                --lower[axis];
+                _minus_two[axis][i] = index_of(lower);
+            }
+        }
+        const double degree = e.x + e.y + e.z;
+        double factorial = 1.0;
+        for (int axis = 0; axis < 3; ++axis) {
+            const double n = e[axis];
+            _recurrence[6 * i + axis] = -(2.0 * degree - 1.0) * n / degree;
+            _recurrence[6 * i + 3 + axis] = -(degree - 1.0) * n * (n - 1.0)
+                                            / degree;
+            for (unsigned f = 2; f <= e[axis]; ++f)
+                factorial *= f;
+        }
+        _inverse_factorials[i] = 1.0 / factorial;
+        _source_factors[i]
+            = (static_cast<unsigned>(degree) % 2 == 0 ? 1.0 : -1.0) / factorial;
+    }
+
+    _m2m.clear();
+    _l2l.clear();
+    for (std::size_t n = 0; n < _terms; ++n) {
+        const glm::uvec3 &en = _exponents[n];
+        for (std::size_t k = 0; k < _terms; ++k) {
+            const glm::uvec3 &ek = _exponents[k];
+            if (ek.x > en.x || ek.y > en.y || ek.z > en.z)
+                continue;
+
+            const std::uint16_t power = index_of(en - ek);
+            const double coefficient = binomial(en, ek);
+            _m2m.push_back(Term{
+                static_cast<std::uint16_t>(n), static_cast<std::uint16_t>(k),
+                power, coefficient
+            });
+            // The potential itself is never used, only its gradient
+            if (ek.x + ek.y + ek.z > 0)
+                _l2l.push_back(Term{
+                    static_cast<std::uint16_t>(k), static_cast<std::uint16_t>(n),
+                    power, coefficient
+                });
+        }
+    }
+
+    // With scaled multipoles and derivatives M2L has no coefficients left,
+    // sum_n D_{n+k} (-1)^|n| M_n / n! is k! times the Taylor coefficient.
+    // Sources of order 1 are left out, moments are taken about the center
+    // of mass so they vanish.
+    _m2l.clear();
+    _m2l_offsets.assign(_terms + 1, 0);
+    for (std::size_t k = 1; k < _terms; ++k) {
+        const glm::uvec3 &ek = _exponents[k];
+        for (std::size_t n = 0; n < _terms; ++n) {
+            const glm::uvec3 &en = _exponents[n];
+            const std::uint32_t degree_n = en.x + en.y + en.z;
+            if (degree_n + ek.x + ek.y + ek.z <= p && degree_n != 1)
+                _m2l.push_back(Product{
+                    static_cast<std::uint16_t>(n), index_of(en + ek)
+                });
+        }
+        _m2l_offsets[k + 1] = _m2l.size();
+    }
+}
+
+bool FastMultipole::is_leaf(const LinearOcTree::Node &node) const {
+    return node.is_leaf() || node.body_count <= leaf_size;
+}
+
+void FastMultipole::prepare_levels() {
+    const std::vector<LinearOcTree::Node> &nodes = _tree->nodes();
+    _parents.resize(nodes.size());
+    _first_body.resize(nodes.size());
+    _levels.clear();
+    _level_offsets.clear();
+    _leaves.clear();
+
+    // Breadth-first walk, so _levels ends up grouped by depth
+    _parents[0] = LinearOcTree::null_index;
+    _levels.push_back(0);
+    _level_offsets.push_back(0);
+    std::size_t level_begin = 0;
+    while (level_begin < _levels.size()) {
+        const std::size_t level_end = _levels.size();
+        _level_offsets.push_back(level_end);
+        for (std::size_t i = level_begin; i < level_end; ++i) {
+            const LinearOcTree::Node &n = nodes[_levels[i]];
+            if (is_leaf(n)) {
+                _leaves.push_back(_levels[i]);
+                continue;
+            }
+            for (std::uint32_t k = 0; k < 8; ++k) {
+                _parents[n.first_child + k] = _levels[i];
+                _levels.push_back(n.first_child + k);
+            }
+        }
+        level_begin = level_end;
+    }
+
+    std::uint32_t offset = 0;
+    for (auto leaf : _leaves) {
+        _first_body[leaf] = offset;
+        offset += nodes[leaf].body_count;
+    }
+    _bodies.resize(offset);
+    _x.resize(offset);
+    _y.resize(offset);
+    _z.resize(offset);
+    _mass.resize(offset);
+#pragma omp parallel for schedule(dynamic, 64)
+    for (std::size_t i = 0; i < _leaves.size(); ++i)
+        gather_bodies(_leaves[i]);
+}
+
+void FastMultipole::gather_bodies(std::uint32_t leaf) {
+    // Walks the leafs of the octree below the node through the next links,
+    // bodies of a subtree are not contiguous once the tree was refitted
+    const std::vector<LinearOcTree::Node> &nodes = _tree->nodes();
+    const std::uint32_t end = nodes[leaf].next;
+    std::uint32_t cursor = _first_body[leaf];
+    std::uint32_t node = leaf;
+    while (node != end) {
+        const LinearOcTree::Node &n = nodes[node];
+        if (!n.is_leaf()) {
+            node = n.first_child;
+            continue;
+        }
+        for (std::uint32_t i = 0; i < n.body_count; ++i) {
+            const std::uint32_t body = _tree->body_indices()[n.first_body + i];
+            _bodies[cursor] = body;
+            _x[cursor] = _positions[body].x;
+            _y[cursor] = _positions[body].y;
+            _z[cursor] = _positions[body].z;
+            _mass[cursor] = _masses[body];
+            ++cursor;
+        }
+        node = n.next;
+    }
+}
+
+void FastMultipole::powers_of(const glm::dvec3 &offset, double *powers) const {
+    powers[0] = 1.0;
+    for (std::size_t i = 1; i < _terms; ++i)
+        powers[i] = powers[_lower[i]] * offset[_lower_axis[i]];
+    powers[_terms] = 0.0;
+}
+
+void FastMultipole::inverse_distance_derivatives(
+    const glm::dvec3 &offset, double *derivatives
+) const {
+    // Derivatives D_n of 1/r follow |n| r^2 D_n = -(2|n| - 1) sum_i n_i x_i
+    // D_{n-e_i} - (|n| - 1) sum_i n_i (n_i - 1) D_{n-2e_i}
+    const double inv_r2 = 1.0 / glm::dot(offset, offset);
+    derivatives[0] = std::sqrt(inv_r2);
+    derivatives[_terms] = 0.0;
+    const std::uint16_t *minus_one_x = _minus_one[0].data();
+    const std::uint16_t *minus_one_y = _minus_one[1].data();
+    const std::uint16_t *minus_one_z = _minus_one[2].data();
+    const std::uint16_t *minus_two_x = _minus_two[0].data();
+    const std::uint16_t *minus_two_y = _minus_two[1].data();
+    const std::uint16_t *minus_two_z = _minus_two[2].data();
+    for (std::size_t i = 1; i < _terms; ++i) {
+        const double *f = &_recurrence[6 * i];
+        const double sum
+            = f[0] * offset.x * derivatives[minus_one_x[i]]
+              + f[1] * offset.y * derivatives[minus_one_y[i]]
+              + f[2] * offset.z * derivatives[minus_one_z[i]]
+              + f[3] * derivatives[minus_two_x[i]]
+              + f[4] * derivatives[minus_two_y[i]]
+              + f[5] * derivatives[minus_two_z[i]];
+        derivatives[i] = sum * inv_r2;
+    }
+}
+
+void FastMultipole::upward(std::uint32_t node) {
+    const std::vector<LinearOcTree::Node> &nodes = _tree->nodes();
+    const LinearOcTree::Node &n = nodes[node];
+    double *multipole = &_multipoles[node * _terms];
+    std::fill(multipole, multipole + _terms, 0.0);
+    _radii[node] = 0.0;
+    if (n.body_count == 0)
+        return;
+
+    const glm::dvec3 center{n.center_of_mass};
+    double powers[FMM_MAX_TERMS + 1];
+    double radius = 0.0;
+    if (is_leaf(n)) {
+        const std::uint32_t first = _first_body[node];
+        for (std::uint32_t i = first; i < first + n.body_count; ++i) {
+            const glm::dvec3 offset = glm::dvec3{_x[i], _y[i], _z[i]} - center;
+            const double mass = _mass[i];
+            powers_of(offset, powers);
+            for (std::size_t t = 0; t < _terms; ++t)
+                multipole[t] += mass * powers[t];
+            radius = std::max(radius, glm::length(offset));
+        }
+        _radii[node] = radius;
+        scale_sources(node);
+        return;
+    }
+
+    for (std::uint32_t k = 0; k < 8; ++k) {
+        const std::uint32_t child = n.first_child + k;
+        if (nodes[child].body_count == 0)
+            continue;
+
+        const glm::dvec3 offset
+            = glm::dvec3{nodes[child].center_of_mass} - center;
+        const double *child_multipole = &_multipoles[child * _terms];
+        powers_of(offset, powers);
+        for (const Term &t : _m2m)
+            multipole[t.target]
+                += t.coefficient * powers[t.power] * child_multipole[t.source];
+        radius = std::max(radius, glm::length(offset) + _radii[child]);
+    }
+
+    // The cube bounds the bodies too, whichever bound is tighter is kept
+    const glm::dvec3 start{n.cube_start};
+    const glm::dvec3 far_corner = glm::max(
+        glm::abs(center - start), glm::abs(start + double(n.width) - center)
+    );
+    _radii[node] = std::min(radius, glm::length(far_corner));
+    scale_sources(node);
+}
+
+void FastMultipole::scale_sources(std::uint32_t node) {
+    const double *multipole = &_multipoles[node * _terms];
+    double *source = &_sources[node * _terms];
+    for (std::size_t t = 0; t < _terms; ++t)
+        source[t] = multipole[t] * _source_factors[t];
+}
+
+void FastMultipole::interact(std::uint32_t source, std::uint32_t target) {
+    const std::vector<LinearOcTree::Node> &nodes = _tree->nodes();
+    const LinearOcTree::Node &s = nodes[source];
+    const LinearOcTree::Node &t = nodes[target];
+    if (s.total_mass == 0.0f || t.body_count == 0)
+        return;
+
+    const double distance = glm::length(
+        glm::dvec3{t.center_of_mass} - glm::dvec3{s.center_of_mass}
+    );
+    if (_radii[source] + _radii[target] < theta * distance) {
+        m2l(source, target);
+        return;
+    }
+    const bool source_leaf = is_leaf(s);
+    const bool target_leaf = is_leaf(t);
+    if (source_leaf && target_leaf) {
+        p2p(source, target);
+        return;
+    }
+
+    // The larger node is split. Splitting the target keeps the writes of
+    // each call inside its own subtree, so those calls may run as tasks,
+    // only worth it while both sides still hold many bodies.
+    if (source_leaf || (!target_leaf && _radii[target] >= _radii[source])) {
+        if (t.body_count > FMM_TASK_BODIES
+            && s.body_count > FMM_TASK_BODIES) {
+            for (std::uint32_t k = 0; k < 8; ++k) {
+                const std::uint32_t child = t.first_child + k;
+#pragma omp task
+                interact(source, child);
+            }
+#pragma omp taskwait
+        }
+        else {
+            for (std::uint32_t k = 0; k < 8; ++k)
+                interact(source, t.first_child + k);
+        }
+    }
+    else {
+        for (std::uint32_t k = 0; k < 8; ++k)
+            interact(s.first_child + k, target);
+    }
+}
+
+void FastMultipole::m2l(std::uint32_t source, std::uint32_t target) {
+    const std::vector<LinearOcTree::Node> &nodes = _tree->nodes();
+    const glm::dvec3 offset = glm::dvec3{nodes[target].center_of_mass}
+                              - glm::dvec3{nodes[source].center_of_mass};
+    double derivatives[FMM_MAX_TERMS + 1];
+    inverse_distance_derivatives(offset, derivatives);
+
+    // Sums are kept in registers, each target is written once
+    const double *scaled = &_sources[source * _terms];
+    double *local = &_locals[target * _terms];
+    const Product *products = _m2l.data();
+    for (std::size_t k = 1; k < _terms; ++k) {
+        double sum = 0.0;
+        for (std::uint32_t i = _m2l_offsets[k]; i < _m2l_offsets[k + 1]; ++i)
+            sum += derivatives[products[i].derivative]
+                   * scaled[products[i].source];
+        local[k] += sum;
+    }
+}
+
+void FastMultipole::p2p(std::uint32_t source, std::uint32_t target) {
+    const std::vector<LinearOcTree::Node> &nodes = _tree->nodes();
+    const std::uint32_t source_begin = _first_body[source];
+    const std::uint32_t source_end = source_begin + nodes[source].body_count;
+    const std::uint32_t target_begin = _first_body[target];
+    const std::uint32_t target_end = target_begin + nodes[target].body_count;
+    const std::uint32_t count = source_end - source_begin;
+    const float softening2 = softening * softening;
+
+    // Coincident bodies, the body itself included, add nothing
+    for (std::uint32_t i = target_begin; i < target_end; ++i) {
+        const glm::vec3 acceleration = direct_sum(
+            &_x[source_begin], &_y[source_begin], &_z[source_begin],
+            &_mass[source_begin], count, glm::vec3{_x[i], _y[i], _z[i]},
+            softening2
+        );
+        _accelerations[_bodies[i]] += acceleration * static_cast<float>(G);
+    }
+}
+
+void FastMultipole::downward(std::uint32_t node) {
+    const std::vector<LinearOcTree::Node> &nodes = _tree->nodes();
+    const LinearOcTree::Node &n = nodes[node];
+    if (n.body_count == 0)
+        return;
+
+    // M2L left k! times the Taylor coefficients
+    const glm::dvec3 center{n.center_of_mass};
+    double *local = &_locals[node * _terms];
+    for (std::size_t t = 0; t < _terms; ++t)
+        local[t] *= _inverse_factorials[t];
+
+    double powers[FMM_MAX_TERMS + 1];
+    const std::uint32_t parent = _parents[node];
+    if (parent != LinearOcTree::null_index) {
+        const glm::dvec3 offset
+            = center - glm::dvec3{nodes[parent].center_of_mass};
+        const double *parent_local = &_locals[parent * _terms];
+        powers_of(offset, powers);
+        for (const Term &t : _l2l)
+            local[t.target]
+                += t.coefficient * powers[t.power] * parent_local[t.source];
+    }
+    if (!is_leaf(n))
+        return;
+
+    // The acceleration is G times the gradient of the expansion of sum m/r
+    const std::uint32_t first = _first_body[node];
+    for (std::uint32_t b = first; b < first + n.body_count; ++b) {
+        powers_of(glm::dvec3{_x[b], _y[b], _z[b]} - center, powers);
+        glm::dvec3 gradient{0.0, 0.0, 0.0};
+        for (std::size_t i = 1; i < _terms; ++i) {
+            for (int axis = 0; axis < 3; ++axis)
+                gradient[axis] += _exponents[i][axis] * local[i]
+                                  * powers[_minus_one[axis][i]];
+        }
+        _accelerations[_bodies[b]] += glm::vec3{gradient * G};
+    }
+}
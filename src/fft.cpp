@@ -0,0 +1,55 @@
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "fft.hpp"
+
+std::vector<std::complex<float>> fft_twiddles(std::size_t n) {
+    std::vector<std::complex<float>> twiddles(n / 2);
+    for (std::size_t k = 0; k < n / 2; ++k) {
+        // Angles in double, float would lose bits on large transforms
+        const double angle = -2.0 * M_PI * static_cast<double>(k)
+                             / static_cast<double>(n);
+        twiddles[k] = std::complex<float>{
+            static_cast<float>(std::cos(angle)),
+            static_cast<float>(std::sin(angle))
+        };
+    }
+    return twiddles;
+}
+
+void fft(
+    std::complex<float> *data, std::size_t n,
+    const std::complex<float> *twiddles, bool inverse
+) {
+    for (std::size_t i = 1, j = 0; i < n; ++i) {
+        std::size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            std::swap(data[i], data[j]);
+    }
+
+    const float sign = inverse ? -1.0f : 1.0f;
+    for (std::size_t length = 2; length <= n; length <<= 1) {
+        const std::size_t half = length / 2;
+        const std::size_t step = n / length;
+        for (std::size_t i = 0; i < n; i += length) {
+            for (std::size_t k = 0; k < half; ++k) {
+                // Products written out, std::complex checks for NaNs
+                const float wr = twiddles[k * step].real();
+                const float wi = sign * twiddles[k * step].imag();
+                const std::complex<float> u = data[i + k];
+                const std::complex<float> v = data[i + k + half];
+                const std::complex<float> t{
+                    v.real() * wr - v.imag() * wi, v.real() * wi + v.imag() * wr
+                };
+                data[i + k] = u + t;
+                data[i + k + half] = u - t;
+            }
+        }
+    }
+}
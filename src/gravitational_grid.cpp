@@ -11,7 +11,7 @@
 #define DEBUG
 #include <axolote/utils.hpp>
 
-#include "celestial_body.hpp"
+#include "body_store.hpp"
 #include "gravitational_grid.hpp"
 
 #define G 6.67430e-11f
@@ -20,19 +20,22 @@
 #define A 40000.0
 #define K 4000.0
 
-GravGrid::GravGrid(std::vector<std::shared_ptr<CelestialBody>> bodies) {
+GravGrid::GravGrid(const BodyStore &bodies) {
+    const std::vector<glm::vec3> &positions = bodies.positions();
+    const std::vector<float> &masses = bodies.masses();
+
     // Find the most massive body
-    std::shared_ptr<CelestialBody> biggest = bodies[0];
-    for (auto &c : bodies) {
-        if (c->mass() > biggest->mass()) {
-            biggest = c;
+    std::size_t biggest = 0;
+    for (std::size_t i = 0; i < bodies.size(); ++i) {
+        if (masses[i] > masses[biggest]) {
+            biggest = i;
         }
     }
 
-    std::shared_ptr<CelestialBody> farest = bodies[0];
-    for (auto &c : bodies) {
-        if (glm::length(c->pos) > glm::length(farest->pos)) {
-            farest = c;
+    std::size_t farest = 0;
+    for (std::size_t i = 0; i < bodies.size(); ++i) {
+        if (glm::length(positions[i]) > glm::length(positions[farest])) {
+            farest = i;
         }
     }
     //// Calculate mean distance between two bodies
@@ -70,11 +73,11 @@ GravGrid::GravGrid(std::vector<std::shared_ptr<CelestialBody>> bodies) {
     //     size, size, width
     //);
 
-    int size = (int)glm::length(farest->pos) * 1.6;
+    int size = (int)glm::length(positions[farest]) * 1.6;
     int width = size / 40;
 
     // Calculate the multiplier constant based on the most massive body
-    multiplier_constant = calculate_multiplier(biggest->mass());
+    multiplier_constant = calculate_multiplier(masses[biggest]);
     axolote::debug(
         axolote::DebugType::INFO2, "Chosen multiplier: %lf", multiplier_constant
     );
@@ -136,18 +139,17 @@ GravGrid::GravGrid(std::vector<std::shared_ptr<CelestialBody>> bodies) {
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo);
 }
 
-void GravGrid::update_for_body(std::shared_ptr<CelestialBody> c) {
+void GravGrid::update_for_body(const glm::vec3 &pos, double mass) {
     // O(n²)
     for (std::size_t i = 0; i < _displacements.capacity(); ++i) {
         glm::vec3 vertex_pos = gmodel->meshes[0].vertices[i].pos;
 
-        glm::vec3 pos = c->pos;
         // dividing by X increases the area of "perception" of gravity
         float dist = glm::distance(vertex_pos, pos) / 10.0f;
 
         // Do not allow division by zero or rs tending to infinity
         dist = std::max(dist, 0.05f);
-        double rs = (2 * G * c->mass()) / (dist * dist);
+        double rs = (2 * G * mass) / (dist * dist);
         double w = 2 * std::sqrt(rs * (dist - rs)) * multiplier_constant;
 
         _displacements[i] += w;
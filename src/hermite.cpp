@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "constants.hpp"
+#include "hermite.hpp"
+
+/**
+ * \brief Sums the acceleration and jerk of point masses on a body
+ * \param x - x of each source
+ * \param y - y of each source
+ * \param z - z of each source
+ * \param vx - x velocity of each source
+ * \param vy - y velocity of each source
+ * \param vz - z velocity of each source
+ * \param gm - mass of each source times G
+ * \param count - amount of sources
+ * \param i - source that is the body itself
+ * \param softening2 - squared Plummer softening length
+ * \param acceleration - receives the acceleration
+ * \param jerk - receives the jerk
+ **/
+static void acceleration_jerk(
+    const double *x, const double *y, const double *z, const double *vx,
+    const double *vy, const double *vz, const double *gm, std::size_t count,
+    std::size_t i, double softening2, glm::dvec3 &acceleration,
+    glm::dvec3 &jerk
+) {
+    const double px = x[i];
+    const double py = y[i];
+    const double pz = z[i];
+    const double pvx = vx[i];
+    const double pvy = vy[i];
+    const double pvz = vz[i];
+    double ax = 0.0, ay = 0.0, az = 0.0;
+    double jx = 0.0, jy = 0.0, jz = 0.0;
+    // Branch free so it vectorizes, the body itself is at distance zero
+#pragma omp simd reduction(+ : ax, ay, az, jx, jy, jz)
+    for (std::size_t j = 0; j < count; ++j) {
+        const double dx = x[j] - px;
+        const double dy = y[j] - py;
+        const double dz = z[j] - pz;
+        const double dvx = vx[j] - pvx;
+        const double dvy = vy[j] - pvy;
+        const double dvz = vz[j] - pvz;
+        const double r2 = dx * dx + dy * dy + dz * dz + softening2;
+        const double valid = r2 > 0.0;
+        const double inv_r2 = valid / (r2 + (1.0 - valid));
+        const double inv_r3 = gm[j] * inv_r2 * std::sqrt(inv_r2);
+        const double rv = 3.0 * (dx * dvx + dy * dvy + dz * dvz) * inv_r2;
+        ax += dx * inv_r3;
+        ay += dy * inv_r3;
+        az += dz * inv_r3;
+        jx += (dvx - rv * dx) * inv_r3;
+        jy += (dvy - rv * dy) * inv_r3;
+        jz += (dvz - rv * dz) * inv_r3;
+    }
+    acceleration = glm::dvec3{ax, ay, az};
+    jerk = glm::dvec3{jx, jy, jz};
+}
+
+std::size_t Hermite::step(BodyStore &bodies, double dt) {
+    load(bodies);
+    const std::size_t n = _positions.size();
+    if (n == 0 || dt <= 0.0)
+        return 0;
+
+    if (_step <= 0.0) {
+        _step = std::numeric_limits<double>::infinity();
+        for (std::size_t i = 0; i < n; ++i) {
+            const double jerk = glm::length(_jerks[i]);
+            if (jerk > 0.0)
+                _step = std::min(
+                    _step, eta_start * glm::length(_accelerations[i]) / jerk
+                );
+        }
+    }
+
+    const double min_step = dt / std::max<std::uint32_t>(max_substeps, 1);
+    std::size_t substeps = 0;
+    double t = 0.0;
+    while (t < dt) {
+        const double h = std::min(std::max(_step, min_step), dt - t);
+        predict(h);
+        evaluate();
+        const double next = correct(h);
+        // A substep cut short by the end of the step gives poor derivatives
+        if (h < _step)
+            _step = std::min(_step, std::max(next, h));
+        else
+            _step = next;
+        t = h == dt - t ? dt : t + h;
+        ++substeps;
+    }
+
+    std::vector<glm::vec3> &positions = bodies.positions();
+    std::vector<glm::vec3> &velocities = bodies.velocities();
+#pragma omp parallel for schedule(static) if (n >= HERMITE_PARALLEL_BODIES)
+    for (std::size_t i = 0; i < n; ++i) {
+        positions[i] = glm::vec3{_positions[i]};
+        velocities[i] = glm::vec3{_velocities[i]};
+    }
+    return substeps;
+}
+
+void Hermite::load(const BodyStore &bodies) {
+    const std::size_t n = bodies.size();
+    const std::vector<glm::vec3> &positions = bodies.positions();
+    const std::vector<glm::vec3> &velocities = bodies.velocities();
+    const std::vector<float> &masses = bodies.masses();
+    bool is_same = _positions.size() == n;
+    for (std::size_t i = 0; is_same && i < n; ++i) {
+        is_same = positions[i] == glm::vec3{_positions[i]}
+                  && velocities[i] == glm::vec3{_velocities[i]}
+                  && masses[i] * G == _gm[i];
+    }
+    if (is_same)
+        return;
+
+    _positions.resize(n);
+    _velocities.resize(n);
+    _accelerations.resize(n);
+    _jerks.resize(n);
+    _new_accelerations.resize(n);
+    _new_jerks.resize(n);
+    _x.resize(n);
+    _y.resize(n);
+    _z.resize(n);
+    _vx.resize(n);
+    _vy.resize(n);
+    _vz.resize(n);
+    _gm.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        _positions[i] = glm::dvec3{positions[i]};
+        _velocities[i] = glm::dvec3{velocities[i]};
+        _gm[i] = masses[i] * G;
+    }
+    predict(0.0);
+    evaluate();
+    _accelerations.swap(_new_accelerations);
+    _jerks.swap(_new_jerks);
+    _step = 0.0;
+}
+
+void Hermite::predict(double h) {
+    const std::size_t n = _positions.size();
+    const double h2 = h * h / 2.0;
+    const double h3 = h * h2 / 3.0;
+#pragma omp parallel for schedule(static) if (n >= HERMITE_PARALLEL_BODIES)
+    for (std::size_t i = 0; i < n; ++i) {
+        const glm::dvec3 pos = _positions[i] + _velocities[i] * h
+                               + _accelerations[i] * h2 + _jerks[i] * h3;
+        const glm::dvec3 vel
+            = _velocities[i] + _accelerations[i] * h + _jerks[i] * h2;
+        _x[i] = pos.x;
+        _y[i] = pos.y;
+        _z[i] = pos.z;
+        _vx[i] = vel.x;
+        _vy[i] = vel.y;
+        _vz[i] = vel.z;
+    }
+}
+
+void Hermite::evaluate() {
+    const std::size_t n = _positions.size();
+    const double softening2
+        = static_cast<double>(softening) * static_cast<double>(softening);
+#pragma omp parallel for schedule(static) if (n >= HERMITE_PARALLEL_BODIES)
+    for (std::size_t i = 0; i < n; ++i) {
+        acceleration_jerk(
+            _x.data(), _y.data(), _z.data(), _vx.data(), _vy.data(),
+            _vz.data(), _gm.data(), n, i, softening2, _new_accelerations[i],
+            _new_jerks[i]
+        );
+    }
+}
+
+double Hermite::correct(double h) {
+    const std::size_t n = _positions.size();
+    double next = std::numeric_limits<double>::infinity();
+#pragma omp parallel for schedule(static) reduction(min : next) \
+    if (n >= HERMITE_PARALLEL_BODIES)
+    for (std::size_t i = 0; i < n; ++i) {
+        const glm::dvec3 a0 = _accelerations[i];
+        const glm::dvec3 j0 = _jerks[i];
+        const glm::dvec3 a1 = _new_accelerations[i];
+        const glm::dvec3 j1 = _new_jerks[i];
+
+        // Time symmetric form of the corrector
+        const double h2 = h * h / 12.0;
+        const glm::dvec3 vel
+            = _velocities[i] + (a0 + a1) * (h / 2.0) + (j0 - j1) * h2;
+        _positions[i] += (_velocities[i] + vel) * (h / 2.0) + (a0 - a1) * h2;
+        _velocities[i] = vel;
+        _accelerations[i] = a1;
+        _jerks[i] = j1;
+
+        // Second and third derivatives of the acceleration at the end
+        const glm::dvec3 snap
+            = (-6.0 * (a0 - a1) - h * (4.0 * j0 + 2.0 * j1)) / (h * h);
+        const glm::dvec3 crackle
+            = (12.0 * (a0 - a1) + 6.0 * h * (j0 + j1)) / (h * h * h);
+        const glm::dvec3 snap_end = snap + crackle * h;
+
+        const double a = glm::length(a1);
+        const double j = glm::length(j1);
+        const double s = glm::length(snap_end);
+        const double c = glm::length(crackle);
+        const double denominator = j * c + s * s;
+        if (denominator > 0.0)
+            next = std::min(
+                next, std::sqrt(eta * (a * s + j * j) / denominator)
+            );
+    }
+    return next;
+}
@@ -0,0 +1,547 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/gtc/constants.hpp>
+
+#include "constants.hpp"
+#include "integrator.hpp"
+
+/** Iterations of the Kepler solver, it usually converges in a few **/
+#define KEPLER_MAX_ITERATIONS 32
+/** Relative change of the universal anomaly the Kepler solver stops at **/
+#define KEPLER_TOLERANCE 1e-14
+/** Times a Kepler step that did not converge is halved **/
+#define KEPLER_MAX_HALVINGS 16
+
+/**
+ * \brief Adds the accelerations times a step to the velocities
+ * \param bodies - bodies
+ * \param accelerations - acceleration of each body
+ * \param dt - step
+ **/
+static void kick(
+    BodyStore &bodies, const std::vector<glm::vec3> &accelerations, float dt
+) {
+    std::vector<glm::vec3> &velocities = bodies.velocities();
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < bodies.size(); ++i) {
+        velocities[i] += accelerations[i] * dt;
+    }
+}
+
+/**
+ * \brief Adds the velocities times a step to the positions
+ * \param bodies - bodies
+ * \param dt - step
+ **/
+static void drift(BodyStore &bodies, float dt) {
+    std::vector<glm::vec3> &positions = bodies.positions();
+    const std::vector<glm::vec3> &velocities = bodies.velocities();
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < bodies.size(); ++i) {
+        positions[i] += velocities[i] * dt;
+    }
+}
+
+/**
+ * \brief Stumpff functions c2 and c3
+ * \param z - argument
+ * \param c - receives c2(z)
+ * \param s - receives c3(z)
+ **/
+static void stumpff(double z, double &c, double &s) {
+    if (z > 1e-2) {
+        const double sz = std::sqrt(z);
+        c = (1.0 - std::cos(sz)) / z;
+        s = (sz - std::sin(sz)) / (z * sz);
+    }
+    else if (z < -1e-2) {
+        const double sz = std::sqrt(-z);
+        c = (std::cosh(sz) - 1.0) / -z;
+        s = (std::sinh(sz) - sz) / (-z * sz);
+    }
+    else {
+        // Series, the closed forms cancel out near zero
+        c = 1.0 / 2.0 - z * (1.0 / 24.0 - z * (1.0 / 720.0 - z / 40320.0));
+        s = 1.0 / 6.0 - z * (1.0 / 120.0 - z * (1.0 / 5040.0 - z / 362880.0));
+    }
+}
+
+/**
+ * \brief Moves a body along its Kepler orbit around a point mass
+ * \param pos - position relative to the point mass
+ * \param vel - velocity
+ * \param mu - mass of the point times G
+ * \param dt - delta time
+ * \returns false if the solver did not converge, the body is left untouched
+ *
+ * Universal variable formulation, valid for any eccentricity, solved with
+ * Laguerre-Conway iterations
+ **/
+static bool
+kepler_step(glm::dvec3 &pos, glm::dvec3 &vel, double mu, double dt) {
+    const double r0 = glm::length(pos);
+
+    const double sqrt_mu = std::sqrt(mu);
+    const double eta = glm::dot(pos, vel) / sqrt_mu;
+    const double alpha = 2.0 / r0 - glm::dot(vel, vel) / mu;
+    const double zeta = 1.0 - alpha * r0;
+    double chi = sqrt_mu * dt / r0;
+    if (alpha > 0.0) {
+        // Whole periods of a bound orbit change nothing
+        const double sqrt_alpha = std::sqrt(alpha);
+        const double period
+            = glm::two_pi<double>() / (sqrt_mu * alpha * sqrt_alpha);
+        dt = std::fmod(dt, period);
+        const double max_chi = glm::two_pi<double>() / sqrt_alpha;
+        chi = std::clamp(sqrt_mu * dt / r0, -max_chi, max_chi);
+    }
+    else if (alpha * r0 < -1e-2) {
+        // Asymptotic guess of Vallado, the linear one overshoots by far on
+        // clearly hyperbolic orbits
+        const double a = 1.0 / alpha;
+        const double sign = dt < 0.0 ? -1.0 : 1.0;
+        const double ratio
+            = -2.0 * mu * alpha * dt
+              / (glm::dot(pos, vel)
+                 + sign * std::sqrt(-mu * a) * (1.0 - r0 * alpha));
+        if (ratio > 0.0)
+            chi = sign * std::sqrt(-a) * std::log(ratio);
+    }
+
+    double z = 0.0, c = 0.5, s = 1.0 / 6.0;
+    bool converged = false;
+    for (int i = 0; i < KEPLER_MAX_ITERATIONS && !converged; ++i) {
+        z = alpha * chi * chi;
+        stumpff(z, c, s);
+        const double chi2 = chi * chi;
+        const double f
+            = eta * chi2 * c + zeta * chi2 * chi * s + r0 * chi - sqrt_mu * dt;
+        const double df = eta * chi * (1.0 - z * s) + zeta * chi2 * c + r0;
+        const double ddf = eta * (1.0 - z * c) + zeta * chi * (1.0 - z * s);
+        // Laguerre-Conway with n = 5
+        const double root
+            = std::sqrt(std::abs(16.0 * df * df - 20.0 * f * ddf));
+        const double delta = 5.0 * f / (df + std::copysign(root, df));
+        chi -= delta;
+        converged = std::abs(delta) <= KEPLER_TOLERANCE * std::abs(chi);
+    }
+    if (!converged || !std::isfinite(chi))
+        return false;
+
+    z = alpha * chi * chi;
+    stumpff(z, c, s);
+
+    const double chi2 = chi * chi;
+    const double r = eta * chi * (1.0 - z * s) + zeta * chi2 * c + r0;
+    const double f = 1.0 - chi2 * c / r0;
+    const double g = dt - chi2 * chi * s / sqrt_mu;
+    const double df = sqrt_mu * chi * (z * s - 1.0) / (r * r0);
+    const double dg = 1.0 - chi2 * c / r;
+    const glm::dvec3 new_pos = f * pos + g * vel;
+    const glm::dvec3 new_vel = df * pos + dg * vel;
+    if (!std::isfinite(glm::dot(new_pos, new_vel)))
+        return false;
+
+    pos = new_pos;
+    vel = new_vel;
+    return true;
+}
+
+/**
+ * \brief Moves a body along its Kepler orbit around a point mass
+ * \param pos - position relative to the point mass
+ * \param vel - velocity
+ * \param mu - mass of the point times G
+ * \param dt - delta time
+ * \param halvings - times dt was already halved
+ *
+ * Long steps on nearly parabolic orbits can defeat the first guess of the
+ * solver, they are split in halves until it converges
+ **/
+static void kepler_drift(
+    glm::dvec3 &pos, glm::dvec3 &vel, double mu, double dt, int halvings = 0
+) {
+    if (glm::length(pos) == 0.0 || mu <= 0.0) {
+        pos += vel * dt;
+        return;
+    }
+    if (kepler_step(pos, vel, mu, dt))
+        return;
+
+    if (halvings == KEPLER_MAX_HALVINGS) {
+        pos += vel * dt;
+        return;
+    }
+    kepler_drift(pos, vel, mu, dt / 2.0, halvings + 1);
+    kepler_drift(pos, vel, mu, dt / 2.0, halvings + 1);
+}
+
+/**
+ * \brief Finds the body that dominates the others
+ * \param bodies - bodies
+ * \returns index of the heaviest body if it outweighs all the others
+ * DOMINANT_MASS_RATIO times, the amount of bodies otherwise
+ **/
+static std::size_t dominant_body(const BodyStore &bodies) {
+    const std::vector<float> &masses = bodies.masses();
+    std::size_t heaviest = 0;
+    double total = 0.0;
+    for (std::size_t i = 0; i < bodies.size(); ++i) {
+        total += masses[i];
+        if (masses[i] > masses[heaviest])
+            heaviest = i;
+    }
+    if (bodies.size() == 0 || masses[heaviest] <= 0.0f)
+        return bodies.size();
+
+    const double others = total - masses[heaviest];
+    if (masses[heaviest] < DOMINANT_MASS_RATIO * others)
+        return bodies.size();
+    return heaviest;
+}
+
+bool Integrator::parse(const std::string &name, Scheme &scheme) {
+    if (name == "euler")
+        scheme = Scheme::Euler;
+    else if (name == "leapfrog")
+        scheme = Scheme::Leapfrog;
+    else if (name == "yoshida")
+        scheme = Scheme::Yoshida;
+    else if (name == "block")
+        scheme = Scheme::Block;
+    else if (name == "wisdom-holman")
+        scheme = Scheme::WisdomHolman;
+    else
+        return false;
+
+    return true;
+}
+
+void Integrator::step(
+    BodyStore &bodies, std::vector<glm::vec3> &accelerations, double dt,
+    const Evaluate &evaluate
+) {
+    switch (scheme) {
+    case Scheme::Euler:
+        evaluate(nullptr);
+        kick(bodies, accelerations, static_cast<float>(dt));
+        drift(bodies, static_cast<float>(dt));
+        _has_accelerations = false;
+        break;
+
+    case Scheme::Leapfrog:
+        leapfrog(bodies, accelerations, dt, evaluate);
+        break;
+
+    case Scheme::Yoshida: {
+        // w1 + w0 + w1 = 1 and w0 < 0, the middle step goes back in time
+        const double cbrt2 = std::cbrt(2.0);
+        const double w1 = 1.0 / (2.0 - cbrt2);
+        const double w0 = -cbrt2 / (2.0 - cbrt2);
+        leapfrog(bodies, accelerations, w1 * dt, evaluate);
+        leapfrog(bodies, accelerations, w0 * dt, evaluate);
+        leapfrog(bodies, accelerations, w1 * dt, evaluate);
+        break;
+    }
+
+    case Scheme::Block:
+        block(bodies, accelerations, dt, evaluate);
+        break;
+
+    case Scheme::WisdomHolman:
+        wisdom_holman(bodies, accelerations, dt, evaluate);
+        break;
+    }
+}
+
+void Integrator::invalidate() {
+    _has_accelerations = false;
+}
+
+void Integrator::reset() {
+    _has_accelerations = false;
+    _dominant = SIZE_MAX;
+    _levels.clear();
+    _previous_accelerations.clear();
+}
+
+void Integrator::erase_removed(const BodyStore &bodies) {
+    if (_levels.size() != bodies.size())
+        return;
+
+    // Same order preserving compaction as BodyStore::compact()
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < bodies.size(); ++i) {
+        if (bodies.is_removed(i))
+            continue;
+
+        _levels[kept] = _levels[i];
+        _previous_accelerations[kept] = _previous_accelerations[i];
+        ++kept;
+    }
+    _levels.resize(kept);
+    _previous_accelerations.resize(kept);
+}
+
+void Integrator::reorder(const std::vector<std::uint32_t> &order) {
+    const std::size_t n = order.size();
+    if (_dominant != SIZE_MAX) {
+        // Index the dominant body moved to
+        for (std::size_t i = 0; i < n; ++i) {
+            if (order[i] == _dominant) {
+                _dominant = i;
+                break;
+            }
+        }
+    }
+    if (_levels.size() != n)
+        return;
+
+    std::vector<std::uint8_t> levels(n);
+    std::vector<glm::vec3> previous_accelerations(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        levels[i] = _levels[order[i]];
+        previous_accelerations[i] = _previous_accelerations[order[i]];
+    }
+    _levels.swap(levels);
+    _previous_accelerations.swap(previous_accelerations);
+}
+
+void Integrator::leapfrog(
+    BodyStore &bodies, std::vector<glm::vec3> &accelerations, double dt,
+    const Evaluate &evaluate
+) {
+    if (!_has_accelerations || accelerations.size() != bodies.size())
+        evaluate(nullptr);
+
+    const float half_dt = static_cast<float>(dt * 0.5);
+    kick(bodies, accelerations, half_dt);
+    drift(bodies, static_cast<float>(dt));
+    evaluate(nullptr);
+    kick(bodies, accelerations, half_dt);
+    _has_accelerations = true;
+}
+
+void Integrator::block(
+    BodyStore &bodies, std::vector<glm::vec3> &accelerations, double dt,
+    const Evaluate &evaluate
+) {
+    const std::size_t n = bodies.size();
+    const std::uint32_t levels = std::min<std::uint32_t>(block_levels, 31);
+    if (!_has_accelerations || accelerations.size() != n) {
+        evaluate(nullptr);
+        // Without a previous acceleration bodies start on the smallest step
+        // and climb as soon as their derivative is known
+        if (_levels.size() != n) {
+            _levels.assign(n, levels);
+            _previous_accelerations = accelerations;
+        }
+    }
+    _active.resize(n);
+
+    // Time is counted in ticks of the smallest step, every body is at the
+    // start of its step on tick 0
+    const std::uint32_t ticks = 1u << levels;
+    const double tick_dt = dt / ticks;
+    std::vector<glm::vec3> &velocities = bodies.velocities();
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < n; ++i) {
+        _levels[i] = std::min<std::uint8_t>(_levels[i], levels);
+        const double step = dt / (1u << _levels[i]);
+        velocities[i] += accelerations[i] * static_cast<float>(0.5 * step);
+    }
+
+    std::uint32_t tick = 0;
+    while (tick < ticks) {
+        std::uint8_t finest = 0;
+#pragma omp parallel for schedule(static) reduction(max : finest)
+        for (std::size_t i = 0; i < n; ++i) {
+            finest = std::max(finest, _levels[i]);
+        }
+        const std::uint32_t stride = ticks >> finest;
+        const std::uint32_t next = (tick / stride + 1) * stride;
+        drift(bodies, static_cast<float>((next - tick) * tick_dt));
+        tick = next;
+
+#pragma omp parallel for schedule(static)
+        for (std::size_t i = 0; i < n; ++i) {
+            _active[i] = tick % (ticks >> _levels[i]) == 0;
+        }
+        evaluate(&_active);
+
+#pragma omp parallel for schedule(static)
+        for (std::size_t i = 0; i < n; ++i) {
+            if (!_active[i])
+                continue;
+
+            const double step = dt / (1u << _levels[i]);
+            const float half_step = static_cast<float>(0.5 * step);
+            velocities[i] += accelerations[i] * half_step;
+            std::uint8_t level = block_level(
+                accelerations[i], _previous_accelerations[i], step, dt
+            );
+            // Larger steps have to start on one of their own ticks
+            while (level < _levels[i] && tick % (ticks >> level) != 0)
+                ++level;
+            _levels[i] = level;
+            _previous_accelerations[i] = accelerations[i];
+            if (tick < ticks) {
+                const double next_step = dt / (1u << level);
+                velocities[i]
+                    += accelerations[i] * static_cast<float>(0.5 * next_step);
+            }
+        }
+    }
+    _has_accelerations = true;
+}
+
+void Integrator::wisdom_holman(
+    BodyStore &bodies, std::vector<glm::vec3> &accelerations, double dt,
+    const Evaluate &evaluate
+) {
+    const std::size_t n = bodies.size();
+    const std::size_t c = dominant_body(bodies);
+    if (c == n) {
+        // The accelerations kept may be missing the former dominant body
+        if (_dominant != SIZE_MAX)
+            _has_accelerations = false;
+        _dominant = SIZE_MAX;
+        leapfrog(bodies, accelerations, dt, evaluate);
+        return;
+    }
+    if (!_has_accelerations || _dominant != c || accelerations.size() != n)
+        evaluate_without(bodies, c, evaluate);
+
+    std::vector<glm::vec3> &positions = bodies.positions();
+    std::vector<glm::vec3> &velocities = bodies.velocities();
+    const std::vector<float> &masses = bodies.masses();
+    double total = 0.0;
+    double px = 0.0, py = 0.0, pz = 0.0;
+    double wx = 0.0, wy = 0.0, wz = 0.0;
+#pragma omp parallel for schedule(static) \
+    reduction(+ : total, px, py, pz, wx, wy, wz)
+    for (std::size_t i = 0; i < n; ++i) {
+        const double m = masses[i];
+        total += m;
+        px += m * velocities[i].x;
+        py += m * velocities[i].y;
+        pz += m * velocities[i].z;
+        wx += m * positions[i].x;
+        wy += m * positions[i].y;
+        wz += m * positions[i].z;
+    }
+    const double dominant_mass = masses[c];
+    const double mu = G * dominant_mass;
+    const glm::dvec3 center_velocity = glm::dvec3{px, py, pz} / total;
+    const glm::dvec3 center = glm::dvec3{wx, wy, wz} / total;
+    const glm::dvec3 origin{positions[c]};
+    const double half_dt = 0.5 * dt;
+
+    // Half kick of the interactions, the dominant body is the origin of the
+    // positions and its velocity follows from the others
+    _heliocentric.resize(n);
+    _barycentric.resize(n);
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < n; ++i) {
+        if (i == c) {
+            _heliocentric[i] = glm::dvec3{0.0};
+            _barycentric[i] = glm::dvec3{0.0};
+            continue;
+        }
+        _heliocentric[i] = glm::dvec3{positions[i]} - origin;
+        _barycentric[i] = glm::dvec3{velocities[i]} - center_velocity
+                          + glm::dvec3{accelerations[i]} * half_dt;
+    }
+
+    // Drift of the momentum of the dominant body, Kepler, drift again
+    const auto momentum_drift = [&] {
+        double sx = 0.0, sy = 0.0, sz = 0.0;
+#pragma omp parallel for schedule(static) reduction(+ : sx, sy, sz)
+        for (std::size_t i = 0; i < n; ++i) {
+            const double m = masses[i];
+            sx += m * _barycentric[i].x;
+            sy += m * _barycentric[i].y;
+            sz += m * _barycentric[i].z;
+        }
+        const glm::dvec3 drift
+            = glm::dvec3{sx, sy, sz} * (half_dt / dominant_mass);
+#pragma omp parallel for schedule(static)
+        for (std::size_t i = 0; i < n; ++i) {
+            if (i != c)
+                _heliocentric[i] += drift;
+        }
+    };
+    momentum_drift();
+#pragma omp parallel for schedule(dynamic, 256)
+    for (std::size_t i = 0; i < n; ++i) {
+        if (i != c)
+            kepler_drift(_heliocentric[i], _barycentric[i], mu, dt);
+    }
+    momentum_drift();
+
+    // Back to positions, the barycenter moves in a straight line
+    double qx = 0.0, qy = 0.0, qz = 0.0;
+#pragma omp parallel for schedule(static) reduction(+ : qx, qy, qz)
+    for (std::size_t i = 0; i < n; ++i) {
+        const double m = masses[i];
+        qx += m * _heliocentric[i].x;
+        qy += m * _heliocentric[i].y;
+        qz += m * _heliocentric[i].z;
+    }
+    const glm::dvec3 new_origin
+        = center + center_velocity * dt - glm::dvec3{qx, qy, qz} / total;
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < n; ++i) {
+        positions[i] = glm::vec3{new_origin + _heliocentric[i]};
+    }
+
+    evaluate_without(bodies, c, evaluate);
+    double bx = 0.0, by = 0.0, bz = 0.0;
+#pragma omp parallel for schedule(static) reduction(+ : bx, by, bz)
+    for (std::size_t i = 0; i < n; ++i) {
+        if (i == c)
+            continue;
+
+        _barycentric[i] += glm::dvec3{accelerations[i]} * half_dt;
+        velocities[i] = glm::vec3{center_velocity + _barycentric[i]};
+        const double m = masses[i];
+        bx += m * _barycentric[i].x;
+        by += m * _barycentric[i].y;
+        bz += m * _barycentric[i].z;
+    }
+    velocities[c]
+        = glm::vec3{center_velocity - glm::dvec3{bx, by, bz} / dominant_mass};
+    _has_accelerations = true;
+}
+
+void Integrator::evaluate_without(
+    BodyStore &bodies, std::size_t dominant, const Evaluate &evaluate
+) {
+    const float mass = bodies.masses()[dominant];
+    bodies.set_mass(dominant, 0.0f);
+    evaluate(nullptr);
+    bodies.set_mass(dominant, mass);
+    _dominant = dominant;
+}
+
+std::uint8_t Integrator::block_level(
+    const glm::vec3 &acceleration, const glm::vec3 &previous, double elapsed,
+    double dt
+) const {
+    const std::uint32_t levels = std::min<std::uint32_t>(block_levels, 31);
+    const double change = glm::length(acceleration - previous);
+    if (change == 0.0)
+        return 0;
+
+    // dt / step with step = eta * |a| / |da/dt|
+    const double ratio
+        = dt * change / (elapsed * block_eta * glm::length(acceleration));
+    if (!(ratio < static_cast<double>(1u << levels)))
+        return levels;
+    if (ratio <= 1.0)
+        return 0;
+    return static_cast<std::uint8_t>(std::ceil(std::log2(ratio)));
+}
@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include "constants.hpp"
+#include "kd_tree.hpp"
+
+#define UNUSED(x) (void)(x)
+
+static_assert(
+    std::is_trivially_copyable<KdTree::Node>::value
+        && std::is_trivially_destructible<KdTree::Node>::value,
+    "KdTree::Node must stay POD so the arena can be reset in O(1)"
+);
+
+/**
+ * \brief Surface of the sphere around a box, up to a constant, the cost
+ * measure of SAH
+ * \param box_min - lower corner of the box
+ * \param box_max - upper corner of the box
+ * \returns squared diagonal of the box
+ *
+ * The opening test sees a node as a sphere of radius bmax, the surface of
+ * the box itself would favor thin slabs that are opened from far away
+ **/
+static float
+sphere_surface(const glm::vec3 &box_min, const glm::vec3 &box_max) {
+    const glm::vec3 e = box_max - box_min;
+    return glm::dot(e, e);
+}
+
+bool KdTree::Node::is_leaf() const {
+    return first_child == null_index;
+}
+
+double KdTree::theta = 1.0;
+
+KdTree::KdTree() {
+}
+
+KdTree::KdTree(const BodyStore &bodies) :
+  _bodies{&bodies} {
+}
+
+void KdTree::clear(const BodyStore &bodies) {
+    _bodies = &bodies;
+    _nodes.clear();
+    _body_indices.clear();
+}
+
+void KdTree::insert(std::uint32_t body) {
+    if (_bodies->is_removed(body))
+        return;
+
+    _body_indices.push_back(body);
+}
+
+void KdTree::build() {
+    _nodes.clear();
+    const std::uint32_t n = _body_indices.size();
+    if (n == 0)
+        return;
+
+    _nodes.push_back(Node{});
+    build_node(0, 0, n, 0, null_index);
+
+    const std::vector<glm::vec3> &positions = _bodies->positions();
+    const std::vector<float> &masses = _bodies->masses();
+    _x.resize(n);
+    _y.resize(n);
+    _z.resize(n);
+    _mass.resize(n);
+    for (std::uint32_t i = 0; i < n; ++i) {
+        const std::uint32_t b = _body_indices[i];
+        _x[i] = positions[b].x;
+        _y[i] = positions[b].y;
+        _z[i] = positions[b].z;
+        _mass[i] = masses[b];
+    }
+}
+
+void KdTree::build_node(
+    std::uint32_t node, std::uint32_t begin, std::uint32_t end,
+    std::uint32_t depth, std::uint32_t next
+) {
+    Node &n = _nodes[node];
+    n.first_body = begin;
+    n.body_count = end - begin;
+    n.first_child = null_index;
+    n.next = next;
+    compute_moments(node);
+
+    // Bodies on the same position can't be split
+    if (end - begin <= leaf_size || n.box_min == n.box_max)
+        return;
+
+    const std::uint32_t middle = partition(node, depth);
+    // Pushing the children moves the nodes, n is not used after this
+    const std::uint32_t first_child = _nodes.size();
+    _nodes[node].first_child = first_child;
+    _nodes.resize(first_child + 2);
+    build_node(first_child, begin, middle, depth + 1, first_child + 1);
+    build_node(first_child + 1, middle, end, depth + 1, next);
+}
+
+void KdTree::compute_moments(std::uint32_t node) {
+    const std::vector<glm::vec3> &positions = _bodies->positions();
+    const std::vector<float> &masses = _bodies->masses();
+    Node &n = _nodes[node];
+    glm::vec3 weighted_pos{0.0f, 0.0f, 0.0f};
+    float total_mass = 0.0f;
+    glm::vec3 box_min{std::numeric_limits<float>::max()};
+    glm::vec3 box_max{std::numeric_limits<float>::lowest()};
+    for (std::uint32_t i = 0; i < n.body_count; ++i) {
+        const std::uint32_t b = _body_indices[n.first_body + i];
+        weighted_pos += positions[b] * masses[b];
+        total_mass += masses[b];
+        box_min = glm::min(box_min, positions[b]);
+        box_max = glm::max(box_max, positions[b]);
+    }
+    n.total_mass = total_mass;
+    n.center_of_mass = total_mass > 0.0f ? weighted_pos / total_mass
+                                         : (box_min + box_max) * 0.5f;
+    n.box_min = box_min;
+    n.box_max = box_max;
+    n.bmax = bmax_of(n.center_of_mass, box_min, box_max);
+}
+
+std::uint32_t KdTree::partition(std::uint32_t node, std::uint32_t depth) {
+    const Node &n = _nodes[node];
+    if (split == Split::SAH && depth < KD_MAX_SAH_DEPTH) {
+        const std::uint32_t middle = partition_sah(node);
+        if (middle != n.first_body + n.body_count)
+            return middle;
+    }
+
+    const glm::vec3 extent = n.box_max - n.box_min;
+    int axis = 0;
+    if (extent.y > extent[axis])
+        axis = 1;
+    if (extent.z > extent[axis])
+        axis = 2;
+    return partition_median(node, axis);
+}
+
+std::uint32_t KdTree::partition_median(std::uint32_t node, int axis) {
+    const std::vector<glm::vec3> &positions = _bodies->positions();
+    const Node &n = _nodes[node];
+    const auto first = _body_indices.begin() + n.first_body;
+    const auto last = first + n.body_count;
+    const auto middle = first + n.body_count / 2;
+    std::nth_element(
+        first, middle, last,
+        [&](std::uint32_t a, std::uint32_t b) {
+            return positions[a][axis] < positions[b][axis];
+        }
+    );
+    return static_cast<std::uint32_t>(middle - _body_indices.begin());
+}
+
+std::uint32_t KdTree::partition_sah(std::uint32_t node) {
+    const std::vector<glm::vec3> &positions = _bodies->positions();
+    const Node &n = _nodes[node];
+    const std::uint32_t begin = n.first_body;
+    const std::uint32_t end = begin + n.body_count;
+    const glm::vec3 box_min = n.box_min;
+    const glm::vec3 extent = n.box_max - n.box_min;
+    auto bin_of = [&](std::uint32_t b, int axis) {
+        const float t = (positions[b][axis] - box_min[axis]) * KD_SAH_BINS
+                        / extent[axis];
+        return std::min(static_cast<int>(t), KD_SAH_BINS - 1);
+    };
+
+    float best_cost = std::numeric_limits<float>::max();
+    int best_axis = -1;
+    int best_bin = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (extent[axis] <= 0.0f)
+            continue;
+
+        std::uint32_t counts[KD_SAH_BINS] = {};
+        glm::vec3 bin_min[KD_SAH_BINS];
+        glm::vec3 bin_max[KD_SAH_BINS];
+        std::fill_n(bin_min, KD_SAH_BINS, n.box_max);
+        std::fill_n(bin_max, KD_SAH_BINS, n.box_min);
+        for (std::uint32_t i = begin; i < end; ++i) {
+            const std::uint32_t b = _body_indices[i];
+            const int bin = bin_of(b, axis);
+            ++counts[bin];
+            bin_min[bin] = glm::min(bin_min[bin], positions[b]);
+            bin_max[bin] = glm::max(bin_max[bin], positions[b]);
+        }
+
+        // Costs of the bins right of each plane, then the left sweep
+        float right_cost[KD_SAH_BINS];
+        glm::vec3 side_min = n.box_max;
+        glm::vec3 side_max = n.box_min;
+        std::uint32_t side_count = 0;
+        for (int bin = KD_SAH_BINS - 1; bin > 0; --bin) {
+            if (counts[bin] > 0) {
+                side_min = glm::min(side_min, bin_min[bin]);
+                side_max = glm::max(side_max, bin_max[bin]);
+                side_count += counts[bin];
+            }
+            right_cost[bin] = side_count > 0
+                                  ? sphere_surface(side_min, side_max)
+                                        * static_cast<float>(side_count)
+                                  : -1.0f;
+        }
+        side_min = n.box_max;
+        side_max = n.box_min;
+        side_count = 0;
+        for (int bin = 1; bin < KD_SAH_BINS; ++bin) {
+            if (counts[bin - 1] > 0) {
+                side_min = glm::min(side_min, bin_min[bin - 1]);
+                side_max = glm::max(side_max, bin_max[bin - 1]);
+                side_count += counts[bin - 1];
+            }
+            if (side_count == 0 || right_cost[bin] < 0.0f)
+                continue;
+
+            const float cost = sphere_surface(side_min, side_max)
+                                   * static_cast<float>(side_count)
+                               + right_cost[bin];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = bin;
+            }
+        }
+    }
+    if (best_axis < 0)
+        return end;
+
+    const auto middle = std::partition(
+        _body_indices.begin() + begin, _body_indices.begin() + end,
+        [&](std::uint32_t b) { return bin_of(b, best_axis) < best_bin; }
+    );
+    return static_cast<std::uint32_t>(middle - _body_indices.begin());
+}
+
+glm::vec3
+KdTree::net_acceleration_on_body(std::uint32_t body, double dt) const {
+    UNUSED(dt);
+    return with_flag(softening > 0.0f, [&](auto softened) {
+        return net_acceleration_on_body<
+            Precision::Float, decltype(softened)::value>(body);
+    });
+}
+
+template <Precision precision, bool softened>
+glm::vec3 KdTree::net_acceleration_on_body(std::uint32_t body) const {
+    using Scalar = typename PrecisionTypes<precision>::Scalar;
+    using Accumulator = typename PrecisionTypes<precision>::Accumulator;
+    using Vector = glm::vec<3, Scalar>;
+    using Sum = glm::vec<3, Accumulator>;
+
+    if (_nodes.empty() || _bodies->is_removed(body))
+        return glm::vec3{0.0f, 0.0f, 0.0f};
+
+    const glm::vec3 &pos = _bodies->positions()[body];
+    const Scalar opening = static_cast<Scalar>(theta)
+                           * static_cast<Scalar>(OPENING_BMAX_SCALE);
+    const float softening2 = softened ? softening * softening : 0.0f;
+    Sum net_acceleration{0, 0, 0};
+
+    // Depth-first walk without a stack like LinearOcTree. Leafs sum their
+    // bodies directly, the body itself is at distance zero and adds nothing
+    const Node *nodes = _nodes.data();
+    std::uint32_t node = 0;
+    while (node != null_index) {
+        const Node &n = nodes[node];
+        if (n.total_mass == 0.0f) {
+            node = n.next;
+            continue;
+        }
+
+        const bool is_leaf = n.is_leaf();
+        if (!is_leaf || n.body_count > 1) {
+            const Vector offset = Vector{n.center_of_mass} - Vector{pos};
+            const Scalar r = std::sqrt(glm::dot(offset, offset));
+            if (static_cast<Scalar>(n.bmax) < opening * r
+                && are_boxes_apart(pos, pos, n.box_min, n.box_max)) {
+                const Scalar gravitational_acceleration
+                    = static_cast<Scalar>(G)
+                      * static_cast<Scalar>(n.total_mass) / (r * r * r);
+                net_acceleration += Sum{offset * gravitational_acceleration};
+                node = n.next;
+                continue;
+            }
+        }
+
+        if (is_leaf) {
+            const std::uint32_t first = n.first_body;
+            net_acceleration += Sum{direct_sum_as<Scalar, Accumulator>(
+                                    &_x[first], &_y[first], &_z[first],
+                                    &_mass[first], n.body_count, pos, softening2
+                                )}
+                                * static_cast<Accumulator>(G);
+            node = n.next;
+        }
+        else {
+            node = n.first_child;
+        }
+    }
+    return glm::vec3{net_acceleration};
+}
+
+template glm::vec3
+KdTree::net_acceleration_on_body<Precision::Float, false>(std::uint32_t body
+) const;
+template glm::vec3
+KdTree::net_acceleration_on_body<Precision::Float, true>(std::uint32_t body
+) const;
+template glm::vec3
+KdTree::net_acceleration_on_body<Precision::Mixed, false>(std::uint32_t body
+) const;
+template glm::vec3
+KdTree::net_acceleration_on_body<Precision::Mixed, true>(std::uint32_t body
+) const;
+template glm::vec3
+KdTree::net_acceleration_on_body<Precision::Double, false>(std::uint32_t body
+) const;
+template glm::vec3
+KdTree::net_acceleration_on_body<Precision::Double, true>(std::uint32_t body
+) const;
+
+const std::vector<KdTree::Node> &KdTree::nodes() const {
+    return _nodes;
+}
+
+std::size_t KdTree::memory_usage() const {
+    return _nodes.size() * sizeof(Node)
+           + _body_indices.size() * (sizeof(std::uint32_t) + 4 * sizeof(float));
+}
@@ -0,0 +1,1474 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include <omp.h>
+
+#include <glm/fwd.hpp>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include "constants.hpp"
+#include "direct_sum.hpp"
+#include "linear_octree.hpp"
+#include "morton.hpp"
+
+/** Flags the leafs of a recorded list whose bodies are summed directly **/
+#define LIST_LEAF_BIT 0x80000000u
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(address) __builtin_prefetch(address)
+#else
+#define PREFETCH(address)
+#endif
+
+static_assert(
+    std::is_trivially_copyable<LinearOcTree::Node>::value
+        && std::is_trivially_destructible<LinearOcTree::Node>::value,
+    "LinearOcTree::Node must stay POD so the arena can be reset in O(1)"
+);
+
+/**
+ * \brief Gets the octant of a position inside a cube
+ * \param pos - position
+ * \param mid - center of the cube
+ * \returns octant index, bit 2 is x, bit 1 is y and bit 0 is z
+ *
+ * A position on the center goes to the upper half like its Morton key, so
+ * refits of a Morton build place the bodies of flat systems as the build.
+ **/
+static inline std::uint32_t octant(const glm::vec3 &pos, const glm::vec3 &mid) {
+    return (static_cast<std::uint32_t>(pos.x >= mid.x) << 2)
+           | (static_cast<std::uint32_t>(pos.y >= mid.y) << 1)
+           | static_cast<std::uint32_t>(pos.z >= mid.z);
+}
+
+/**
+ * \brief Sets the cubes of a block of eight empty children
+ * \param children - first child of the block
+ * \param cube_start - 3D point where the parent cube starts
+ * \param new_width - width of the children cubes
+ **/
+static inline void init_children(
+    LinearOcTree::Node *children, const glm::vec3 &cube_start, float new_width
+) {
+    for (std::uint32_t k = 0; k < 8; ++k) {
+        LinearOcTree::Node &child = children[k];
+        child.cube_start = glm::vec3{
+            cube_start.x + ((k >> 2) & 1) * new_width,
+            cube_start.y + ((k >> 1) & 1) * new_width,
+            cube_start.z + (k & 1) * new_width
+        };
+        child.width = new_width;
+        child.center_of_mass = child.cube_start + new_width * 0.5f;
+        child.total_mass = 0.0f;
+        child.first_child = LinearOcTree::null_index;
+        child.body_count = 0;
+    }
+}
+
+/**
+ * \brief Calls a function with an expansion as a compile-time constant
+ * \param multipole - expansion
+ * \param function - called with std::integral_constant<Multipole, ...>
+ * \returns what the function returns
+ **/
+template <typename Function>
+static auto
+with_expansion(LinearOcTree::Multipole multipole, Function &&function) {
+    using Multipole = LinearOcTree::Multipole;
+    switch (multipole) {
+    case Multipole::Quadrupole:
+        return function(
+            std::integral_constant<Multipole, Multipole::Quadrupole>{}
+        );
+    case Multipole::Octupole:
+        return function(
+            std::integral_constant<Multipole, Multipole::Octupole>{}
+        );
+    default:
+        return function(
+            std::integral_constant<Multipole, Multipole::Monopole>{}
+        );
+    }
+}
+
+/**
+ * \brief Adds the acceleration of the quadrupole and octupole terms of a
+ * node, over G
+ * \tparam octupole - include the octupole term
+ * \param x - x of the position minus the center of mass of the node
+ * \param y - y of the position minus the center of mass of the node
+ * \param z - z of the position minus the center of mass of the node
+ * \param second - raw second moments, see LinearOcTree::Multipoles
+ * \param third - raw third moments, see LinearOcTree::Multipoles
+ * \param stride - distance between two components of the moments
+ * \param ax - x of the acceleration to add to
+ * \param ay - y of the acceleration to add to
+ * \param az - z of the acceleration to add to
+ *
+ * Terms of the traceless moments written with the raw ones. Takes and gives
+ * scalars, OpenMP privatizes vectors passed by reference inside simd loops
+ * and that keeps them from vectorizing
+ **/
+template <bool octupole>
+static inline void add_multipole_term(
+    float x, float y, float z, const float *second, const float *third,
+    std::size_t stride, float &ax, float &ay, float &az
+) {
+    const float sxx = second[0];
+    const float sxy = second[stride];
+    const float sxz = second[2 * stride];
+    const float syy = second[3 * stride];
+    const float syz = second[4 * stride];
+    const float szz = second[5 * stride];
+
+    const glm::vec3 offset{x, y, z};
+    const float r2 = x * x + y * y + z * z;
+    const float inv_r2 = 1.0f / r2;
+    const float inv_r = std::sqrt(inv_r2);
+    const float inv_r5 = inv_r * inv_r2 * inv_r2;
+
+    const glm::vec3 sr{
+        sxx * x + sxy * y + sxz * z, sxy * x + syy * y + syz * z,
+        sxz * x + syz * y + szz * z
+    };
+    const float trace = sxx + syy + szz;
+    const float q = 3.0f * glm::dot(offset, sr) - trace * r2;
+    glm::vec3 acceleration
+        = (3.0f * sr - trace * offset - 2.5f * q * inv_r2 * offset) * inv_r5;
+
+    if (octupole) {
+        const float txxx = third[0];
+        const float txxy = third[stride];
+        const float txxz = third[2 * stride];
+        const float txyy = third[3 * stride];
+        const float txyz = third[4 * stride];
+        const float txzz = third[5 * stride];
+        const float tyyy = third[6 * stride];
+        const float tyyz = third[7 * stride];
+        const float tyzz = third[8 * stride];
+        const float tzzz = third[9 * stride];
+
+        const glm::vec3 trr{
+            txxx * x * x + txyy * y * y + txzz * z * z
+                + 2.0f * (txxy * x * y + txxz * x * z + txyz * y * z),
+            txxy * x * x + tyyy * y * y + tyzz * z * z
+                + 2.0f * (txyy * x * y + txyz * x * z + tyyz * y * z),
+            txxz * x * x + tyyz * y * y + tzzz * z * z
+                + 2.0f * (txyz * x * y + txzz * x * z + tyzz * y * z)
+        };
+        const glm::vec3 traces{
+            txxx + txyy + txzz, txxy + tyyy + tyzz, txxz + tyyz + tzzz
+        };
+        const float trace_r = glm::dot(traces, offset);
+        const float o = 15.0f * glm::dot(trr, offset) - 9.0f * trace_r * r2;
+        const glm::vec3 v
+            = 15.0f * trr - 3.0f * (traces * r2 + 2.0f * trace_r * offset);
+        const float inv_r7 = inv_r5 * inv_r2;
+        acceleration
+            += (0.5f * v - (7.0f / 6.0f) * o * inv_r2 * offset) * inv_r7;
+    }
+    ax += acceleration.x;
+    ay += acceleration.y;
+    az += acceleration.z;
+}
+
+/**
+ * \brief Sums the higher moments of a list of nodes on a position
+ * \tparam octupole - include the octupole term
+ * \param columns - centers of mass and moments, one column per component
+ * \param count - amount of nodes
+ * \param pos - position
+ * \returns acceleration on top of the monopoles, divided by G
+ **/
+template <bool octupole>
+static glm::vec3 sum_multipole_terms(
+    const float *columns, std::size_t count, const glm::vec3 &pos
+) {
+    const float px = pos.x;
+    const float py = pos.y;
+    const float pz = pos.z;
+    float ax = 0.0f;
+    float ay = 0.0f;
+    float az = 0.0f;
+#pragma omp simd reduction(+ : ax, ay, az)
+    for (std::size_t j = 0; j < count; ++j) {
+        add_multipole_term<octupole>(
+            px - columns[j], py - columns[count + j],
+            pz - columns[2 * count + j], columns + 3 * count + j,
+            columns + 9 * count + j, count, ax, ay, az
+        );
+    }
+    return glm::vec3{ax, ay, az};
+}
+
+// ---- LINEAR OCTREE NODE ----
+
+bool LinearOcTree::Node::is_leaf() const {
+    return first_child == null_index;
+}
+
+// ---- LINEAR OCTREE ----
+
+double LinearOcTree::theta = 1.0;
+Opening LinearOcTree::opening = Opening::Bmax;
+
+LinearOcTree::LinearOcTree() {
+}
+
+LinearOcTree::LinearOcTree(float initial_coord) {
+    if (initial_coord == 0)
+        return;
+    else if (initial_coord > 0)
+        initial_coord = -initial_coord;
+
+    initial_cube_start = glm::vec3{initial_coord, initial_coord, initial_coord};
+    initial_width = std::abs(2 * initial_coord);
+}
+
+LinearOcTree::LinearOcTree(const glm::vec3 &cube_start, float width) :
+  initial_cube_start{cube_start},
+  initial_width{width} {
+}
+
+void LinearOcTree::clear() {
+    _nodes.clear();
+    _body_indices.clear();
+}
+
+void LinearOcTree::compute_multipoles() {
+    if (_multipole == Multipole::Monopole)
+        return;
+
+    // Distinct components of the symmetric second and third moments
+    static const int second_axes[6][2]
+        = {{0, 0}, {0, 1}, {0, 2}, {1, 1}, {1, 2}, {2, 2}};
+    static const int third_axes[10][3]
+        = {{0, 0, 0}, {0, 0, 1}, {0, 0, 2}, {0, 1, 1}, {0, 1, 2},
+           {0, 2, 2}, {1, 1, 1}, {1, 1, 2}, {1, 2, 2}, {2, 2, 2}};
+    // Component of the second moment for each pair of axes
+    static const int second_index[3][3] = {{0, 1, 2}, {1, 3, 4}, {2, 4, 5}};
+
+    const std::uint32_t count = _nodes.size();
+    _multipoles.resize(count);
+
+#pragma omp parallel for schedule(static)
+    for (std::uint32_t i = 0; i < count; ++i) {
+        const Node &n = _nodes[i];
+        if (!n.is_leaf())
+            continue;
+
+        Multipoles &m = _multipoles[i];
+        m = Multipoles{};
+        for (std::uint32_t b = 0; b < n.body_count; ++b) {
+            const std::uint32_t body = _body_indices[n.first_body + b];
+            const glm::vec3 x = _positions[body] - n.center_of_mass;
+            const float mass = _masses[body];
+            for (int c = 0; c < 6; ++c)
+                m.second[c]
+                    += mass * x[second_axes[c][0]] * x[second_axes[c][1]];
+            for (int c = 0; c < 10; ++c)
+                m.third[c] += mass * x[third_axes[c][0]]
+                              * x[third_axes[c][1]] * x[third_axes[c][2]];
+        }
+    }
+
+    // Parallel axis theorem, children come after their parent so a reverse
+    // sweep shifts children before parents use them
+    for (std::uint32_t i = count; i-- > 0;) {
+        const Node &n = _nodes[i];
+        if (n.is_leaf())
+            continue;
+
+        Multipoles &m = _multipoles[i];
+        m = Multipoles{};
+        for (std::uint32_t k = 0; k < 8; ++k) {
+            const Node &child = _nodes[n.first_child + k];
+            if (child.total_mass == 0.0f)
+                continue;
+
+            const Multipoles &cm = _multipoles[n.first_child + k];
+            const glm::vec3 d = child.center_of_mass - n.center_of_mass;
+            const float mass = child.total_mass;
+            for (int c = 0; c < 6; ++c) {
+                const int a = second_axes[c][0];
+                const int b = second_axes[c][1];
+                m.second[c] += cm.second[c] + mass * d[a] * d[b];
+            }
+            for (int c = 0; c < 10; ++c) {
+                const int a = third_axes[c][0];
+                const int b = third_axes[c][1];
+                const int e = third_axes[c][2];
+                m.third[c] += cm.third[c]
+                              + cm.second[second_index[a][b]] * d[e]
+                              + cm.second[second_index[a][e]] * d[b]
+                              + cm.second[second_index[b][e]] * d[a]
+                              + mass * d[a] * d[b] * d[e];
+            }
+        }
+    }
+}
+
+template <LinearOcTree::Multipole expansion>
+glm::vec3 LinearOcTree::multipole_acceleration(
+    std::uint32_t node, const glm::vec3 &offset
+) const {
+    const Multipoles &m = _multipoles[node];
+    float ax = 0.0f;
+    float ay = 0.0f;
+    float az = 0.0f;
+    add_multipole_term<expansion == Multipole::Octupole>(
+        offset.x, offset.y, offset.z, m.second, m.third, 1, ax, ay, az
+    );
+    return glm::vec3{ax, ay, az} * static_cast<float>(G);
+}
+
+void LinearOcTree::start_build(
+    const std::vector<glm::vec3> &positions, const std::vector<float> &masses
+) {
+    clear();
+    _positions = positions.data();
+    _masses = masses.data();
+    _body_count = positions.size();
+    _refit_ready = false;
+    _refits = 0;
+    _multipole = multipole;
+    _lists_stale = true;
+}
+
+void LinearOcTree::build(
+    const std::vector<glm::vec3> &positions, const std::vector<float> &masses
+) {
+    start_build(positions, masses);
+
+    const glm::vec3 cube_end = initial_cube_start + initial_width;
+    for (std::uint32_t i = 0; i < positions.size(); ++i) {
+        const glm::vec3 &p = positions[i];
+        bool is_inside = p.x >= initial_cube_start.x
+                         && p.y >= initial_cube_start.y
+                         && p.z >= initial_cube_start.z && p.x <= cube_end.x
+                         && p.y <= cube_end.y && p.z <= cube_end.z;
+        if (is_inside)
+            _body_indices.push_back(i);
+    }
+
+    if (_body_indices.empty())
+        return;
+
+    _scratch.resize(_body_indices.size());
+    Node root{};
+    root.cube_start = initial_cube_start;
+    root.width = initial_width;
+    _nodes.push_back(root);
+    build_node(0, 0, _body_indices.size(), 0);
+    link_nodes();
+    compute_multipoles();
+}
+
+void LinearOcTree::build_node(
+    std::uint32_t node, std::uint32_t begin, std::uint32_t end,
+    std::uint32_t depth
+) {
+    // _nodes may grow during the recursion, so nodes are always accessed by
+    // index and never kept by reference across build_node() calls
+    if (end - begin <= bucket_size || depth >= max_depth) {
+        Node &leaf = _nodes[node];
+        leaf.first_child = null_index;
+        leaf.first_body = begin;
+        leaf.body_count = end - begin;
+        compute_moments(node);
+        return;
+    }
+
+    const glm::vec3 cube_start = _nodes[node].cube_start;
+    const float new_width = _nodes[node].width * 0.5f;
+    const glm::vec3 mid = cube_start + new_width;
+
+    // Counting sort of the body indices by octant
+    std::uint32_t offsets[9] = {0};
+    for (std::uint32_t i = begin; i < end; ++i)
+        ++offsets[octant(_positions[_body_indices[i]], mid) + 1];
+    for (int k = 0; k < 8; ++k)
+        offsets[k + 1] += offsets[k];
+
+    std::uint32_t cursor[8];
+    for (int k = 0; k < 8; ++k)
+        cursor[k] = begin + offsets[k];
+    for (std::uint32_t i = begin; i < end; ++i) {
+        std::uint32_t b = _body_indices[i];
+        _scratch[cursor[octant(_positions[b], mid)]++] = b;
+    }
+    std::copy(
+        _scratch.begin() + begin, _scratch.begin() + end,
+        _body_indices.begin() + begin
+    );
+
+    const std::uint32_t first_child = _nodes.size();
+    _nodes[node].first_child = first_child;
+    _nodes[node].body_count = 0;
+    _nodes.resize(_nodes.size() + 8);
+    init_children(&_nodes[first_child], cube_start, new_width);
+    for (std::uint32_t k = 0; k < 8; ++k)
+        _nodes[first_child + k].first_body = begin + offsets[k];
+
+    for (std::uint32_t k = 0; k < 8; ++k) {
+        std::uint32_t child_begin = begin + offsets[k];
+        std::uint32_t child_end = begin + offsets[k + 1];
+        if (child_begin != child_end)
+            build_node(first_child + k, child_begin, child_end, depth + 1);
+    }
+
+    compute_moments(node);
+}
+
+void LinearOcTree::compute_moments(std::uint32_t node) {
+    Node &n = _nodes[node];
+    glm::vec3 weighted_pos{0.0f, 0.0f, 0.0f};
+    float total_mass = 0.0f;
+    glm::vec3 box_min{std::numeric_limits<float>::max()};
+    glm::vec3 box_max{std::numeric_limits<float>::lowest()};
+    if (n.is_leaf()) {
+        if (n.body_count == 0) {
+            n.total_mass = 0.0f;
+            n.center_of_mass = n.cube_start + n.width * 0.5f;
+            n.box_min = n.center_of_mass;
+            n.box_max = n.center_of_mass;
+            n.bmax = 0.0f;
+            return;
+        }
+
+        for (std::uint32_t i = 0; i < n.body_count; ++i) {
+            std::uint32_t b = _body_indices[n.first_body + i];
+            weighted_pos += _positions[b] * _masses[b];
+            total_mass += _masses[b];
+            box_min = glm::min(box_min, _positions[b]);
+            box_max = glm::max(box_max, _positions[b]);
+        }
+        n.total_mass = total_mass;
+        n.center_of_mass = total_mass > 0.0f
+                               ? weighted_pos / total_mass
+                               : _positions[_body_indices[n.first_body]];
+        n.box_min = box_min;
+        n.box_max = box_max;
+        n.bmax = opening_size(
+            opening, n.center_of_mass, box_min, box_max, n.width
+        );
+        return;
+    }
+
+    std::uint32_t body_count = 0;
+    for (std::uint32_t k = 0; k < 8; ++k) {
+        const Node &child = _nodes[n.first_child + k];
+        weighted_pos += child.center_of_mass * child.total_mass;
+        total_mass += child.total_mass;
+        body_count += child.body_count;
+        if (child.body_count > 0) {
+            box_min = glm::min(box_min, child.box_min);
+            box_max = glm::max(box_max, child.box_max);
+        }
+    }
+    n.body_count = body_count;
+    n.total_mass = total_mass;
+    n.center_of_mass = total_mass > 0.0f ? weighted_pos / total_mass
+                                         : n.cube_start + n.width * 0.5f;
+    if (body_count == 0) {
+        // A refit can leave a subtree without bodies
+        box_min = n.center_of_mass;
+        box_max = n.center_of_mass;
+    }
+    n.box_min = box_min;
+    n.box_max = box_max;
+    n.bmax
+        = opening_size(opening, n.center_of_mass, box_min, box_max, n.width);
+}
+
+void LinearOcTree::build_morton(
+    const std::vector<glm::vec3> &positions, const std::vector<float> &masses
+) {
+    start_build(positions, masses);
+
+    const std::uint32_t n = positions.size();
+    const glm::vec3 cube_start = initial_cube_start;
+    _keys.resize(n);
+    _body_indices.resize(n);
+#pragma omp parallel for schedule(static)
+    for (std::uint32_t i = 0; i < n; ++i) {
+        _keys[i] = morton_key(positions[i], cube_start, initial_width);
+        _body_indices[i] = i;
+    }
+
+    radix_sort(_keys, _body_indices, _key_scratch, _scratch);
+
+    // Bodies outside of the root cube got the largest key, drop them
+    const std::uint32_t count
+        = std::lower_bound(_keys.begin(), _keys.end(), MORTON_INVALID_KEY)
+          - _keys.begin();
+    _keys.resize(count);
+    _body_indices.resize(count);
+    if (count == 0)
+        return;
+
+    // The top of the tree is split into enough subtrees to keep every thread
+    // busy, each subtree is then emitted on its own
+    const std::uint32_t wanted_subtrees = 4 * omp_get_max_threads();
+    std::uint32_t split_depth = 0;
+    std::uint32_t top_size = 0;
+    do {
+        ++split_depth;
+        _subtrees.clear();
+        top_size = collect_morton_subtrees(0, count, 0, split_depth);
+    } while (_subtrees.size() < wanted_subtrees && split_depth < 4
+             && !is_morton_leaf(0, count, 0));
+
+#pragma omp parallel for schedule(dynamic)
+    for (std::size_t s = 0; s < _subtrees.size(); ++s) {
+        MortonSubtree &subtree = _subtrees[s];
+        subtree.size
+            = count_morton_nodes(subtree.begin, subtree.end, subtree.depth);
+    }
+
+    std::uint32_t total = 1 + top_size;
+    for (auto &subtree : _subtrees)
+        total += subtree.size;
+    _nodes.resize(total);
+
+    Node &root = _nodes[0];
+    root.cube_start = cube_start;
+    root.width = initial_width;
+    root.first_body = 0;
+    root.body_count = 0;
+    _top_nodes.clear();
+    _reserved_subtrees = 0;
+    emit_morton_node(0, 0, count, 0, 1, split_depth);
+
+#pragma omp parallel for schedule(dynamic)
+    for (std::size_t s = 0; s < _subtrees.size(); ++s) {
+        const MortonSubtree &subtree = _subtrees[s];
+        emit_morton_node(
+            subtree.node, subtree.begin, subtree.end, subtree.depth,
+            subtree.first_child, 0
+        );
+
+        // Blocks of children always come after their parent, so a reverse
+        // sweep fills children before parents
+        for (std::uint32_t i = subtree.first_child + subtree.size;
+             i-- > subtree.first_child;)
+            compute_moments(i);
+        compute_moments(subtree.node);
+    }
+
+    for (auto it = _top_nodes.rbegin(); it != _top_nodes.rend(); ++it) {
+        const std::uint32_t first_child = _nodes[*it].first_child;
+        for (std::uint32_t k = 0; k < 8; ++k) {
+            if (_nodes[first_child + k].is_leaf())
+                compute_moments(first_child + k);
+        }
+        compute_moments(*it);
+    }
+    if (_nodes[0].is_leaf())
+        compute_moments(0);
+    link_nodes();
+    compute_multipoles();
+}
+
+bool LinearOcTree::is_morton_leaf(
+    std::uint32_t begin, std::uint32_t end, std::uint32_t depth
+) const {
+    return end - begin <= bucket_size || depth >= MORTON_BITS_PER_AXIS
+           || depth >= max_depth;
+}
+
+void LinearOcTree::morton_child_bounds(
+    std::uint32_t begin, std::uint32_t end, std::uint32_t depth,
+    std::uint32_t bounds[9]
+) const {
+    const std::uint32_t shift = 3 * (MORTON_BITS_PER_AXIS - 1 - depth);
+    const std::uint64_t prefix = (_keys[begin] >> shift) & ~std::uint64_t{7};
+
+    bounds[0] = begin;
+    bounds[8] = end;
+    for (std::uint32_t k = 1; k < 8; ++k) {
+        bounds[k] = std::lower_bound(
+                        _keys.begin() + bounds[k - 1], _keys.begin() + end,
+                        (prefix | k) << shift
+                    )
+                    - _keys.begin();
+    }
+}
+
+std::uint32_t LinearOcTree::collect_morton_subtrees(
+    std::uint32_t begin, std::uint32_t end, std::uint32_t depth,
+    std::uint32_t split_depth
+) {
+    if (is_morton_leaf(begin, end, depth))
+        return 0;
+    if (depth == split_depth) {
+        _subtrees.push_back({null_index, begin, end, depth, null_index, 0});
+        return 0;
+    }
+
+    std::uint32_t bounds[9];
+    morton_child_bounds(begin, end, depth, bounds);
+    std::uint32_t size = 8;
+    for (std::uint32_t k = 0; k < 8; ++k) {
+        if (bounds[k] != bounds[k + 1])
+            size += collect_morton_subtrees(
+                bounds[k], bounds[k + 1], depth + 1, split_depth
+            );
+    }
+    return size;
+}
+
+std::uint32_t LinearOcTree::count_morton_nodes(
+    std::uint32_t begin, std::uint32_t end, std::uint32_t depth
+) const {
+    if (is_morton_leaf(begin, end, depth))
+        return 0;
+
+    std::uint32_t bounds[9];
+    morton_child_bounds(begin, end, depth, bounds);
+    std::uint32_t size = 8;
+    for (std::uint32_t k = 0; k < 8; ++k) {
+        if (bounds[k] != bounds[k + 1])
+            size += count_morton_nodes(bounds[k], bounds[k + 1], depth + 1);
+    }
+    return size;
+}
+
+std::uint32_t LinearOcTree::emit_morton_node(
+    std::uint32_t node, std::uint32_t begin, std::uint32_t end,
+    std::uint32_t depth, std::uint32_t cursor, std::uint32_t split_depth
+) {
+    if (is_morton_leaf(begin, end, depth)) {
+        Node &leaf = _nodes[node];
+        leaf.first_child = null_index;
+        leaf.first_body = begin;
+        leaf.body_count = end - begin;
+        return cursor;
+    }
+
+    if (depth == split_depth) {
+        // Emitted later by its own thread, only reserve room for it. Subtrees
+        // are visited in the same order they were collected
+        MortonSubtree &subtree = _subtrees[_reserved_subtrees++];
+        subtree.node = node;
+        subtree.first_child = cursor;
+        return cursor + subtree.size;
+    }
+
+    if (split_depth != 0)
+        _top_nodes.push_back(node);
+
+    std::uint32_t bounds[9];
+    morton_child_bounds(begin, end, depth, bounds);
+
+    const std::uint32_t first_child = cursor;
+    Node &n = _nodes[node];
+    n.first_child = first_child;
+    n.body_count = 0;
+    init_children(&_nodes[first_child], n.cube_start, n.width * 0.5f);
+    for (std::uint32_t k = 0; k < 8; ++k)
+        _nodes[first_child + k].first_body = bounds[k];
+
+    cursor += 8;
+    for (std::uint32_t k = 0; k < 8; ++k) {
+        if (bounds[k] != bounds[k + 1])
+            cursor = emit_morton_node(
+                first_child + k, bounds[k], bounds[k + 1], depth + 1, cursor,
+                split_depth
+            );
+    }
+    return cursor;
+}
+
+bool LinearOcTree::refit(
+    const std::vector<glm::vec3> &positions, const std::vector<float> &masses
+) {
+    if (_nodes.empty() || positions.size() != _body_count
+        || (rebuild_interval > 0 && _refits >= rebuild_interval))
+        return false;
+    if (_nodes[0].cube_start != initial_cube_start
+        || _nodes[0].width != initial_width)
+        return false;
+    // Splitting leafs and the moments read the bodies through these
+    _positions = positions.data();
+    _masses = masses.data();
+
+    if (!_refit_ready) {
+        // The top of a Morton build is laid out breadth-first, the merges
+        // below need the leafs of each subtree next to each other
+        relayout_nodes();
+        link_nodes();
+        prepare_refit();
+        _built_nodes = _nodes.size();
+        _built_levels = _level_offsets.size();
+    }
+    // Split leafs of the earlier refits degraded the tree
+    if (_nodes.size() > max_node_growth * _built_nodes
+        || _level_offsets.size() > _built_levels + max_depth_growth)
+        return false;
+
+    const std::uint32_t n = positions.size();
+    _new_body_leaf.resize(n);
+    std::uint32_t migrated = 0;
+    bool is_tree_stale = false;
+#pragma omp parallel for schedule(static) reduction(+ : migrated) \
+    reduction(|| : is_tree_stale)
+    for (std::uint32_t i = 0; i < n; ++i) {
+        const glm::vec3 &p = positions[i];
+        const std::uint32_t leaf = _body_leaf[i];
+        if (leaf == null_index) {
+            // Bodies left out of the build are only seen again by a rebuild
+            is_tree_stale = true;
+            continue;
+        }
+
+        const Node &l = _nodes[leaf];
+        const glm::vec3 cube_end = l.cube_start + l.width;
+        bool is_inside = p.x >= l.cube_start.x && p.y >= l.cube_start.y
+                         && p.z >= l.cube_start.z && p.x <= cube_end.x
+                         && p.y <= cube_end.y && p.z <= cube_end.z;
+        if (is_inside) {
+            _new_body_leaf[i] = leaf;
+            continue;
+        }
+
+        const std::uint32_t new_leaf = find_leaf(p);
+        if (new_leaf == null_index)
+            is_tree_stale = true;
+        _new_body_leaf[i] = new_leaf;
+        ++migrated;
+    }
+
+    if (is_tree_stale)
+        return false;
+
+    if (migrated > 0) {
+        // Counting sort of the bodies by their new leaf
+        _node_scratch.assign(_nodes.size(), 0);
+        for (std::uint32_t i = 0; i < n; ++i) {
+            if (_new_body_leaf[i] != null_index)
+                ++_node_scratch[_new_body_leaf[i]];
+        }
+        std::uint32_t offset = 0;
+        for (auto leaf : _leaves) {
+            Node &l = _nodes[leaf];
+            l.first_body = offset;
+            l.body_count = _node_scratch[leaf];
+            _node_scratch[leaf] = offset;
+            offset += l.body_count;
+        }
+        for (std::uint32_t i = 0; i < _body_indices.size(); ++i) {
+            const std::uint32_t b = _body_indices[i];
+            _scratch[_node_scratch[_new_body_leaf[b]]++] = b;
+        }
+        std::copy(
+            _scratch.begin(), _scratch.begin() + _body_indices.size(),
+            _body_indices.begin()
+        );
+        _body_leaf.swap(_new_body_leaf);
+
+        // Subtrees left with few bodies are merged back into a leaf, their
+        // leafs are next to each other in the arena so are their bodies
+        bool is_merged = false;
+        for (std::size_t level = _level_offsets.size() - 1; level-- > 0;) {
+            for (std::uint32_t i = _level_offsets[level];
+                 i < _level_offsets[level + 1]; ++i) {
+                Node &node = _nodes[_internal_nodes[i]];
+                const Node *children = &_nodes[node.first_child];
+                node.first_body = children[0].first_body;
+                node.body_count = 0;
+                for (std::uint32_t k = 0; k < 8; ++k) {
+                    node.first_body
+                        = std::min(node.first_body, children[k].first_body);
+                    node.body_count += children[k].body_count;
+                }
+            }
+        }
+        for (std::size_t i = 1; i < _internal_nodes.size(); ++i) {
+            Node &node = _nodes[_internal_nodes[i]];
+            if (node.body_count > bucket_size)
+                continue;
+            node.first_child = null_index;
+            is_merged = true;
+        }
+
+        // Leafs that gathered too many bodies are split in place, their
+        // children go to the end of the arena until the relayout
+        const std::size_t node_count = _nodes.size();
+        const float root_width = _nodes[0].width;
+        for (auto leaf : _leaves) {
+            const Node &l = _nodes[leaf];
+            if (l.body_count <= max_leaf_occupancy)
+                continue;
+            const std::uint32_t depth = std::ilogb(root_width / l.width);
+            build_node(leaf, l.first_body, l.first_body + l.body_count, depth);
+        }
+        if (is_merged || _nodes.size() != node_count) {
+            relayout_nodes();
+            link_nodes();
+            prepare_refit();
+        }
+    }
+
+    ++_refits;
+    update_moments();
+    compute_multipoles();
+    return true;
+}
+
+void LinearOcTree::prepare_refit() {
+    _leaves.clear();
+    _internal_nodes.clear();
+    _level_offsets.clear();
+    _level_offsets.push_back(0);
+    if (_nodes[0].is_leaf()) {
+        _leaves.push_back(0);
+    }
+    else {
+        // Breadth-first walk, so _internal_nodes ends up grouped by depth
+        _internal_nodes.push_back(0);
+        _level_offsets.push_back(1);
+        std::size_t level_begin = 0;
+        while (level_begin < _internal_nodes.size()) {
+            const std::size_t level_end = _internal_nodes.size();
+            for (std::size_t i = level_begin; i < level_end; ++i) {
+                const std::uint32_t first_child
+                    = _nodes[_internal_nodes[i]].first_child;
+                for (std::uint32_t k = 0; k < 8; ++k) {
+                    if (_nodes[first_child + k].is_leaf())
+                        _leaves.push_back(first_child + k);
+                    else
+                        _internal_nodes.push_back(first_child + k);
+                }
+            }
+            if (_internal_nodes.size() != level_end)
+                _level_offsets.push_back(_internal_nodes.size());
+            level_begin = level_end;
+        }
+        std::sort(_leaves.begin(), _leaves.end());
+    }
+
+    _body_leaf.assign(_body_count, null_index);
+    for (auto leaf : _leaves) {
+        const Node &l = _nodes[leaf];
+        for (std::uint32_t i = 0; i < l.body_count; ++i)
+            _body_leaf[_body_indices[l.first_body + i]] = leaf;
+    }
+    _scratch.resize(_body_indices.size());
+    _refit_ready = true;
+}
+
+void LinearOcTree::relayout_nodes() {
+    _node_arena_scratch.resize(_nodes.size());
+    _node_scratch.assign(_nodes.size(), null_index);
+    _node_scratch[0] = 0;
+    _node_arena_scratch.resize(relayout_node(0, 0, 1));
+    _nodes.swap(_node_arena_scratch);
+
+    // Lists recorded on the old arena, by group root and by entry
+    if (_lists_stale || _recorded_lists.empty())
+        return;
+    _recorded_lists.resize(_node_scratch.size());
+    std::vector<RecordedList> lists(_nodes.size());
+    for (std::uint32_t node = 0; node < _recorded_lists.size(); ++node) {
+        RecordedList &recorded = _recorded_lists[node];
+        if (!recorded.is_recorded)
+            continue;
+        // Nodes of merged subtrees are gone, so are the lists using them
+        const std::uint32_t target = _node_scratch[node];
+        if (target == null_index)
+            continue;
+        for (auto &entry : recorded.entries) {
+            const std::uint32_t moved = _node_scratch[entry & ~LIST_LEAF_BIT];
+            if (moved == null_index) {
+                recorded.is_recorded = false;
+                break;
+            }
+            entry = moved | (entry & LIST_LEAF_BIT);
+        }
+        lists[target] = std::move(recorded);
+    }
+    _recorded_lists.swap(lists);
+}
+
+std::uint32_t LinearOcTree::relayout_node(
+    std::uint32_t node, std::uint32_t target, std::uint32_t cursor
+) {
+    const Node &n = _nodes[node];
+    _node_arena_scratch[target] = n;
+    if (n.is_leaf())
+        return cursor;
+
+    const std::uint32_t first_child = cursor;
+    _node_arena_scratch[target].first_child = first_child;
+    for (std::uint32_t k = 0; k < 8; ++k)
+        _node_scratch[n.first_child + k] = first_child + k;
+    cursor += 8;
+    for (std::uint32_t k = 0; k < 8; ++k)
+        cursor = relayout_node(n.first_child + k, first_child + k, cursor);
+    return cursor;
+}
+
+void LinearOcTree::link_nodes() {
+    // Blocks of children always come after their parent, so a forward sweep
+    // links parents before their children
+    _nodes[0].next = null_index;
+    for (std::uint32_t i = 0; i < _nodes.size(); ++i) {
+        const Node &n = _nodes[i];
+        if (n.is_leaf())
+            continue;
+        for (std::uint32_t k = 0; k < 7; ++k)
+            _nodes[n.first_child + k].next = n.first_child + k + 1;
+        _nodes[n.first_child + 7].next = n.next;
+    }
+}
+
+std::uint32_t LinearOcTree::find_leaf(const glm::vec3 &pos) const {
+    const Node &root = _nodes[0];
+    const glm::vec3 cube_end = root.cube_start + root.width;
+    bool is_inside = pos.x >= root.cube_start.x && pos.y >= root.cube_start.y
+                     && pos.z >= root.cube_start.z && pos.x <= cube_end.x
+                     && pos.y <= cube_end.y && pos.z <= cube_end.z;
+    if (!is_inside)
+        return null_index;
+
+    std::uint32_t node = 0;
+    while (!_nodes[node].is_leaf()) {
+        const Node &n = _nodes[node];
+        node = n.first_child + octant(pos, n.cube_start + n.width * 0.5f);
+    }
+    return node;
+}
+
+void LinearOcTree::update_moments() {
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < _leaves.size(); ++i)
+        compute_moments(_leaves[i]);
+
+    for (std::size_t level = _level_offsets.size() - 1; level-- > 0;) {
+#pragma omp parallel for schedule(static)
+        for (std::uint32_t i = _level_offsets[level];
+             i < _level_offsets[level + 1]; ++i)
+            compute_moments(_internal_nodes[i]);
+    }
+}
+
+glm::vec3 LinearOcTree::net_acceleration_on_body(std::uint32_t body) const {
+    if (_nodes.empty())
+        return glm::vec3{0.0f, 0.0f, 0.0f};
+
+    return net_acceleration_at(_positions[body], body);
+}
+
+glm::vec3 LinearOcTree::net_acceleration_at(
+    const glm::vec3 &pos, std::uint32_t body
+) const {
+    if (_nodes.empty())
+        return glm::vec3{0.0f, 0.0f, 0.0f};
+
+    return with_precision(precision, [&](auto p) {
+        return with_expansion(_multipole, [&](auto e) {
+            return with_flag(softening > 0.0f, [&](auto softened) {
+                return walk_acceleration<
+                    decltype(p)::value, decltype(e)::value,
+                    decltype(softened)::value>(pos, body);
+            });
+        });
+    });
+}
+
+template <
+    Precision precision, LinearOcTree::Multipole expansion, bool softened>
+glm::vec3 LinearOcTree::walk_acceleration(
+    const glm::vec3 &pos, std::uint32_t body
+) const {
+    using Scalar = typename PrecisionTypes<precision>::Scalar;
+    using Accumulator = typename PrecisionTypes<precision>::Accumulator;
+    using Vector = glm::vec<3, Scalar>;
+    using Sum = glm::vec<3, Accumulator>;
+
+    const Scalar opening = static_cast<Scalar>(theta)
+                           * static_cast<Scalar>(OPENING_BMAX_SCALE);
+    const Scalar softening2
+        = static_cast<Scalar>(softening) * static_cast<Scalar>(softening);
+    Sum net_acceleration{0, 0, 0};
+
+    // Depth-first walk without a stack: descending goes to the first child
+    // and skipping a subtree follows its next link
+    const Node *nodes = _nodes.data();
+    std::uint32_t node = 0;
+    while (node != null_index) {
+        const Node &n = nodes[node];
+        // Massless subtrees add nothing, this also skips the subtrees a
+        // refit left without bodies
+        if (n.total_mass == 0.0f) {
+            node = n.next;
+            continue;
+        }
+
+        const bool is_leaf = n.is_leaf();
+        if (!is_leaf)
+            PREFETCH(&nodes[n.first_child]);
+
+        // Leafs with several bodies are approximated like internal nodes
+        if (!is_leaf || n.body_count > 1) {
+            const Vector offset = Vector{n.center_of_mass} - Vector{pos};
+            const Scalar r = std::sqrt(glm::dot(offset, offset));
+            if (static_cast<Scalar>(n.bmax) < opening * r
+                && are_boxes_apart(pos, pos, n.box_min, n.box_max)) {
+                const Scalar gravitational_acceleration
+                    = static_cast<Scalar>(G)
+                      * static_cast<Scalar>(n.total_mass) / (r * r * r);
+                net_acceleration += Sum{offset * gravitational_acceleration};
+                if constexpr (expansion != Multipole::Monopole) {
+                    if (n.body_count > 1)
+                        net_acceleration += Sum{multipole_acceleration<
+                            expansion>(node, pos - n.center_of_mass)};
+                }
+                node = n.next;
+                continue;
+            }
+        }
+
+        if (is_leaf) {
+            for (std::uint32_t i = 0; i < n.body_count; ++i) {
+                std::uint32_t other = _body_indices[n.first_body + i];
+                if (other != body)
+                    net_acceleration
+                        += Sum{point_acceleration<Scalar, softened>(
+                            pos, _positions[other], _masses[other],
+                            softening2
+                        )};
+            }
+            node = n.next;
+        }
+        else {
+            node = n.first_child;
+        }
+    }
+    return glm::vec3{net_acceleration};
+}
+
+void LinearOcTree::net_accelerations(
+    std::vector<glm::vec3> &accelerations,
+    const std::vector<std::uint8_t> *active
+) {
+    if (active == nullptr) {
+        accelerations.assign(_body_count, glm::vec3{0.0f, 0.0f, 0.0f});
+    }
+    else {
+        accelerations.resize(_body_count);
+#pragma omp parallel for schedule(static)
+        for (std::uint32_t i = 0; i < _body_count; ++i) {
+            if ((*active)[i])
+                accelerations[i] = glm::vec3{0.0f, 0.0f, 0.0f};
+        }
+    }
+    if (_nodes.empty())
+        return;
+
+    // Groups are the largest subtrees holding at most group_size bodies
+    _groups.clear();
+    std::uint32_t node = 0;
+    while (node != null_index) {
+        const Node &n = _nodes[node];
+        if (n.body_count == 0) {
+            node = n.next;
+        }
+        else if (n.is_leaf() || n.body_count <= group_size) {
+            _groups.push_back(node);
+            node = n.next;
+        }
+        else {
+            node = n.first_child;
+        }
+    }
+
+    // The instantiation is picked once, the loops below carry no checks of
+    // the precision or the expansion
+    with_precision(precision, [&](auto p) {
+        with_expansion(_multipole, [&](auto e) {
+            evaluate_groups<decltype(p)::value, decltype(e)::value>(
+                accelerations, active
+            );
+        });
+    });
+}
+
+template <Precision precision, LinearOcTree::Multipole expansion>
+void LinearOcTree::evaluate_groups(
+    std::vector<glm::vec3> &accelerations,
+    const std::vector<std::uint8_t> *active
+) {
+    _interaction_lists.resize(omp_get_max_threads());
+    const float softening2 = softening * softening;
+    // The recorded lists hold node indices, they are only valid while the
+    // tree keeps its shape. The TreePM cutoff is not recorded.
+    const bool reuse = reuse_lists && split_radius <= 0.0f;
+    if (reuse && _lists_stale) {
+        for (auto &recorded : _recorded_lists)
+            recorded.is_recorded = false;
+        _lists_stale = false;
+    }
+    // The arena may have changed since the lists were recorded
+    if (reuse)
+        _recorded_lists.resize(_nodes.size());
+    std::size_t walked = 0;
+#pragma omp parallel reduction(+ : walked)
+    {
+        InteractionList &list = _interaction_lists[omp_get_thread_num()];
+
+#pragma omp for schedule(dynamic)
+        for (std::size_t g = 0; g < _groups.size(); ++g) {
+            const std::uint32_t group = _groups[g];
+            walked += build_interaction_list<expansion>(
+                group, list, active, reuse ? &_recorded_lists[group] : nullptr
+            );
+
+            for (auto body : list.bodies)
+                accelerations[body] = list_acceleration<precision, expansion>(
+                    list, _positions[body], softening2
+                );
+        }
+    }
+    _walked_groups = walked;
+}
+
+void LinearOcTree::field_accelerations(
+    const std::vector<glm::vec3> &targets,
+    std::vector<glm::vec3> &accelerations
+) {
+    const std::uint32_t n = targets.size();
+    accelerations.assign(n, glm::vec3{0.0f, 0.0f, 0.0f});
+    if (_nodes.empty() || n == 0)
+        return;
+
+    // Neighbours along the Morton curve are neighbours in space, targets
+    // outside of the root cube end up together in the last runs
+    const glm::vec3 cube_start = _nodes[0].cube_start;
+    const float width = _nodes[0].width;
+    _target_keys.resize(n);
+    _target_order.resize(n);
+#pragma omp parallel for schedule(static)
+    for (std::uint32_t i = 0; i < n; ++i) {
+        _target_keys[i] = morton_key(targets[i], cube_start, width);
+        _target_order[i] = i;
+    }
+    radix_sort(_target_keys, _target_order, _key_scratch, _target_scratch);
+
+    with_precision(precision, [&](auto p) {
+        with_expansion(_multipole, [&](auto e) {
+            evaluate_targets<decltype(p)::value, decltype(e)::value>(
+                targets, accelerations
+            );
+        });
+    });
+}
+
+template <Precision precision, LinearOcTree::Multipole expansion>
+void LinearOcTree::evaluate_targets(
+    const std::vector<glm::vec3> &targets,
+    std::vector<glm::vec3> &accelerations
+) {
+    _interaction_lists.resize(omp_get_max_threads());
+    const float softening2 = softening * softening;
+    const std::size_t n = targets.size();
+    const std::size_t runs = (n + group_size - 1) / group_size;
+#pragma omp parallel
+    {
+        InteractionList &list = _interaction_lists[omp_get_thread_num()];
+
+#pragma omp for schedule(dynamic)
+        for (std::size_t r = 0; r < runs; ++r) {
+            const std::size_t begin = r * group_size;
+            const std::size_t end = std::min(begin + group_size, n);
+            list.bodies.assign(
+                _target_order.begin() + begin, _target_order.begin() + end
+            );
+            glm::vec3 box_min{std::numeric_limits<float>::max()};
+            glm::vec3 box_max{std::numeric_limits<float>::lowest()};
+            for (auto t : list.bodies) {
+                box_min = glm::min(box_min, targets[t]);
+                box_max = glm::max(box_max, targets[t]);
+            }
+            fill_interaction_list<expansion>(box_min, box_max, list);
+
+            for (auto t : list.bodies)
+                accelerations[t] = list_acceleration<precision, expansion>(
+                    list, targets[t], softening2
+                );
+        }
+    }
+}
+
+template <Precision precision, LinearOcTree::Multipole expansion>
+glm::vec3 LinearOcTree::list_acceleration(
+    const InteractionList &list, const glm::vec3 &pos, float softening2
+) const {
+    if (split_radius > 0.0f) {
+        const glm::vec3 acceleration = short_range_sum_in<precision>(
+            list.x.data(), list.y.data(), list.z.data(), list.mass.data(),
+            list.mass.size(), pos, softening2, split_radius
+        );
+        return acceleration * static_cast<float>(G);
+    }
+
+    glm::vec3 acceleration = direct_sum_in<precision>(
+        list.x.data(), list.y.data(), list.z.data(), list.mass.data(),
+        list.mass.size(), pos, softening2
+    );
+    acceleration *= static_cast<float>(G);
+    if constexpr (expansion != Multipole::Monopole) {
+        if (!list.nodes.empty())
+            acceleration
+                += multipole_list_acceleration<expansion>(list, pos);
+    }
+    return acceleration;
+}
+
+template <LinearOcTree::Multipole expansion>
+glm::vec3 LinearOcTree::multipole_list_acceleration(
+    const InteractionList &list, const glm::vec3 &pos
+) const {
+    const float *columns = list.moments.data();
+    const std::size_t count = list.nodes.size();
+    const glm::vec3 acceleration
+        = sum_multipole_terms<expansion == Multipole::Octupole>(
+            columns, count, pos
+        );
+    return acceleration * static_cast<float>(G);
+}
+
+template <LinearOcTree::Multipole expansion>
+bool LinearOcTree::build_interaction_list(
+    std::uint32_t group, InteractionList &list,
+    const std::vector<std::uint8_t> *active, RecordedList *recorded
+) const {
+    list.bodies.clear();
+
+    // Bounding box of the bodies of the group
+    glm::vec3 box_min{std::numeric_limits<float>::max()};
+    glm::vec3 box_max{std::numeric_limits<float>::lowest()};
+    const std::uint32_t group_end = _nodes[group].next;
+    std::uint32_t node = group;
+    while (node != group_end) {
+        const Node &n = _nodes[node];
+        if (!n.is_leaf()) {
+            node = n.first_child;
+            continue;
+        }
+        for (std::uint32_t i = 0; i < n.body_count; ++i) {
+            const std::uint32_t b = _body_indices[n.first_body + i];
+            if (active != nullptr && !(*active)[b])
+                continue;
+
+            list.bodies.push_back(b);
+            box_min = glm::min(box_min, _positions[b]);
+            box_max = glm::max(box_max, _positions[b]);
+        }
+        node = n.next;
+    }
+    if (list.bodies.empty())
+        return false;
+
+    if (recorded == nullptr) {
+        fill_interaction_list<expansion>(box_min, box_max, list);
+        return true;
+    }
+
+    const bool is_inside
+        = glm::max(box_min, recorded->box_min) == box_min
+          && glm::min(box_max, recorded->box_max) == box_max;
+    if (recorded->is_recorded && is_inside
+        && refill_interaction_list<expansion>(
+            box_min, box_max, *recorded, list
+        ))
+        return false;
+
+    // Nodes accepted against the grown box stay accepted while the bodies
+    // are inside of it, unless the nodes themselves grow
+    const float margin = list_margin * _nodes[group].width;
+    recorded->box_min = box_min - margin;
+    recorded->box_max = box_max + margin;
+    recorded->is_recorded = true;
+    fill_interaction_list<expansion>(
+        recorded->box_min, recorded->box_max, list, &recorded->entries
+    );
+    return true;
+}
+
+template <LinearOcTree::Multipole expansion>
+void LinearOcTree::fill_interaction_list(
+    const glm::vec3 &box_min, const glm::vec3 &box_max, InteractionList &list,
+    std::vector<std::uint32_t> *entries
+) const {
+    list.x.clear();
+    list.y.clear();
+    list.z.clear();
+    list.mass.clear();
+    list.nodes.clear();
+    if (entries != nullptr)
+        entries->clear();
+
+    auto push = [&list](const glm::vec3 &pos, float mass) {
+        list.x.push_back(pos.x);
+        list.y.push_back(pos.y);
+        list.z.push_back(pos.z);
+        list.mass.push_back(mass);
+    };
+
+    // A node accepted against the closest point of the box is accepted for
+    // every position inside of it
+    const float opening = static_cast<float>(theta) * OPENING_BMAX_SCALE;
+    const bool is_split = split_radius > 0.0f;
+    const float cutoff = split_cutoff * split_radius;
+    std::uint32_t node = 0;
+    while (node != null_index) {
+        const Node &n = _nodes[node];
+        if (n.total_mass == 0.0f) {
+            // A refit may move bodies into it
+            if (entries != nullptr)
+                entries->push_back(node);
+            node = n.next;
+            continue;
+        }
+        if (is_split) {
+            // Nothing of the node is within the reach of the short range sum
+            const glm::vec3 node_gap = glm::max(box_min - n.box_max, 0.0f)
+                                       + glm::max(n.box_min - box_max, 0.0f);
+            if (glm::dot(node_gap, node_gap) > cutoff * cutoff) {
+                node = n.next;
+                continue;
+            }
+        }
+
+        const bool is_leaf = n.is_leaf();
+        if (!is_leaf)
+            PREFETCH(&_nodes[n.first_child]);
+
+        const glm::vec3 gap = glm::max(box_min - n.center_of_mass, 0.0f)
+                              + glm::max(n.center_of_mass - box_max, 0.0f);
+        if (n.bmax < opening * glm::length(gap)
+            && are_boxes_apart(box_min, box_max, n.box_min, n.box_max)) {
+            push(n.center_of_mass, n.total_mass);
+            if constexpr (expansion != Multipole::Monopole) {
+                if (n.body_count > 1 && !is_split)
+                    list.nodes.push_back(node);
+            }
+            if (entries != nullptr)
+                entries->push_back(node);
+            node = n.next;
+        }
+        else if (is_leaf) {
+            for (std::uint32_t i = 0; i < n.body_count; ++i) {
+                const std::uint32_t b = _body_indices[n.first_body + i];
+                push(_positions[b], _masses[b]);
+            }
+            if (entries != nullptr)
+                entries->push_back(node | LIST_LEAF_BIT);
+            node = n.next;
+        }
+        else {
+            node = n.first_child;
+        }
+    }
+
+    if constexpr (expansion != Multipole::Monopole)
+        fill_moment_columns(list);
+}
+
+template <LinearOcTree::Multipole expansion>
+bool LinearOcTree::refill_interaction_list(
+    const glm::vec3 &box_min, const glm::vec3 &box_max,
+    const RecordedList &recorded, InteractionList &list
+) const {
+    list.x.clear();
+    list.y.clear();
+    list.z.clear();
+    list.mass.clear();
+    list.nodes.clear();
+
+    // Leafs read their current bodies, so bodies that changed leaf since
+    // the walk are still summed exactly once
+    const float opening = static_cast<float>(theta) * OPENING_BMAX_SCALE;
+    for (auto entry : recorded.entries) {
+        const std::uint32_t node = entry & ~LIST_LEAF_BIT;
+        const Node &n = _nodes[node];
+        if (entry & LIST_LEAF_BIT) {
+            // Split by a refit since the walk
+            if (!n.is_leaf())
+                return false;
+            for (std::uint32_t i = 0; i < n.body_count; ++i) {
+                const std::uint32_t b = _body_indices[n.first_body + i];
+                list.x.push_back(_positions[b].x);
+                list.y.push_back(_positions[b].y);
+                list.z.push_back(_positions[b].z);
+                list.mass.push_back(_masses[b]);
+            }
+            continue;
+        }
+        if (n.total_mass == 0.0f)
+            continue;
+
+        const glm::vec3 gap = glm::max(box_min - n.center_of_mass, 0.0f)
+                              + glm::max(n.center_of_mass - box_max, 0.0f);
+        if (!(n.bmax < opening * glm::length(gap))
+            || !are_boxes_apart(box_min, box_max, n.box_min, n.box_max))
+            return false;
+
+        list.x.push_back(n.center_of_mass.x);
+        list.y.push_back(n.center_of_mass.y);
+        list.z.push_back(n.center_of_mass.z);
+        list.mass.push_back(n.total_mass);
+        if constexpr (expansion != Multipole::Monopole) {
+            if (n.body_count > 1)
+                list.nodes.push_back(node);
+        }
+    }
+
+    if constexpr (expansion != Multipole::Monopole)
+        fill_moment_columns(list);
+    return true;
+}
+
+void LinearOcTree::fill_moment_columns(InteractionList &list) const {
+    // Columns of centers of mass and moments of the accepted nodes
+    const std::size_t count = list.nodes.size();
+    list.moments.resize(19 * count);
+    for (std::size_t j = 0; j < count; ++j) {
+        const std::uint32_t node = list.nodes[j];
+        const Multipoles &m = _multipoles[node];
+        for (int c = 0; c < 3; ++c)
+            list.moments[c * count + j] = _nodes[node].center_of_mass[c];
+        for (int c = 0; c < 6; ++c)
+            list.moments[(3 + c) * count + j] = m.second[c];
+        for (int c = 0; c < 10; ++c)
+            list.moments[(9 + c) * count + j] = m.third[c];
+    }
+}
+
+std::size_t LinearOcTree::walked_groups() const {
+    return _walked_groups;
+}
+
+std::size_t LinearOcTree::group_count() const {
+    return _groups.size();
+}
+
+const std::vector<LinearOcTree::Node> &LinearOcTree::nodes() const {
+    return _nodes;
+}
+
+const std::vector<std::uint32_t> &LinearOcTree::body_indices() const {
+    return _body_indices;
+}
+
+std::size_t LinearOcTree::memory_usage() const {
+    return _nodes.size() * sizeof(Node)
+           + _body_indices.size() * sizeof(std::uint32_t);
+}
@@ -1,6 +1,10 @@
+#include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <regex>
+#include <stdexcept>
+#include <string>
 
 #include "app.hpp"
 
@@ -48,6 +52,14 @@ int main(int argc, char **argv) {
 
     Mode mode = Mode::Simulate;
     bool use_grav_grid = false;
+    bool use_morton = false;
+    bool use_refit = false;
+    bool use_reuse_lists = false;
+    bool use_kd_tree = false;
+    bool use_hermite = false;
+    bool use_tree_pm = false;
+    unsigned long reorder_interval = 0;
+    std::string integrator;
 
     for (int i = 2; i < argc; ++i) {
         std::string arg = argv[i];
@@ -67,6 +79,51 @@ int main(int argc, char **argv) {
         else if (arg == "--grav-grid") {
             use_grav_grid = true;
         }
+        else if (arg == "--morton") {
+            use_morton = true;
+        }
+        else if (arg == "--refit") {
+            use_morton = true;
+            use_refit = true;
+        }
+        else if (arg == "--reuse-lists") {
+            use_morton = true;
+            use_refit = true;
+            use_reuse_lists = true;
+        }
+        else if (arg == "--kdtree") {
+            use_kd_tree = true;
+        }
+        else if (arg == "--hermite") {
+            use_hermite = true;
+        }
+        else if (arg == "--treepm") {
+            use_tree_pm = true;
+        }
+        else if (arg == "--integrator" && i + 1 < argc) {
+            integrator = argv[++i];
+        }
+        else if (arg == "--reorder" && i + 1 < argc) {
+            const std::string value = argv[++i];
+            bool is_valid = true;
+            try {
+                reorder_interval = std::stoul(value);
+            }
+            catch (const std::invalid_argument &) {
+                is_valid = false;
+            }
+            catch (const std::out_of_range &) {
+                is_valid = false;
+            }
+            if (!is_valid
+                || reorder_interval
+                       > std::numeric_limits<std::uint32_t>::max()) {
+                std::cerr << "Invalid step count for --reorder: " << value
+                          << '\n';
+                std::cerr << "Use --help for usage information.\n";
+                return 1;
+            }
+        }
         else if (arg == "--version") {
             std::cout << title << std::endl;
             return 0;
@@ -81,6 +138,23 @@ int main(int argc, char **argv) {
                 << "  --benchmark    Benchmark all simulation algorithms\n"
                 << "  --grav-grid    Enable gravitational grid (simulation "
                    "only)\n"
+                << "  --morton       Build the octree in parallel from Morton "
+                   "keys\n"
+                << "  --refit        Like --morton, but refit the octree "
+                   "between steps\n"
+                << "  --reuse-lists  Like --refit, but keep the interaction "
+                   "lists between steps\n"
+                << "  --kdtree       Use a kd-tree instead of the octree, for "
+                   "clustered bodies\n"
+                << "  --hermite      Hermite integration with adaptive steps, "
+                   "for few bodies\n"
+                << "  --treepm       Long range gravity from a mesh, short "
+                   "range from the octree\n"
+                << "  --integrator   euler, leapfrog, yoshida, block or "
+                   "wisdom-holman,\n"
+                   "                 overrides the config\n"
+                << "  --reorder N    Sort the bodies along a Morton curve "
+                   "every N steps\n"
                 << "  --version      Show version\n"
                 << "  --help         Show this help message\n";
             return 0;
@@ -96,6 +170,27 @@ int main(int argc, char **argv) {
     app.set_title(title);
     app.set_window_size(800, 800);
     app.set_color(0x10, 0x10, 0x10);
+    if (use_morton) {
+        app.bodies_system->tree_builder
+            = CelestialBodySystem::TreeBuilder::Morton;
+        app.bodies_system->octree_refit = use_refit;
+        app.bodies_system->linear_octree.reuse_lists = use_reuse_lists;
+    }
+    if (use_kd_tree) {
+        app.bodies_system->tree_builder
+            = CelestialBodySystem::TreeBuilder::KdTree;
+    }
+    if (use_hermite) {
+        app.bodies_system->algorithm
+            = CelestialBodySystem::SimulationAlgorithm::Hermite;
+    }
+    if (use_tree_pm) {
+        app.bodies_system->algorithm
+            = CelestialBodySystem::SimulationAlgorithm::TreePM;
+    }
+    if (reorder_interval > 0)
+        app.bodies_system->reorder_interval = reorder_interval;
+    app.integrator = integrator;
 
     const std::string json_path = argv[1];
 
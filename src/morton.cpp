@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <omp.h>
+
+#include "morton.hpp"
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+void radix_sort(
+    std::vector<std::uint64_t> &keys, std::vector<std::uint32_t> &values,
+    std::vector<std::uint64_t> &key_scratch,
+    std::vector<std::uint32_t> &value_scratch
+) {
+    const std::size_t n = keys.size();
+    if (n == 0)
+        return;
+
+    key_scratch.resize(n);
+    value_scratch.resize(n);
+
+    const int max_threads = omp_get_max_threads();
+    std::vector<std::size_t> histograms(
+        static_cast<std::size_t>(max_threads) * RADIX_BUCKETS
+    );
+
+    for (int shift = 0; shift < 64; shift += RADIX_BITS) {
+        bool is_sorted_digit = false;
+
+#pragma omp parallel
+        {
+            const int thread = omp_get_thread_num();
+            const int threads = omp_get_num_threads();
+            const std::size_t begin = n * thread / threads;
+            const std::size_t end = n * (thread + 1) / threads;
+            std::size_t *histogram = &histograms[thread * RADIX_BUCKETS];
+
+            std::fill(histogram, histogram + RADIX_BUCKETS, 0);
+            for (std::size_t i = begin; i < end; ++i)
+                ++histogram[(keys[i] >> shift) & (RADIX_BUCKETS - 1)];
+
+#pragma omp barrier
+#pragma omp single
+            {
+                // Turns the per thread histograms into scatter offsets, bucket
+                // major so the sort stays stable
+                std::size_t offset = 0;
+                for (int digit = 0; digit < RADIX_BUCKETS; ++digit) {
+                    std::size_t digit_total = 0;
+                    for (int t = 0; t < threads; ++t) {
+                        std::size_t &entry
+                            = histograms[t * RADIX_BUCKETS + digit];
+                        std::size_t count = entry;
+                        entry = offset;
+                        offset += count;
+                        digit_total += count;
+                    }
+                    if (digit_total == n)
+                        is_sorted_digit = true;
+                }
+            }
+
+            if (!is_sorted_digit) {
+                for (std::size_t i = begin; i < end; ++i) {
+                    std::size_t dst
+                        = histogram[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+                    key_scratch[dst] = keys[i];
+                    value_scratch[dst] = values[i];
+                }
+            }
+        }
+
+        if (!is_sorted_digit) {
+            keys.swap(key_scratch);
+            values.swap(value_scratch);
+        }
+    }
+}
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <cstdlib>
 #include <iostream>
 #include <memory>
@@ -9,9 +10,19 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/string_cast.hpp>
 
-#include "celestial_body.hpp"
+#include "body_store.hpp"
+#include "constants.hpp"
 #include "octree.hpp"
 
+#define UNUSED(x) (void)(x)
+
+/** Children in lane order, right on bit 2, up on bit 1 and front on bit 0 **/
+static std::unique_ptr<OcTree::Node> OcTree::Node::*const children[8] = {
+    &OcTree::Node::lbb, &OcTree::Node::lbf, &OcTree::Node::lub,
+    &OcTree::Node::luf, &OcTree::Node::rbb, &OcTree::Node::rbf,
+    &OcTree::Node::rub, &OcTree::Node::ruf
+};
+
 // ---- OCTREE NODE ----
 
 OcTree::Node::Node() {
@@ -22,47 +33,52 @@ OcTree::Node::Node(glm::vec3 cube_start, float width) :
   width{width} {
 }
 
-void OcTree::Node::insert(const std::shared_ptr<CelestialBody> &body) {
+void OcTree::Node::insert(const BodyStore &bodies, std::uint32_t body) {
     float m1 = total_mass;
-    float m2 = body->mass();
+    float m2 = bodies.masses()[body];
     glm::vec3 x1 = center_of_mass;
-    glm::vec3 x2 = body->pos;
+    glm::vec3 x2 = bodies.positions()[body];
 
     if (is_leaf) {
-        if (Node::body == nullptr) {
+        if (Node::body == BodyStore::null_index) {
             center_of_mass = x2;
             total_mass = m2;
+            box_min = x2;
+            box_max = x2;
             Node::body = body;
             return;
         }
-        else if (Node::body->is_colliding(*body)) {
-            Node::body->collide(body);
-            if (body->merged) {
-                center_of_mass = Node::body->pos;
-                total_mass += m2;
-                return;
-            }
+        else if (bodies.positions()[Node::body] == x2) {
+            // Splitting can't separate bodies on the same position
+            total_mass += m2;
+            return;
         }
 
         // split must be the first!
-        split();
+        split(bodies);
         center_of_mass = (m1 * x1 + m2 * x2) / (m1 + m2);
         total_mass += m2;
+        box_min = glm::min(box_min, x2);
+        box_max = glm::max(box_max, x2);
 
-        auto &correct_node = find_correct_child(x2);
-        correct_node->insert(body);
+        const std::uint32_t lane = child_index(x2);
+        child(lane)->insert(bodies, body);
+        refresh_child(lane);
         return;
     }
 
     center_of_mass = (m1 * x1 + m2 * x2) / (m1 + m2);
     total_mass += m2;
+    box_min = glm::min(box_min, x2);
+    box_max = glm::max(box_max, x2);
 
-    auto &correct_node = find_correct_child(x2);
-    correct_node->insert(body);
+    const std::uint32_t lane = child_index(x2);
+    child(lane)->insert(bodies, body);
+    refresh_child(lane);
 }
 
-void OcTree::Node::split() {
-    if (!is_leaf || body == nullptr)
+void OcTree::Node::split(const BodyStore &bodies) {
+    if (!is_leaf || body == BodyStore::null_index)
         return;
 
     float new_width = width * 0.5f;
@@ -107,91 +123,153 @@ void OcTree::Node::split() {
         new_width
     );
 
-    auto &correct_node = find_correct_child(body->pos);
+    auto &correct_node = find_correct_child(bodies.positions()[body]);
     std::swap(correct_node->body, body);
     correct_node->center_of_mass = center_of_mass;
     correct_node->total_mass = total_mass;
+    correct_node->box_min = box_min;
+    correct_node->box_max = box_max;
 
     is_leaf = false;
+    for (std::uint32_t lane = 0; lane < 8; ++lane)
+        refresh_child(lane);
 }
 
 std::unique_ptr<OcTree::Node> &
 OcTree::Node::find_correct_child(const glm::vec3 &pos) {
-    glm::vec3 mid = cube_start + width * 0.5f;
-    if (pos.x > mid.x) {
-        if (pos.y > mid.y) {
-            if (pos.z > mid.z)
-                return ruf;
-            else
-                return rub;
-        }
-        else {
-            if (pos.z > mid.z)
-                return rbf;
-            else
-                return rbb;
-        }
-    }
-    else {
-        if (pos.y > mid.y) {
-            if (pos.z > mid.z)
-                return luf;
-            else
-                return lub;
-        }
-        else {
-            if (pos.z > mid.z)
-                return lbf;
-            else
-                return lbb;
-        }
+    return child(child_index(pos));
+}
+
+std::uint32_t OcTree::Node::child_index(const glm::vec3 &pos) const {
+    const glm::vec3 mid = cube_start + width * 0.5f;
+    return (pos.x > mid.x ? 4u : 0u) | (pos.y > mid.y ? 2u : 0u)
+           | (pos.z > mid.z ? 1u : 0u);
+}
+
+std::unique_ptr<OcTree::Node> &OcTree::Node::child(std::uint32_t lane) {
+    return this->*children[lane];
+}
+
+const std::unique_ptr<OcTree::Node> &
+OcTree::Node::child(std::uint32_t lane) const {
+    return this->*children[lane];
+}
+
+void OcTree::Node::refresh_child(std::uint32_t lane) {
+    const Node &c = *child(lane);
+    if (c.is_leaf && c.body == BodyStore::null_index) {
+        // Empty, its center of mass was never set
+        child_x[lane] = 0.0f;
+        child_y[lane] = 0.0f;
+        child_z[lane] = 0.0f;
+        child_mass[lane] = 0.0f;
+        child_bmax[lane] = 0.0f;
+        return;
     }
+
+    child_x[lane] = c.center_of_mass.x;
+    child_y[lane] = c.center_of_mass.y;
+    child_z[lane] = c.center_of_mass.z;
+    child_mass[lane] = static_cast<float>(c.total_mass);
+    child_bmax[lane] = 0.0f;
+    if (!c.is_leaf)
+        child_bmax[lane] = opening_size(
+            opening, c.center_of_mass, c.box_min, c.box_max, c.width
+        );
 }
 
-glm::vec3 OcTree::Node::net_acceleration_on_body(
-    std::shared_ptr<CelestialBody> body, double dt
+template <Precision precision, bool softened>
+glm::vec<3, typename PrecisionTypes<precision>::Accumulator>
+OcTree::Node::net_acceleration_on_body(
+    const BodyStore &bodies, std::uint32_t body, float softening2,
+    bool can_accept_held
 ) const {
-    if (body->merged) {
-        return glm::vec3{0.0f, 0.0f, 0.0f};
-    }
+    using Scalar = typename PrecisionTypes<precision>::Scalar;
+    using Accumulator = typename PrecisionTypes<precision>::Accumulator;
+    using Sum = glm::vec<3, Accumulator>;
 
+    // Removed bodies are never inserted, see OcTree::insert
+    const glm::vec3 &pos = bodies.positions()[body];
     if (is_leaf) {
-        if (Node::body == nullptr || Node::body == body || Node::body->merged)
-            return glm::vec3{0.0f, 0.0f, 0.0f};
+        if (Node::body == BodyStore::null_index || Node::body == body)
+            return Sum{0, 0, 0};
 
-        return body->calculate_acceleration_vec(*Node::body);
+        return Sum{point_acceleration<Scalar, softened>(
+            pos, bodies.positions()[Node::body], bodies.masses()[Node::body],
+            static_cast<Scalar>(softening2)
+        )};
     }
-    else if (ratio_width_distance(body->pos) < theta) {
-        return body->calculate_acceleration_vec(center_of_mass, total_mass);
+
+    // One pass over the lanes of the eight children: leaves and the nodes
+    // far enough are summed as point masses, the others are opened after.
+    // Sources at distance zero, the body itself included, add nothing.
+    const Scalar px = pos.x;
+    const Scalar py = pos.y;
+    const Scalar pz = pos.z;
+    const Scalar opening = static_cast<Scalar>(theta)
+                           * static_cast<Scalar>(OPENING_BMAX_SCALE);
+    const Scalar opening2 = opening * opening;
+    const Scalar eps2 = softening2;
+    Accumulator ax = 0;
+    Accumulator ay = 0;
+    Accumulator az = 0;
+    Scalar opened[8];
+#pragma omp simd reduction(+ : ax, ay, az)
+    for (std::uint32_t lane = 0; lane < 8; ++lane) {
+        const Scalar dx = static_cast<Scalar>(child_x[lane]) - px;
+        const Scalar dy = static_cast<Scalar>(child_y[lane]) - py;
+        const Scalar dz = static_cast<Scalar>(child_z[lane]) - pz;
+        Scalar r2 = dx * dx + dy * dy + dz * dz;
+        const Scalar b = child_bmax[lane];
+        const Scalar accepted = b * b < opening2 * r2;
+        // Only the leaves, single bodies, are softened
+        if constexpr (softened)
+            r2 += eps2 * (b == Scalar{0});
+        const Scalar inv_r
+            = accepted / std::sqrt(r2 + (Scalar{1} - accepted));
+        const Scalar s = static_cast<Scalar>(child_mass[lane]) * inv_r
+                         * inv_r * inv_r;
+        ax += dx * s;
+        ay += dy * s;
+        az += dz * s;
+        opened[lane] = (b > Scalar{0}) * (Scalar{1} - accepted);
     }
 
-    glm::vec3 net_acceleration{0.0f, 0.0f, 0.0f};
-    if (luf->should_be_called(body))
-        net_acceleration += luf->net_acceleration_on_body(body, dt);
-    if (lub->should_be_called(body))
-        net_acceleration += lub->net_acceleration_on_body(body, dt);
-    if (lbf->should_be_called(body))
-        net_acceleration += lbf->net_acceleration_on_body(body, dt);
-    if (lbb->should_be_called(body))
-        net_acceleration += lbb->net_acceleration_on_body(body, dt);
-    if (ruf->should_be_called(body))
-        net_acceleration += ruf->net_acceleration_on_body(body, dt);
-    if (rub->should_be_called(body))
-        net_acceleration += rub->net_acceleration_on_body(body, dt);
-    if (rbf->should_be_called(body))
-        net_acceleration += rbf->net_acceleration_on_body(body, dt);
-    if (rbb->should_be_called(body))
-        net_acceleration += rbb->net_acceleration_on_body(body, dt);
-    return net_acceleration;
-}
+    // Only the child whose cube holds pos can hold it in its tight box. If
+    // that child passed the test anyway, its point mass is taken back and
+    // it is opened
+    const std::uint32_t held = can_accept_held ? child_index(pos) : 8;
+    if (held < 8 && opened[held] == Scalar{0} && child_bmax[held] > Scalar{0}
+        && !are_boxes_apart(
+            pos, pos, child(held)->box_min, child(held)->box_max
+        )) {
+        const Scalar dx = static_cast<Scalar>(child_x[held]) - px;
+        const Scalar dy = static_cast<Scalar>(child_y[held]) - py;
+        const Scalar dz = static_cast<Scalar>(child_z[held]) - pz;
+        const Scalar inv_r = Scalar{1} / std::sqrt(dx * dx + dy * dy + dz * dz);
+        const Scalar s
+            = static_cast<Scalar>(child_mass[held]) * inv_r * inv_r * inv_r;
+        ax -= dx * s;
+        ay -= dy * s;
+        az -= dz * s;
+        opened[held] = Scalar{1};
+    }
 
-double OcTree::Node::ratio_width_distance(const glm::vec3 &pos) const {
-    return width / glm::distance(pos, center_of_mass);
+    Sum net_acceleration
+        = Sum{ax, ay, az} * static_cast<Accumulator>(G);
+    for (std::uint32_t lane = 0; lane < 8; ++lane) {
+        if (opened[lane] != Scalar{0})
+            net_acceleration
+                += child(lane)->net_acceleration_on_body<precision, softened>(
+                    bodies, body, softening2, can_accept_held
+                );
+    }
+    return net_acceleration;
 }
 
 std::ostream &operator<<(std::ostream &os, OcTree::Node node) {
     std::cout << "[ " << glm::to_string(node.cube_start) << ", " << node.width
-              << ", " << node.body.get() << ", "
+              << ", " << node.body << ", "
               << glm::to_string(node.center_of_mass) << ", " << node.total_mass
               << ", " << node.is_leaf << " ]" << std::endl;
 
@@ -236,7 +314,7 @@ operator<<(std::ostream &os, std::unique_ptr<OcTree::Node> &node) {
         return os;
 
     std::cout << "[ " << glm::to_string(node->cube_start) << ", " << node->width
-              << ", " << node->body.get() << ", "
+              << ", " << node->body << ", "
               << glm::to_string(node->center_of_mass) << ", "
               << node->total_mass << ", " << node->is_leaf << " ]" << std::endl;
 
@@ -275,54 +353,97 @@ operator<<(std::ostream &os, std::unique_ptr<OcTree::Node> &node) {
     return os;
 }
 
-bool OcTree::Node::should_be_called(
-    const std::shared_ptr<CelestialBody> &other
-) const {
-    return !(is_leaf && (body == nullptr || body == other || body->merged));
-}
-
 // ---- OCTREE ----
 
 double OcTree::theta = 1.0;
+Opening OcTree::opening = Opening::Bmax;
+float OcTree::softening = 0.0f;
 
 OcTree::OcTree() {
 }
 
-OcTree::OcTree(float initial_coord) {
+OcTree::OcTree(const BodyStore &bodies, float initial_coord) :
+  _bodies{&bodies} {
     if (initial_coord == 0)
         return;
     else if (initial_coord > 0)
         initial_coord = -initial_coord;
 
-    OcTree::initial_coord = initial_coord;
-    initial_width = std::abs(2 * OcTree::initial_coord);
+    initial_cube_start = glm::vec3{initial_coord, initial_coord, initial_coord};
+    initial_width = std::abs(2 * initial_coord);
 }
 
-void OcTree::insert(const std::shared_ptr<CelestialBody> &body) {
+OcTree::OcTree(
+    const BodyStore &bodies, const glm::vec3 &cube_start, float width
+) :
+  initial_cube_start{cube_start},
+  initial_width{width},
+  _bodies{&bodies} {
+}
+
+void OcTree::insert(std::uint32_t body) {
+    const glm::vec3 &pos = _bodies->positions()[body];
+    bool should_erase = !contains(pos) || _bodies->is_removed(body);
+    if (should_erase)
+        return;
+
     if (root == nullptr) {
-        root = std::make_unique<Node>(
-            glm::vec3{initial_coord, initial_coord, initial_coord},
-            initial_width
-        );
-        root->center_of_mass = body->pos;
-        root->total_mass = body->mass();
+        root = std::make_unique<Node>(initial_cube_start, initial_width);
+        root->center_of_mass = pos;
+        root->total_mass = _bodies->masses()[body];
         root->body = body;
     }
     else {
-        bool should_erase = std::abs(body->pos.x) > initial_width / 2
-                            || std::abs(body->pos.y) > initial_width / 2
-                            || std::abs(body->pos.z) > initial_width / 2
-                            || body->merged;
-        if (!should_erase)
-            root->insert(body);
+        root->insert(*_bodies, body);
     }
 }
 
-glm::vec3 OcTree::net_acceleration_on_body(
-    std::shared_ptr<CelestialBody> body, double dt
-) const {
-    if (root == nullptr || body->merged)
+bool OcTree::contains(const glm::vec3 &pos) const {
+    const glm::vec3 cube_end = initial_cube_start + initial_width;
+    return pos.x >= initial_cube_start.x && pos.y >= initial_cube_start.y
+           && pos.z >= initial_cube_start.z && pos.x <= cube_end.x
+           && pos.y <= cube_end.y && pos.z <= cube_end.z;
+}
+
+glm::vec3
+OcTree::net_acceleration_on_body(std::uint32_t body, double dt) const {
+    UNUSED(dt);
+    return with_flag(softening > 0.0f, [&](auto softened) {
+        return net_acceleration_on_body<
+            Precision::Float, decltype(softened)::value>(body);
+    });
+}
+
+template <Precision precision, bool softened>
+glm::vec3 OcTree::net_acceleration_on_body(std::uint32_t body) const {
+    if (root == nullptr || _bodies->is_removed(body))
         return glm::vec3{0.0f, 0.0f, 0.0f};
 
-    return root->net_acceleration_on_body(body, dt);
+    // A position in the tight box of a node is at most bmax from its center
+    // of mass, and at most the diagonal of its cube, twice the size of
+    // Opening::Width. Only a theta large enough accepts such a node
+    const double reach = opening == Opening::Width ? 2.0 : 1.0;
+    const bool can_accept_held = theta * OPENING_BMAX_SCALE * reach >= 1.0;
+    return glm::vec3{root->net_acceleration_on_body<precision, softened>(
+        *_bodies, body, softening * softening, can_accept_held
+    )};
 }
+
+template glm::vec3
+OcTree::net_acceleration_on_body<Precision::Float, false>(std::uint32_t body
+) const;
+template glm::vec3
+OcTree::net_acceleration_on_body<Precision::Float, true>(std::uint32_t body
+) const;
+template glm::vec3
+OcTree::net_acceleration_on_body<Precision::Mixed, false>(std::uint32_t body
+) const;
+template glm::vec3
+OcTree::net_acceleration_on_body<Precision::Mixed, true>(std::uint32_t body
+) const;
+template glm::vec3
+OcTree::net_acceleration_on_body<Precision::Double, false>(std::uint32_t body
+) const;
+template glm::vec3
+OcTree::net_acceleration_on_body<Precision::Double, true>(std::uint32_t body
+) const;
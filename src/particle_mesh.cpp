@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <omp.h>
+
+#include "constants.hpp"
+#include "fft.hpp"
+#include "particle_mesh.hpp"
+
+/** Nodes kept around the cube on each side, the cloud-in-cell stencil and
+ * the finite differences of the nodes next to the bodies stay inside **/
+#define MESH_MARGIN 2
+
+/**
+ * \brief Node of a cloud-in-cell stencil
+ * \param corner - corner of the cell, x on bit 0, y on bit 1, z on bit 2
+ * \returns offset of the node from the lower one
+ **/
+static glm::uvec3 corner_offset(std::uint32_t corner) {
+    return glm::uvec3{corner & 1, (corner >> 1) & 1, (corner >> 2) & 1};
+}
+
+/**
+ * \brief Weight of a node of a cloud-in-cell stencil
+ * \param corner - corner of the cell, x on bit 0, y on bit 1, z on bit 2
+ * \param weight - weight of the upper node on each axis
+ * \returns weight of the node
+ **/
+static float corner_weight(std::uint32_t corner, const glm::vec3 &weight) {
+    const float x = corner & 1 ? weight.x : 1.0f - weight.x;
+    const float y = corner & 2 ? weight.y : 1.0f - weight.y;
+    const float z = corner & 4 ? weight.z : 1.0f - weight.z;
+    return x * y * z;
+}
+
+void ParticleMesh::solve(
+    const std::vector<glm::vec3> &positions, const std::vector<float> &masses,
+    const glm::vec3 &cube_start, float width
+) {
+    const std::uint32_t n = grid_size;
+    const float spacing
+        = width / static_cast<float>(n - 1 - 2 * MESH_MARGIN);
+    const float split_radius = split_cells * spacing;
+    if (n != _size || spacing != _spacing || split_radius != _split_radius) {
+        _size = n;
+        _spacing = spacing;
+        _split_radius = split_radius;
+        compute_green();
+    }
+    _mesh_start = cube_start - static_cast<float>(MESH_MARGIN) * spacing;
+
+    // Cloud-in-cell deposit on the corner of the padded mesh
+    const std::size_t m = 2 * static_cast<std::size_t>(n);
+    std::fill(_padded.begin(), _padded.end(), std::complex<float>{});
+    float *padded = reinterpret_cast<float *>(_padded.data());
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        glm::uvec3 cell;
+        glm::vec3 weight;
+        stencil(positions[i], cell, weight);
+        for (std::uint32_t k = 0; k < 8; ++k) {
+            const glm::uvec3 c = cell + corner_offset(k);
+            const std::size_t index = (c.z * m + c.y) * m + c.x;
+#pragma omp atomic
+            padded[2 * index] += masses[i] * corner_weight(k, weight);
+        }
+    }
+
+    transform(false);
+    const std::size_t padded_count = m * m * m;
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < padded_count; ++i)
+        _padded[i] *= _green[i];
+    transform(true);
+
+    // The inverse transform is unscaled
+    const float scale
+        = static_cast<float>(G) / static_cast<float>(padded_count);
+    _potential.resize(static_cast<std::size_t>(n) * n * n);
+#pragma omp parallel for schedule(static)
+    for (std::uint32_t z = 0; z < n; ++z) {
+        for (std::uint32_t y = 0; y < n; ++y) {
+            for (std::uint32_t x = 0; x < n; ++x)
+                _potential[node(x, y, z)]
+                    = _padded[(z * m + y) * m + x].real() * scale;
+        }
+    }
+
+    // Four point differences, two point ones next to the border
+    _field.assign(_potential.size(), glm::vec3{0.0f, 0.0f, 0.0f});
+    const std::size_t strides[3] = {1, n, static_cast<std::size_t>(n) * n};
+#pragma omp parallel for schedule(static)
+    for (std::uint32_t z = 1; z < n - 1; ++z) {
+        for (std::uint32_t y = 1; y < n - 1; ++y) {
+            for (std::uint32_t x = 1; x < n - 1; ++x) {
+                const std::size_t i = node(x, y, z);
+                const std::uint32_t coords[3] = {x, y, z};
+                for (int axis = 0; axis < 3; ++axis) {
+                    const std::size_t s = strides[axis];
+                    float gradient
+                        = (_potential[i + s] - _potential[i - s]) * 0.5f;
+                    if (coords[axis] >= 2 && coords[axis] < n - 2)
+                        gradient
+                            = (8.0f * (_potential[i + s] - _potential[i - s])
+                               - (_potential[i + 2 * s] - _potential[i - 2 * s])
+                              )
+                              / 12.0f;
+                    _field[i][axis] = -gradient / _spacing;
+                }
+            }
+        }
+    }
+}
+
+void ParticleMesh::add_accelerations(
+    const std::vector<glm::vec3> &positions,
+    std::vector<glm::vec3> &accelerations,
+    const std::vector<std::uint8_t> *active
+) const {
+    if (_field.empty())
+        return;
+
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        if (active != nullptr && !(*active)[i])
+            continue;
+
+        glm::uvec3 cell;
+        glm::vec3 weight;
+        stencil(positions[i], cell, weight);
+        glm::vec3 acceleration{0.0f, 0.0f, 0.0f};
+        for (std::uint32_t k = 0; k < 8; ++k) {
+            const glm::uvec3 c = cell + corner_offset(k);
+            acceleration
+                += _field[node(c.x, c.y, c.z)] * corner_weight(k, weight);
+        }
+        accelerations[i] += acceleration;
+    }
+}
+
+float ParticleMesh::potential_at(const glm::vec3 &pos) const {
+    if (_potential.empty())
+        return 0.0f;
+
+    glm::uvec3 cell;
+    glm::vec3 weight;
+    stencil(pos, cell, weight);
+    float potential = 0.0f;
+    for (std::uint32_t k = 0; k < 8; ++k) {
+        const glm::uvec3 c = cell + corner_offset(k);
+        potential
+            += _potential[node(c.x, c.y, c.z)] * corner_weight(k, weight);
+    }
+    return potential;
+}
+
+float ParticleMesh::split_radius() const {
+    return _split_radius;
+}
+
+void ParticleMesh::compute_green() {
+    const std::size_t m = 2 * static_cast<std::size_t>(_size);
+    const std::size_t padded_count = m * m * m;
+    _twiddles = fft_twiddles(m);
+    _padded.assign(padded_count, std::complex<float>{});
+    _green.resize(padded_count);
+
+    // Distances wrap around the padded mesh, so the periodic convolution
+    // never mixes a node with the images of the others
+    const double inv_two_split = 0.5 / _split_radius;
+    const double center = -2.0 * inv_two_split / std::sqrt(M_PI);
+#pragma omp parallel for schedule(static)
+    for (std::size_t z = 0; z < m; ++z) {
+        for (std::size_t y = 0; y < m; ++y) {
+            for (std::size_t x = 0; x < m; ++x) {
+                const double dx = std::min(x, m - x) * double{_spacing};
+                const double dy = std::min(y, m - y) * double{_spacing};
+                const double dz = std::min(z, m - z) * double{_spacing};
+                const double r = std::sqrt(dx * dx + dy * dy + dz * dz);
+                const double g
+                    = r > 0.0 ? -std::erf(r * inv_two_split) / r : center;
+                _padded[(z * m + y) * m + x] = static_cast<float>(g);
+            }
+        }
+    }
+
+    // Every line holds data here, none is skipped
+    transform_axis(1, m, m * m, m, m, false);
+    transform_axis(m, 1, m * m, m, m, false);
+    transform_axis(m * m, 1, m, m, m, false);
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < padded_count; ++i)
+        _green[i] = _padded[i].real();
+}
+
+void ParticleMesh::transform(bool inverse) {
+    const std::size_t n = _size;
+    const std::size_t m = 2 * n;
+    if (!inverse) {
+        // Masses only fill the corner, x lines outside of it are zero and
+        // so are the y lines of the upper z planes
+        transform_axis(1, m, m * m, n, n, false);
+        transform_axis(m, 1, m * m, m, n, false);
+        transform_axis(m * m, 1, m, m, m, false);
+    }
+    else {
+        // Only the corner of the potential is read
+        transform_axis(m * m, 1, m, m, m, true);
+        transform_axis(m, 1, m * m, m, n, true);
+        transform_axis(1, m, m * m, n, n, true);
+    }
+}
+
+void ParticleMesh::transform_axis(
+    std::size_t stride, std::size_t line_stride, std::size_t plane_stride,
+    std::size_t lines, std::size_t planes, bool inverse
+) {
+    const std::size_t m = 2 * static_cast<std::size_t>(_size);
+    _lines.resize(omp_get_max_threads());
+#pragma omp parallel
+    {
+        std::vector<std::complex<float>> &line
+            = _lines[omp_get_thread_num()];
+        line.resize(m);
+
+#pragma omp for schedule(static) collapse(2)
+        for (std::size_t p = 0; p < planes; ++p) {
+            for (std::size_t l = 0; l < lines; ++l) {
+                std::complex<float> *first
+                    = _padded.data() + p * plane_stride + l * line_stride;
+                for (std::size_t i = 0; i < m; ++i)
+                    line[i] = first[i * stride];
+                fft(line.data(), m, _twiddles.data(), inverse);
+                for (std::size_t i = 0; i < m; ++i)
+                    first[i * stride] = line[i];
+            }
+        }
+    }
+}
+
+std::size_t ParticleMesh::node(
+    std::uint32_t x, std::uint32_t y, std::uint32_t z
+) const {
+    return (static_cast<std::size_t>(z) * _size + y) * _size + x;
+}
+
+void ParticleMesh::stencil(
+    const glm::vec3 &pos, glm::uvec3 &cell, glm::vec3 &weight
+) const {
+    // Positions past the last cell take its upper face
+    const float last = static_cast<float>(_size - 2);
+    const glm::vec3 p = (pos - _mesh_start) / _spacing;
+    for (int axis = 0; axis < 3; ++axis) {
+        const float coordinate = std::clamp(p[axis], 0.0f, last + 1.0f);
+        cell[axis] = static_cast<std::uint32_t>(std::min(coordinate, last));
+        weight[axis] = coordinate - static_cast<float>(cell[axis]);
+    }
+}